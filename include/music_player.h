@@ -6,9 +6,9 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-// Maximum playlist entries
-#define MAX_PLAYLIST_ENTRIES 256
-#define MAX_FILENAME_LENGTH 128
+// Longest song path below MUSIC_DIR, terminator included (the full path
+// has to fit the 256-byte path buffers)
+#define MAX_FILENAME_LENGTH 240
 
 // Music directory path
 #define MUSIC_DIR "/sd/music"
@@ -20,15 +20,15 @@ typedef enum {
     PLAYBACK_PAUSED,
 } playback_state_t;
 
-// Song info structure
+// Song info structure; the path is stored in the playlist's name chunks
 typedef struct {
-    char filename[MAX_FILENAME_LENGTH];
+    uint32_t name_offset;  // Where its path (relative to MUSIC_DIR) is stored
     uint32_t duration_ms;  // 0 if unknown
 } song_info_t;
 
-// Playlist structure
+// Playlist structure; the songs themselves are only accessed through playlist.h
+// because a background scan may still be adding to them
 typedef struct {
-    song_info_t songs[MAX_PLAYLIST_ENTRIES];
     int count;
     int current_index;
 } playlist_t;
@@ -40,7 +40,39 @@ typedef struct {
     uint32_t song_start_time;  // When current song started (tick ms)
     uint32_t current_position_ms;
     uint8_t volume;  // 0-100
+    volatile uint32_t version;  // Bumped by music_player_state_changed()
 } music_player_state_t;
 
 // Global state accessor
 music_player_state_t* music_player_get_state(void);
+
+// Note a change of the playback state, song, song count or volume, so the
+// status widget rebuilds its text
+void music_player_state_changed(void);
+
+// Queue playlist song index (0-based, as playlist.current_index) to play after
+// the current one, before the order continues; safe from any thread
+// Returns 0 on success, -1 if the index is invalid or the "up next" queue is full
+int music_player_add_up_next(int index);
+
+// Coarse spectrum bands in music_player_levels_t: MP3 subbands (each 1/64 of
+// the sample rate wide) 0, 1, 2, 3-4, 5-7, 8-11, 12-17 and 18-31
+#define MUSIC_PLAYER_BANDS 8
+
+// Levels of the frame last handed to I2S, as heard (volume included), on a
+// 0-32767 scale
+typedef struct {
+    uint32_t serial;        // Bumped for each frame published; unchanged means nothing new
+    uint32_t tick_ms;       // When it was published (asp_plugin_get_tick_ms)
+    uint32_t rate;          // Sample rate of the frame, 0 while nothing is heard
+    uint8_t channels;       // 1 or 2, 0 while nothing is heard (all levels 0)
+    uint16_t peak[2];       // Largest absolute sample per channel (mono: both alike)
+    uint16_t rms[2];        // RMS per channel
+    bool has_bands;         // bands is known (MP3 only)
+    uint16_t bands[MUSIC_PLAYER_BANDS];  // RMS per band; their squares add up to the mean square of rms
+} music_player_levels_t;
+
+// Copy the latest levels without blocking the audio threads; safe from any
+// thread (the status widget, other plugins). Returns false if none could be
+// read: nothing was published yet, it is being updated, or the tap is built out
+bool music_player_get_levels(music_player_levels_t* out);
@@ -1,21 +1,46 @@
 // SPDX-License-Identifier: MIT
 // Music Player Plugin - Audio Playback
-// Uses minimp3 for MP3 decoding and ASP audio API for output
+// Decodes MP3, FLAC and WAV through the decoders in decoder.h, outputs with the ASP audio API
 // Runs decoding in a separate pthread with larger stack to handle minimp3's stack usage
+// Decoded frames go through a PCM ring drained to I2S by a separate output thread
+// A queued next song is decoded right behind the current one (gapless playback)
+// Control requests reach the decoder thread through a command queue (audio_cmd.h)
+// Seeks are placed by the decoder of the track (a VBR TOC, frame index or seek table)
 
 #include "audio.h"
+#include "pcm_ring.h"
+#include "readahead.h"
+#include "decoder.h"
+#include "id3.h"
+#include "audio_cmd.h"
+#include "stats.h"
+#include "mem.h"
+#include "gain.h"
+#include "resample.h"
+#include "tap.h"
+#include "thread_util.h"
 #include "../include/music_player.h"
 #include "tanmatsu_plugin.h"
 #include <string.h>
 #include <stdio.h>
 #include <pthread.h>
 #include <stdlib.h>
-
-// Include minimp3 implementation
-#define MINIMP3_IMPLEMENTATION
-#define MINIMP3_ONLY_MP3
-#define MINIMP3_NO_SIMD
-#include "minimp3.h"
+#include <errno.h>
+#include <sched.h>
+
+// ESP-IDF's pthread config pins the next thread created to a core, and
+// FreeRTOS tells how deep a task's stack has been used
+#if defined(__has_include)
+#if __has_include("esp_pthread.h")
+#include "esp_pthread.h"
+#define HAVE_ESP_PTHREAD 1
+#endif
+#if __has_include("freertos/FreeRTOS.h")
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#define HAVE_FREERTOS 1
+#endif
+#endif
 
 // ASP audio API - available to plugins
 extern int asp_audio_set_rate(uint32_t rate_hz);
@@ -26,264 +51,825 @@ extern int asp_audio_stop(void);
 extern int asp_audio_start(void);
 extern int asp_audio_write(void* samples, size_t samples_size, int64_t timeout_ms);
 
-// Buffer sizes
-#define READ_BUFFER_SIZE    (16 * 1024)  // 16KB read buffer for file I/O (PSRAM)
-#define MAX_FRAME_SIZE      (1152 * 2)   // Max samples per MP3 frame (stereo)
-#define PCM_BUFFER_SIZE     (MAX_FRAME_SIZE * sizeof(int16_t))  // 4608 bytes
-
-// Decoder thread stack size - minimp3 needs >16KB of stack (measured)
-#define DECODER_STACK_SIZE  (32 * 1024)
+// Decoder thread stack size - minimp3's work area is its scratch, not the stack.
+// host_bench measures 10.9 KB on x86-64; bench mode reports the device's peak
+// (audio_get_decoder_stack), which this leaves a margin over
+#define DECODER_STACK_SIZE  (12 * 1024)
+
+// Output thread only moves PCM from the ring to I2S
+#define OUTPUT_STACK_SIZE   (4 * 1024)
+
+// Decoder thread priority, and the levels it is raised by while the PCM ring
+// runs low (0: fixed priority) so playback survives busy moments of the UI
+// without starving it the rest of the time
+#ifndef MUSICPLAYER_DECODER_PRIORITY
+#define MUSICPLAYER_DECODER_PRIORITY  5
+#endif
+#ifndef MUSICPLAYER_DECODER_BOOST
+#define MUSICPLAYER_DECODER_BOOST     3
+#endif
+
+// Core the decoder thread is pinned to, or -1 for any (needs ESP-IDF's pthread config)
+#ifndef MUSICPLAYER_DECODER_CORE
+#define MUSICPLAYER_DECODER_CORE      -1
+#endif
+
+// The output thread stays above the decoder even when that is raised, so it
+// always gets to move the frames that are ready
+#define OUTPUT_PRIORITY     (MUSICPLAYER_DECODER_PRIORITY + MUSICPLAYER_DECODER_BOOST + 1)
+
+// PCM ring fill levels (slots) at which the decoder is raised and lowered again
+#define BOOST_LOW_SLOTS     (PCM_RING_FRAMES / 4)
+#define BOOST_HIGH_SLOTS    (PCM_RING_FRAMES - 1)
+
+// Burst decoding: once the PCM ring is full the decoder sleeps until it has
+// drained to BURST_LOW_SLOTS, then refills it in one go, so the CPU idles for
+// most of a ring's worth of audio at a time instead of waking for every frame
+// (0: decode a frame whenever a slot frees up). The idle window is
+// PCM_RING_FRAMES - BURST_LOW_SLOTS frames: ~130 ms with the default 8 slots at
+// 44.1 kHz, ~310 ms with PCM_RING_FRAMES=16 (40 KB more internal SRAM)
+#ifndef MUSICPLAYER_BURST_DECODE
+#define MUSICPLAYER_BURST_DECODE  1
+#endif
+
+// Above the boost level, so a burst in time does not raise the priority
+#define BURST_LOW_SLOTS     (BOOST_LOW_SLOTS + 1)
+
+// Longest sleep between bursts (the drain, a command or a stop wake it sooner)
+#define BURST_WAIT_MS       1000
+
+// Upper bound for the decoder's ring/read-ahead waits (posting a command wakes it sooner)
+#define RING_WAIT_MS        50
+
+// Contiguous stream data the decoder asks the read-ahead for until a decoder
+// tells how much it needs (several MP3 frames)
+#define DECODE_MIN_BYTES    4096
+
+_Static_assert(DECODE_MIN_BYTES <= READAHEAD_GUARD_SIZE, "read-ahead guard smaller than decoder window");
+
+// Damaged decode steps (no good frame found) in a row, and in all, after
+// which a song is given up on and playback moves on to the next one
+#ifndef MUSICPLAYER_DAMAGED_RUN
+#define MUSICPLAYER_DAMAGED_RUN     32
+#endif
+#ifndef MUSICPLAYER_DAMAGED_BUDGET
+#define MUSICPLAYER_DAMAGED_BUDGET  256
+#endif
+
+// Stream bytes a decoder is shown per step while it resyncs, so damage costs
+// a bounded amount of CPU per step (MP3 sync checks look ~10 frames ahead)
+#define RESYNC_WINDOW       (16 * 1024)
+
+// Tag bytes past the buffered data that are seeked over rather than read
+#define TAG_SEEK_MIN_BYTES  READAHEAD_CHUNK_SIZE
+
+// Attenuation applied to songs without ReplayGain info so loud masters do not clip
+#ifndef MUSICPLAYER_HEADROOM_DB
+#define MUSICPLAYER_HEADROOM_DB  6
+#endif
+
+// Added to ReplayGain track gains (the tags aim at a fairly quiet level)
+#ifndef MUSICPLAYER_REPLAYGAIN_PREAMP_DB
+#define MUSICPLAYER_REPLAYGAIN_PREAMP_DB  0
+#endif
+
+// Time the output gain takes to move across its full range (volume changes,
+// fade-in at a start or seek), so gain changes never step
+#define GAIN_RAMP_MS        30
+
+// Codec volume; the volume setting is applied in software
+#define CODEC_VOLUME        100.0f
+
+// How often the decoder thread refreshes the resume checkpoint
+#define CHECKPOINT_REFRESH_MS  1000
+
+// Longest wait for the output thread to fade out its current frame
+#define FADE_WAIT_MS        (2 * RING_WAIT_MS)
+
+// Fixed I2S rate that every song is resampled to (resample.h), or 0 to switch
+// I2S to the rate of each song
+#ifndef MUSICPLAYER_OUTPUT_RATE
+#define MUSICPLAYER_OUTPUT_RATE  0
+#endif
 
 // Audio state
-static mp3dec_t* g_mp3_decoder = NULL;
-static FILE* g_current_file = NULL;
 static volatile bool g_playing = false;
 static volatile bool g_paused = false;
 static volatile bool g_song_finished = false;
 static volatile uint64_t g_samples_written = 0;
-static volatile uint32_t g_sample_rate = 44100;
+static volatile uint64_t g_position_base = 0;  // Track position of the first sample after a seek
+static volatile uint32_t g_sample_rate = 0;  // Rate of the frames being output, 0 until the first frame
+static uint32_t g_i2s_rate = 0;         // Rate I2S runs at (output thread)
+static int g_output_channels = 0;       // Channels of the frames being output (output thread)
 static bool g_audio_initialized = false;
 
-// PCM buffer in internal SRAM for DMA (16-byte aligned)
-static int16_t pcm_buffer[MAX_FRAME_SIZE] __attribute__((aligned(16)));
-
-// Heap-allocated buffers (PSRAM)
-static uint8_t* read_buffer = NULL;
-static size_t buffer_pos = 0;
-static size_t buffer_len = 0;
-
-// Decoder thread
+// Decoder thread - the only writer of g_playing/g_paused once running
 static pthread_t decoder_thread;
 static volatile bool g_thread_running = false;
 static volatile bool g_thread_should_stop = false;
-static volatile bool g_thread_in_decode = false;  // Track if thread is actively decoding
+static bool g_decoder_boosted = false;  // Running at the raised priority (decoder thread)
+static bool g_boost_failed = false;     // The priority cannot be changed here
+static bool g_ring_draining = false;    // Sleeping until the next burst (decoder thread)
+
+// Output thread sleeps on this while paused
+static pthread_mutex_t g_pause_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_pause_cond = PTHREAD_COND_INITIALIZER;
+
+// Output thread (drains PCM ring to I2S)
+static pthread_t output_thread;
+static volatile bool g_output_running = false;
+
+// Song to continue with gaplessly (decoder thread only)
+static char g_next_path[READAHEAD_PATH_MAX];
+
+// Decoder per-track state
+static uint32_t g_track_serial = 0;     // Tags PCM slots of the track being decoded
+static bool g_header_parsed = false;    // Stream info read for this track
+static size_t g_skip_bytes = 0;         // ID3v2 tag / stream header bytes still to skip
+static bool g_in_tag = false;           // Reading the frames of an ID3v2 tag
+static id3_reader_t g_id3;
+static id3_tags_t g_track_tags;         // Tags of the track being decoded
+static uint32_t g_trim_start = 0;       // Encoder delay samples still to drop
+static uint64_t g_samples_left = 0;     // Samples left before the encoder padding
+static bool g_length_known = false;     // g_samples_left is valid
+
+// Current track's decoder and stream layout
+static char g_track_path[READAHEAD_PATH_MAX];
+static const decoder_ops_t* g_decoder = NULL;  // Picked when the stream header is reached
+static decoder_stream_t g_stream;       // Valid once g_header_parsed
+static size_t g_min_bytes = DECODE_MIN_BYTES;
+static volatile uint32_t g_seek_serial = 0;  // Track serial started by the last seek
+
+// Resume checkpoint: where the next play command with a position starts
+// (written before it is posted), and the one pending until the stream header is read
+static audio_checkpoint_t g_play_at;
+static audio_checkpoint_t g_resume;
+static bool g_resume_pending = false;
+
+// Checkpoint of the song being heard, published by the decoder thread
+static pthread_mutex_t g_checkpoint_lock = PTHREAD_MUTEX_INITIALIZER;
+static audio_checkpoint_t g_checkpoint;
+static char g_checkpoint_path[READAHEAD_PATH_MAX];
+static bool g_checkpoint_valid = false;
+static uint32_t g_checkpoint_tick = 0;
+
+// Gapless track change: reported by the output thread when a chained track becomes audible
+static volatile uint32_t g_chained_serial = 0;
+static volatile uint32_t g_output_track = 0;
+
+// Read-ahead stall in progress (counted once per stall)
+static bool g_read_stalled = false;
+
+// Damaged decode steps of the current track, the last ones in a row
+static uint32_t g_damaged_run = 0;
+static uint32_t g_damaged_total = 0;
 
-// Path for decoder thread to play
-static char g_pending_path[256];
-static volatile bool g_new_file_pending = false;
+// Track if we've logged format for current file
+static bool g_format_logged = false;
 
-// Debug counter for fill_buffer
-static int g_fill_count = 0;
+// Benchmark mode: the output thread drops PCM instead of writing it to I2S
+static volatile bool g_discard_output = false;
+
+// Peak stack use of the decoder thread in bytes, 0 until measured
+static volatile uint32_t g_decoder_stack_used = 0;
+
+// Tags of the track being heard, published when it becomes audible, and the
+// ID3v1 tag the service thread read for g_v1_path (see audio_set_v1_tags)
+static pthread_mutex_t g_tags_lock = PTHREAD_MUTEX_INITIALIZER;
+static id3_tags_t g_tags;
+static char g_tags_path[READAHEAD_PATH_MAX];
+static id3_tags_t g_v1_tags;
+static char g_v1_path[READAHEAD_PATH_MAX];
+
+// Output gain: g_track_gain is the current song's ReplayGain (or the headroom),
+// g_gain the gain at the end of the last decoded frame
+static float g_headroom = 1.0f;
+static float g_track_gain = 1.0f;
+static float g_gain = 0.0f;
+static volatile uint8_t g_volume = 100;
+
+// Fades the output thread applies to the next frame it writes (g_pause_lock)
+typedef enum {
+    FADE_NONE,
+    FADE_IN,        // Ramp the frame up from silence (resume)
+    FADE_OUT,       // Ramp the frame down to silence (pause, stop, skip, seek)
+    FADE_OUT_DONE,  // Faded out; the output thread holds until FADE_NONE
+} fade_t;
+static volatile fade_t g_fade = FADE_NONE;
+
+// Pause or resume the output thread
+static void set_paused(bool paused) {
+    pthread_mutex_lock(&g_pause_lock);
+    g_paused = paused;
+    pthread_cond_broadcast(&g_pause_cond);
+    pthread_mutex_unlock(&g_pause_lock);
+}
 
-// Track if we already warned about low buffer (to avoid spam)
-static bool g_warned_buffer_low = false;
+// Have the output thread fade out the frame it writes next and hold after it,
+// so cutting playback does not click; end with fade_out_release()
+// Skipped while more commands are queued, so fast skipping is not held up
+static void fade_out_output(void) {
+    pthread_mutex_lock(&g_pause_lock);
+    if (g_playing && !g_paused && !g_discard_output && !audio_cmd_pending()) {
+        g_fade = FADE_OUT;
+        while (g_fade == FADE_OUT && !g_thread_should_stop) {
+            if (cond_wait_ms(&g_pause_cond, &g_pause_lock, FADE_WAIT_MS) == ETIMEDOUT) break;
+        }
+    }
+    pthread_mutex_unlock(&g_pause_lock);
+}
+
+// Let the output thread continue after fade_out_output()
+static void fade_out_release(void) {
+    pthread_mutex_lock(&g_pause_lock);
+    g_fade = FADE_NONE;
+    pthread_cond_broadcast(&g_pause_cond);
+    pthread_mutex_unlock(&g_pause_lock);
+}
 
-// Fill read buffer from file
-static size_t fill_buffer(void) {
-    if (!g_current_file) {
-        return 0;
+// Output gain for the next frame: headroom and volume, approached at the ramp
+// rate from where the last frame ended
+static gain_ramp_t next_gain(void) {
+    bool known = g_header_parsed && g_stream.valid;
+    uint32_t spf = known ? g_stream.frame_samples : 1152;
+    uint32_t rate = known ? g_stream.sample_rate : 44100;
+    float max_step = (float)spf * 1000.0f / ((float)rate * GAIN_RAMP_MS);
+
+    float target = g_track_gain * gain_from_volume(g_volume);
+    gain_ramp_t gain = { g_gain, gain_approach(g_gain, target, max_step) };
+    return gain;
+}
+
+// End of file reached - let the output thread play out what is still queued
+static void finish_song(void) {
+    bool drained = false;
+    while (g_playing && !g_thread_should_stop && !audio_cmd_pending()) {
+        if (pcm_ring_wait_empty(RING_WAIT_MS)) {
+            drained = true;
+            break;
+        }
+    }
+    // A stop or new file request while draining is not a finished song
+    // (a pause leaves the song unfinished; it is drained again after resume)
+    // Set before notifying: the service loop checks audio_is_finished() as soon as it wakes
+    if (drained) {
+        g_song_finished = true;
+        if (audio_cmd_notify(AUDIO_EVENT_FINISHED) & AUDIO_EVENT_FINISHED) {
+            g_playing = false;
+        } else {
+            g_song_finished = false;
+        }
     }
+}
 
-    // Move remaining data to start of buffer
-    if (buffer_pos > 0 && buffer_len > buffer_pos) {
-        memmove(read_buffer, read_buffer + buffer_pos, buffer_len - buffer_pos);
-        buffer_len -= buffer_pos;
-        buffer_pos = 0;
-    } else if (buffer_pos > 0) {
-        buffer_len = 0;
-        buffer_pos = 0;
+// Let go of the current track's decoder
+static void close_decoder(void) {
+    if (g_decoder) {
+        g_decoder->close();
+        g_decoder = NULL;
     }
+}
 
-    // Read more data
-    size_t space = READ_BUFFER_SIZE - buffer_len;
-    if (space > 0) {
-        size_t bytes_read = fread(read_buffer + buffer_len, 1, space, g_current_file);
-        buffer_len += bytes_read;
-        g_fill_count++;
+// Reset per-track decoder state for the file at the read-ahead cursor
+static void reset_track(void) {
+    close_decoder();
+    g_track_serial++;
+    g_header_parsed = false;
+    g_skip_bytes = 0;
+    g_trim_start = 0;
+    g_samples_left = 0;
+    g_length_known = false;
+    g_min_bytes = DECODE_MIN_BYTES;
+    memset(&g_stream, 0, sizeof(g_stream));
+    g_format_logged = false;  // Reset for new file
+    g_read_stalled = false;
+    g_damaged_run = 0;
+    g_damaged_total = 0;
+    g_track_gain = g_headroom;
+    g_in_tag = false;
+    memset(&g_track_tags, 0, sizeof(g_track_tags));
+    g_resume_pending = false;
+}
+
+// Make the decoded track's tags the ones that are reported
+static void publish_tags(void) {
+    pthread_mutex_lock(&g_tags_lock);
+    g_tags = g_track_tags;
+    memcpy(g_tags_path, g_track_path, sizeof(g_tags_path));
+    pthread_mutex_unlock(&g_tags_lock);
+}
+
+// Move the read cursor bytes ahead; past what is buffered, a seek is cheaper
+// than reading through (cover art)
+static void skip_stream(uint64_t bytes, size_t available) {
+    if (bytes <= available) {
+        readahead_consume((size_t)bytes);
+    } else if (bytes - available < TAG_SEEK_MIN_BYTES) {
+        readahead_consume(available);
+        g_skip_bytes = (size_t)(bytes - available);
+    } else {
+        uint64_t target = readahead_tell() + bytes;
+        g_skip_bytes = (size_t)(target - readahead_seek(target));
     }
+}
 
-    return buffer_len - buffer_pos;
+// Take the track gain from ReplayGain info, lowered if the peak would clip
+static void apply_replaygain(const mp3_replaygain_t* rg) {
+    float gain = gain_from_db(rg->gain_db + (float)MUSICPLAYER_REPLAYGAIN_PREAMP_DB);
+    if (rg->peak > 0.0f && gain * rg->peak > 1.0f) {
+        gain = 1.0f / rg->peak;
+    }
+    g_track_gain = gain;
+    int centi_db = (int)(rg->gain_db * 100.0f);
+    int magnitude = (centi_db < 0) ? -centi_db : centi_db;
+    asp_log_info("musicplayer", "ReplayGain: %s%d.%02d dB, peak %u%%, gain %u%%", (centi_db < 0) ? "-" : "",
+                 magnitude / 100, magnitude % 100, (unsigned)(rg->peak * 100.0f), (unsigned)(gain * 100.0f));
 }
 
-// Track if we've logged format for current file
-static bool g_format_logged = false;
+// Read the ID3v2 tag and the stream header at the start of a track (called
+// until g_header_parsed)
+static void parse_track_header(const uint8_t* data, size_t available, bool eof) {
+    // Read an ID3v2 tag first so the stream header can be found after it
+    if (g_in_tag) {
+        uint32_t used = id3_feed(&g_id3, data, available, &g_track_tags);
+        if (used == 0 && eof) used = id3_skip_rest(&g_id3);
+        g_in_tag = !id3_done(&g_id3);
+        skip_stream(used, available);
+        return;
+    }
+    if (!g_decoder) {
+        uint32_t header = id3_begin(&g_id3, data, available, &g_track_tags);
+        if (header > 0) {
+            g_in_tag = true;
+            skip_stream(header, available);
+            return;
+        }
+        g_decoder = decoder_find(data, available);
+    }
 
-// Debug counters for audio clipping detection
-static uint32_t g_clip_count = 0;
-static uint32_t g_frame_count = 0;
-static int16_t g_max_sample = 0;
-static int16_t g_min_sample = 0;
+    // data is at the read cursor, so tell() gives the file offset of the buffer
+    decoder_input_t in = { data, available, eof, readahead_tell(), g_track_path };
+    uint64_t skip = 0;
+    decoder_header_t result = g_decoder->read_header(&in, &g_stream, &skip);
+    if (result == DECODER_HEADER_MORE && (skip > 0 || !eof)) {
+        skip_stream(skip, available);
+        return;
+    }
 
-// MP3 decode loop - decode frames and write PCM to audio output
-static void decode_loop(void) {
-    mp3dec_frame_info_t info;
-    int samples;
+    g_header_parsed = true;
+    // A chained track's tags are published by the output thread once it is heard
+    if (g_chained_serial != g_track_serial) publish_tags();
+
+    if (result != DECODER_HEADER_DONE) {
+        // Nothing to play: the decode loop moves on to the next song
+        asp_log_warn("musicplayer", "Cannot play %s stream", g_decoder->name);
+        memset(&g_stream, 0, sizeof(g_stream));
+        g_length_known = true;
+        g_samples_left = 0;
+        return;
+    }
+
+    skip_stream(skip, available);
+    g_min_bytes = g_stream.min_bytes;
+    g_trim_start = g_stream.trim_start;
+    g_samples_left = g_stream.total_samples;
+    g_length_known = g_stream.total_samples > 0;
+
+    // Tagged gains take precedence over the one the encoder wrote
+    if (g_track_tags.replaygain.valid) {
+        apply_replaygain(&g_track_tags.replaygain);
+    } else if (g_stream.replaygain.valid) {
+        apply_replaygain(&g_stream.replaygain);
+    }
+}
+
+// Drop encoder delay and padding from a decoded frame
+// Returns the number of sample frames left, which start at frame *first
+static uint32_t trim_frame(int samples, uint32_t* first) {
+    uint32_t frames = (uint32_t)samples;
+    uint32_t skip = 0;
 
-    g_thread_in_decode = true;
+    if (g_trim_start > 0) {
+        skip = (g_trim_start < frames) ? g_trim_start : frames;
+        g_trim_start -= skip;
+        frames -= skip;
+    }
+    if (g_length_known) {
+        if (frames > g_samples_left) frames = (uint32_t)g_samples_left;
+        g_samples_left -= frames;
+    }
+    *first = skip;
+    return frames;
+}
+
+// Current file is used up - continue with the chained next file or finish
+// Returns true if decoding continues
+static bool end_of_track(const char* reason) {
+    stats_snapshot_t snap;
+    stats_snapshot(&snap);
+    asp_log_info("musicplayer", "Song finished (%s, underruns=%u, clipped=%u, damaged=%u)",
+                reason, (unsigned)snap.counters[STATS_UNDERRUN], (unsigned)snap.counters[STATS_CLIPPED],
+                (unsigned)g_damaged_total);
+
+    if (readahead_next_file(RING_WAIT_MS)) {
+        // Keep the PCM ring and I2S running; the output thread notices the new serial
+        reset_track();
+        g_chained_serial = g_track_serial;
+        memcpy(g_track_path, g_next_path, sizeof(g_track_path));
+        g_next_path[0] = '\0';
+        asp_log_info("musicplayer", "Gapless: continuing with next song");
+        return true;
+    }
+
+    // End of file - stop playing to prevent decode_loop being called again
+    finish_song();
+    return false;
+}
+
+// Count a decode step that hit damaged data; too much damage ends the song,
+// so the service loop moves on to the next one (decoder thread)
+// Returns true if decoding continues
+static bool note_damage(void) {
+    stats_count(STATS_DAMAGED);
+    g_damaged_run++;
+    g_damaged_total++;
+    if (g_damaged_run < MUSICPLAYER_DAMAGED_RUN && g_damaged_total < MUSICPLAYER_DAMAGED_BUDGET) {
+        return true;
+    }
+
+    asp_log_warn("musicplayer", "Skipping damaged song (%u damaged frames, %u in a row)",
+                 (unsigned)g_damaged_total, (unsigned)g_damaged_run);
+    finish_song();
+    return false;
+}
+
+// Raise the decoder thread while the PCM ring runs low, lower it once the ring
+// is about full (decoder thread)
+static void adapt_priority(unsigned fill) {
+    bool boost;
+    if (fill <= BOOST_LOW_SLOTS) {
+        boost = true;
+    } else if (fill >= BOOST_HIGH_SLOTS) {
+        boost = false;
+    } else {
+        return;
+    }
+    if (boost == g_decoder_boosted || MUSICPLAYER_DECODER_BOOST == 0 || g_boost_failed) return;
+
+    int policy;
+    struct sched_param param;
+    int err = pthread_getschedparam(pthread_self(), &policy, &param);
+    if (err == 0) {
+        param.sched_priority = MUSICPLAYER_DECODER_PRIORITY + (boost ? MUSICPLAYER_DECODER_BOOST : 0);
+        err = pthread_setschedparam(pthread_self(), policy, &param);
+    }
+    if (err != 0) {
+        asp_log_warn("musicplayer", "Cannot change the decoder priority (%d), keeping it fixed", err);
+        g_boost_failed = true;
+        return;
+    }
+    g_decoder_boosted = boost;
+    if (boost) stats_count(STATS_PRIORITY_BOOST);
+}
+
+// Jump to position_ms in the current track (decoder thread)
+// hint is a restart point the decoder gave for it earlier, or NULL
+static void seek_to_ms(uint32_t position_ms, const decoder_point_t* hint) {
+    if (!g_playing) {
+        asp_log_warn("musicplayer", "Seek ignored: not playing");
+        return;
+    }
+    if (!g_header_parsed || !g_stream.valid) {
+        asp_log_warn("musicplayer", "Seek ignored: no stream info yet");
+        return;
+    }
+    if (g_track_serial == g_chained_serial && g_output_track != g_track_serial) {
+        // Still playing out the previous song; its file is gone
+        asp_log_warn("musicplayer", "Seek ignored during track change");
+        return;
+    }
+
+    uint64_t target = (uint64_t)position_ms * g_stream.sample_rate / 1000;
+    if (g_length_known && target > g_stream.total_samples) {
+        target = g_stream.total_samples;
+    }
+
+    decoder_seek_t seek;
+    if (g_decoder->seek(target, hint, &seek) != 0) {
+        asp_log_warn("musicplayer", "Seek ignored: %s stream cannot seek", g_decoder->name);
+        return;
+    }
+
+    // Restart the read-ahead at the new position, fading in there (no fade out
+    // when nothing of the track is heard yet, e.g. when resuming it)
+    bool heard = (g_output_track == g_track_serial);
+    if (heard) fade_out_output();
+    pcm_ring_flush();
+    if (heard) fade_out_release();
+    g_gain = 0.0f;
+    uint64_t restart = readahead_seek(seek.offset);
+    g_skip_bytes = (size_t)(seek.offset - restart);
+    g_trim_start = seek.discard;
+    if (g_length_known) {
+        g_samples_left = g_stream.total_samples - target;
+    }
+    g_song_finished = false;
+
+    // New serial so the output thread starts counting from the seek target
+    g_track_serial++;
+    g_seek_serial = g_track_serial;
+    g_position_base = target;
+    g_samples_written = 0;
+
+    asp_log_info("musicplayer", "Seek to %u ms: sample %llu at offset %llu (%s)",
+                (unsigned)position_ms, (unsigned long long)target, (unsigned long long)seek.offset, seek.method);
+}
+
+// Start a resumed song at its checkpoint once the stream header is read (decoder thread)
+static void resume_at_checkpoint(void) {
+    g_resume_pending = false;
+    decoder_point_t hint = { g_resume.sample, g_resume.offset };
+    asp_log_info("musicplayer", "Resuming at %u ms", (unsigned)g_resume.position_ms);
+    seek_to_ms(g_resume.position_ms, (g_resume.offset > 0) ? &hint : NULL);
+}
+
+// Publish where the track being heard is, with the decoder's restart point
+// for it (decoder thread, at most every CHECKPOINT_REFRESH_MS)
+static void update_checkpoint(void) {
+    uint32_t now = asp_plugin_get_tick_ms();
+    if (now - g_checkpoint_tick < CHECKPOINT_REFRESH_MS) return;
+    // Only once the output has reached the decoded track (not across a gapless change or a seek)
+    if (!g_header_parsed || !g_stream.valid || g_output_track != g_track_serial) return;
+    g_checkpoint_tick = now;
+
+    audio_checkpoint_t checkpoint = { audio_get_position_ms(), 0, 0 };
+    decoder_point_t point;
+    uint64_t sample = (uint64_t)checkpoint.position_ms * g_stream.sample_rate / 1000;
+    if (g_decoder->restart_point && g_decoder->restart_point(sample, &point)) {
+        checkpoint.offset = point.offset;
+        checkpoint.sample = point.sample;
+    }
+
+    pthread_mutex_lock(&g_checkpoint_lock);
+    g_checkpoint = checkpoint;
+    memcpy(g_checkpoint_path, g_track_path, sizeof(g_checkpoint_path));
+    g_checkpoint_valid = true;
+    pthread_mutex_unlock(&g_checkpoint_lock);
+}
+
+// Decode loop - decode frames into the PCM ring ahead of the output thread
+static void decode_loop(void) {
     while (g_playing && !g_paused && !g_thread_should_stop) {
-        // Ensure we have data in buffer
-        size_t available = fill_buffer();
-
-        // Debug: Check for buffer underrun (less than 1KB available)
-        // Only warn once per low-buffer episode to avoid log spam
-        if (available < 1024 && available >= 4) {
-            if (!g_warned_buffer_low) {
-                asp_log_warn("musicplayer", "Buffer low: %d bytes available", (int)available);
-                g_warned_buffer_low = true;
-            }
-        } else if (available >= 4096) {
-            // Reset warning flag when buffer is healthy again
-            g_warned_buffer_low = false;
+        // Return to the decoder thread loop to handle control commands
+        if (audio_cmd_pending()) {
+            break;
         }
+        update_checkpoint();
 
-        if (available < 4) {
-            // End of file - stop playing to prevent decode_loop being called again
-            g_song_finished = true;
-            g_playing = false;
-            asp_log_info("musicplayer", "Song finished (EOF, total clips=%u max=%d min=%d)",
-                        g_clip_count, g_max_sample, g_min_sample);
-            break;
+        // Between bursts: wait for the ring to drain
+        if (MUSICPLAYER_BURST_DECODE && pcm_ring_fill() >= PCM_RING_FRAMES) {
+            g_ring_draining = true;
+        }
+        if (g_ring_draining) {
+            if (!pcm_ring_wait_fill(BURST_LOW_SLOTS, BURST_WAIT_MS)) {
+                continue;
+            }
+            g_ring_draining = false;
         }
 
-        // Debug: Check for potential buffer overrun
-        if (buffer_pos > buffer_len) {
-            asp_log_error("musicplayer", "Buffer overrun! pos=%d len=%d", (int)buffer_pos, (int)buffer_len);
+        // Get a free ring slot to decode into
+        int16_t* pcm = pcm_ring_begin_write(RING_WAIT_MS);
+        adapt_priority(pcm_ring_fill());
+        if (!pcm) {
+            // Ring full (or woken by a command) - decoder is ahead of output
+            continue;
         }
 
-        // Decode one frame - track timing
-        uint32_t decode_start = asp_plugin_get_tick_ms();
-        samples = mp3dec_decode_frame(g_mp3_decoder,
-                                       read_buffer + buffer_pos,
-                                       buffer_len - buffer_pos,
-                                       pcm_buffer, &info);
-        uint32_t decode_time = asp_plugin_get_tick_ms() - decode_start;
-
-        if (info.frame_bytes > 0) {
-            buffer_pos += info.frame_bytes;
+        // Get buffered stream data from the read-ahead (never blocks on the SD card itself)
+        size_t available;
+        const uint8_t* data = readahead_peek(g_min_bytes, &available, RING_WAIT_MS);
+        bool eof = readahead_eof();
+        if (available < g_min_bytes && !eof) {
+            if (!g_read_stalled && g_format_logged) {
+                stats_count(STATS_READ_STALL);
+                g_read_stalled = true;
+            }
+            continue;
+        }
+        g_read_stalled = false;
+
+        // Skip tags without decoding them
+        if (g_skip_bytes > 0 && available > 0) {
+            size_t skip = (available < g_skip_bytes) ? available : g_skip_bytes;
+            readahead_consume(skip);
+            g_skip_bytes -= skip;
+            continue;
         }
 
-        if (samples > 0) {
-            g_frame_count++;
+        if (!g_header_parsed && available >= 4) {
+            parse_track_header(data, available, eof);
+            if (g_header_parsed && g_resume_pending) resume_at_checkpoint();
+            continue;
+        }
 
-            // Warn if decode took too long (>20ms is concerning for real-time audio)
-            if (decode_time > 20) {
-                asp_log_warn("musicplayer", "Slow decode: frame %u took %u ms",
-                            g_frame_count, (unsigned)decode_time);
+        if (available < 4 || (g_length_known && g_samples_left == 0)) {
+            // End of file, or only encoder padding left
+            if (!end_of_track("EOF")) {
+                break;
             }
+            continue;
+        }
 
-            // Debug: Scan for clipped samples and track min/max
-            int total_samples = samples * info.channels;
-            int clipped_this_frame = 0;
-            for (int i = 0; i < total_samples; i++) {
-                int16_t s = pcm_buffer[i];
-                if (s > g_max_sample) g_max_sample = s;
-                if (s < g_min_sample) g_min_sample = s;
-                // Check if sample is at clipping boundary (after 0.7 scaling, this means original was way over)
-                if (s >= 32767 || s <= -32768) {
-                    clipped_this_frame++;
-                }
-                // Also check for values very close to limits (within 1% of max)
-                if (s > 32440 || s < -32440) {
-                    clipped_this_frame++;
-                }
-            }
-            if (clipped_this_frame > 0) {
-                g_clip_count += clipped_this_frame;
-                asp_log_warn("musicplayer", "CLIPPING: %d samples clipped in frame %u (max=%d min=%d)",
-                            clipped_this_frame, g_frame_count, g_max_sample, g_min_sample);
+        // Decode one frame - track timing
+        stats_level(STATS_LEVEL_READAHEAD, (uint32_t)available);
+        decoder_input_t in = { data, available, eof, 0, g_track_path };
+        if (g_damaged_run > 0) {
+            // Resyncing: scan a bounded window per step
+            size_t window = (g_min_bytes > RESYNC_WINDOW) ? g_min_bytes : RESYNC_WINDOW;
+            if (in.len > window) {
+                in.len = window;
+                in.eof = false;
             }
+        }
+        decoder_frame_t frame;
+        gain_ramp_t gain = next_gain();
+        uint64_t decode_start = stats_now_us();
+        g_decoder->decode(&in, pcm, &gain, &frame);
+        stats_time(STATS_DECODE, decode_start);
+
+        if (frame.consumed > 0) {
+            readahead_consume(frame.consumed);
+        }
+
+        if (frame.frames > 0) {
+            g_gain = gain.end;
+            g_damaged_run = 0;
 
             // Log format on first successful decode
+            // The output thread reconfigures I2S when a frame's rate differs
             if (!g_format_logged) {
-                asp_log_info("musicplayer", "Format: %d Hz, %d ch, %d kbps",
-                            info.hz, info.channels, info.bitrate_kbps);
-                // Only reconfigure I2S if sample rate is different
-                if (info.hz != g_sample_rate) {
-                    asp_log_info("musicplayer", "Changing sample rate from %u to %d",
-                                (unsigned)g_sample_rate, info.hz);
-                    asp_audio_stop();
-                    asp_audio_set_rate(info.hz);
-                    asp_audio_start();
-                }
-                g_sample_rate = info.hz;
+                asp_log_info("musicplayer", "Format: %s, %u Hz, %d ch, %u kbps", g_decoder->name,
+                            (unsigned)frame.rate, frame.channels, (unsigned)frame.bitrate_kbps);
                 g_format_logged = true;
-                // Reset debug counters for new file
-                g_clip_count = 0;
-                g_frame_count = 0;
-                g_max_sample = 0;
-                g_min_sample = 0;
             }
 
-            // Write to audio output (samples * channels * bytes per sample)
-            // Note: volume attenuation is now done in minimp3's mp3d_scale_pcm()
-            size_t bytes = samples * info.channels * sizeof(int16_t);
-            asp_audio_write(pcm_buffer, bytes, 500);
-            g_samples_written += samples;
-        } else if (info.frame_bytes == 0) {
-            // Need more data or invalid frame, try to refill
-            if (fill_buffer() == 0) {
-                g_song_finished = true;
-                g_playing = false;
-                asp_log_info("musicplayer", "Song finished (no more data, total clips=%u max=%d min=%d)",
-                            g_clip_count, g_max_sample, g_min_sample);
+            // Hand the frame to the output thread; the decoder wrote it straight
+            // into the ring slot with the output gain applied, and trimming only
+            // moves the slot's start
+            uint32_t first;
+            uint32_t frames = trim_frame((int)frame.frames, &first);
+            if (frames > 0) {
+                pcm_ring_end_write(first, frames, frame.channels, frame.rate, g_track_serial, frame.bands);
+            }
+        } else if (frame.damaged || (frame.consumed == 0 && !eof)) {
+            // No progress on a whole window is damage as well: step past it
+            if (frame.consumed == 0) readahead_consume(1);
+            if (!note_damage()) {
+                break;
+            }
+        } else if (frame.consumed == 0) {
+            // Incomplete frame - the read-ahead window always holds a full
+            // frame, so this only happens with the truncated tail of the file
+            if (!end_of_track("no more data")) {
                 break;
             }
         }
     }
-    g_thread_in_decode = false;
 }
 
 // Start playing a new file (called from decoder thread)
 static void start_new_file(const char* path) {
-    // Close any existing file
-    if (g_current_file) {
-        fclose(g_current_file);
-        g_current_file = NULL;
-    }
-
-    // Open new file
-    g_current_file = fopen(path, "rb");
-    if (!g_current_file) {
+    // Drop frames still queued from the previous song
+    fade_out_output();
+    pcm_ring_flush();
+    fade_out_release();
+
+    // The last song's checkpoint no longer applies
+    pthread_mutex_lock(&g_checkpoint_lock);
+    g_checkpoint_valid = false;
+    pthread_mutex_unlock(&g_checkpoint_lock);
+
+    // Close any existing file and start reading ahead in the new one
+    close_decoder();
+    strncpy(g_track_path, path, sizeof(g_track_path) - 1);
+    g_track_path[sizeof(g_track_path) - 1] = '\0';
+    if (readahead_open(path) != 0) {
         asp_log_error("musicplayer", "Failed to open: %s", path);
         g_playing = false;
+        audio_cmd_notify(AUDIO_EVENT_ERROR);
         return;
     }
 
-    // Reset decoder state
-    mp3dec_init(g_mp3_decoder);
-    buffer_pos = 0;
-    buffer_len = 0;
+    // Reset decoder state; the song fades in from silence
+    reset_track();
+    g_chained_serial = 0;
+    g_gain = 0.0f;
 
     g_samples_written = 0;
+    g_position_base = 0;
+    stats_reset();
     g_song_finished = false;
-    g_format_logged = false;  // Reset for new file
-    g_fill_count = 0;  // Reset debug counter
-    g_warned_buffer_low = false;  // Reset buffer warning flag
-    g_paused = false;
+    set_paused(false);
     g_playing = true;
 
-    // Force I2S channel reset: stop, reconfigure, start
-    asp_audio_stop();
-    asp_audio_set_rate(44100);  // Will be updated when we decode first frame
-    asp_audio_start();
+    // I2S keeps running; the output thread only restarts it if the rate changes
 
-    // Enable amplifier and set volume
+    // Enable amplifier; volume is applied in the decoder's output gain
     asp_audio_set_amplifier(true);
-    music_player_state_t* state = music_player_get_state();
-    asp_audio_set_volume((float)state->volume);
+    asp_audio_set_volume(CODEC_VOLUME);
 
     asp_log_info("musicplayer", "Playing: %s", path);
+    audio_cmd_notify(AUDIO_EVENT_STARTED);
+}
+
+// Apply a control command (decoder thread)
+static void handle_command(const audio_cmd_t* cmd) {
+    switch (cmd->type) {
+        case AUDIO_CMD_PLAY:
+            start_new_file(cmd->path);
+            // A position means resuming at the checkpoint posted with it
+            if (g_playing && cmd->value > 0) {
+                g_resume = g_play_at;
+                g_resume_pending = true;
+            }
+            // Opening a new file drops the read-ahead's queue, so re-queue after it
+            if (g_playing && g_next_path[0]) {
+                readahead_queue_next(g_next_path);
+            }
+            break;
+
+        case AUDIO_CMD_STOP:
+            fade_out_output();
+            g_playing = false;
+            set_paused(false);
+            // Don't let the output thread play stale frames
+            pcm_ring_flush();
+            fade_out_release();
+            close_decoder();
+            asp_audio_set_amplifier(false);
+            break;
+
+        case AUDIO_CMD_PAUSE:
+            fade_out_output();
+            set_paused(true);
+            fade_out_release();
+            asp_audio_set_amplifier(false);
+            break;
+
+        case AUDIO_CMD_RESUME:
+            if (g_playing && g_paused) {
+                asp_audio_set_amplifier(true);
+                g_fade = FADE_IN;
+                set_paused(false);
+            }
+            break;
+
+        case AUDIO_CMD_QUEUE_NEXT:
+            memcpy(g_next_path, cmd->path, sizeof(g_next_path));
+            if (g_playing) {
+                readahead_queue_next(g_next_path[0] ? g_next_path : NULL);
+            }
+            break;
+
+        case AUDIO_CMD_SEEK:
+            seek_to_ms(cmd->value, NULL);
+            break;
+
+        case AUDIO_CMD_QUIT:
+            g_thread_should_stop = true;
+            break;
+    }
 }
 
 // Decoder thread main function
+// Note the decoder thread's stack high-water mark; runs on that thread, between
+// songs and commands only, as FreeRTOS scans the stack for it
+static void measure_stack(void) {
+#ifdef HAVE_FREERTOS
+    // ESP-IDF counts stacks in bytes
+    uint32_t unused = (uint32_t)uxTaskGetStackHighWaterMark(NULL);
+    g_decoder_stack_used = unused < DECODER_STACK_SIZE ? DECODER_STACK_SIZE - unused : 0;
+#endif
+}
+
 static void* decoder_thread_func(void* arg) {
     (void)arg;
     asp_log_info("musicplayer", "Decoder thread started");
 
+    audio_cmd_t cmd;
+
     while (!g_thread_should_stop) {
-        // Check for new file to play
-        if (g_new_file_pending) {
-            g_new_file_pending = false;
-            start_new_file(g_pending_path);
+        // Handle queued commands first; sleep until one arrives when idle
+        bool decoding = g_playing && !g_paused;
+        if (audio_cmd_take(&cmd, decoding ? 0 : AUDIO_CMD_WAIT_FOREVER)) {
+            handle_command(&cmd);
+            audio_cmd_done();
+            measure_stack();
+            continue;
         }
 
-        // Decode if playing
-        if (g_playing && !g_paused) {
-            decode_loop();
-        } else {
-            // Sleep when idle
-            asp_plugin_delay_ms(20);
-        }
+        decode_loop();
+        measure_stack();
     }
 
     asp_log_info("musicplayer", "Decoder thread exiting");
@@ -291,6 +877,145 @@ static void* decoder_thread_func(void* arg) {
     return NULL;
 }
 
+// A fade requested through g_fade has been written out
+static void finish_fade(fade_t fade) {
+    pthread_mutex_lock(&g_pause_lock);
+    if (g_fade == fade) {
+        g_fade = (fade == FADE_OUT) ? FADE_OUT_DONE : FADE_NONE;
+        pthread_cond_broadcast(&g_pause_cond);
+    }
+    pthread_mutex_unlock(&g_pause_lock);
+}
+
+// Write a frame of another rate than I2S through the resampler
+static void write_resampled(const pcm_slot_t* slot, int channels) {
+    const int16_t* in = slot->samples;
+    uint32_t left = slot->frames;
+    while (left > 0) {
+        uint32_t used;
+        const int16_t* out;
+        uint64_t resample_start_us = stats_now_us();
+        uint32_t frames = resample_run(in, left, &used, &out);
+        stats_time(STATS_RESAMPLE, resample_start_us);
+        in += used * channels;
+        left -= used;
+
+        if (frames > 0) {
+            uint64_t write_start = stats_now_us();
+            asp_audio_write((void*)out, frames * channels * sizeof(int16_t), 500);
+            stats_time(STATS_WRITE, write_start);
+        }
+    }
+}
+
+// Output thread main function - drains the PCM ring to I2S
+static void* output_thread_func(void* arg) {
+    (void)arg;
+    asp_log_info("musicplayer", "Output thread started");
+
+    while (!g_thread_should_stop) {
+        if (g_paused || g_fade == FADE_OUT_DONE) {
+            // Hold queued frames until resumed (or the decoder is done with a fade-out)
+            tap_clear();
+            pthread_mutex_lock(&g_pause_lock);
+            while ((g_paused || g_fade == FADE_OUT_DONE) && !g_thread_should_stop) {
+                pthread_cond_wait(&g_pause_cond, &g_pause_lock);
+            }
+            pthread_mutex_unlock(&g_pause_lock);
+            continue;
+        }
+
+        const pcm_slot_t* slot = pcm_ring_begin_read(RING_WAIT_MS);
+        if (!slot) {
+            // Nothing playing to fade out
+            tap_clear();
+            if (g_fade == FADE_OUT) finish_fade(FADE_OUT);
+            if (g_playing && g_format_logged && !g_song_finished && !g_discard_output) {
+                stats_count(STATS_UNDERRUN);
+            }
+            continue;
+        }
+
+        // Only reconfigure I2S if its rate has to change; never with a fixed output rate
+        uint32_t i2s_rate = MUSICPLAYER_OUTPUT_RATE ? MUSICPLAYER_OUTPUT_RATE : slot->rate;
+        if (i2s_rate != g_i2s_rate) {
+            asp_log_info("musicplayer", "Changing sample rate from %u to %u",
+                        (unsigned)g_i2s_rate, (unsigned)i2s_rate);
+            asp_audio_stop();
+            asp_audio_set_rate(i2s_rate);
+            asp_audio_start();
+            g_i2s_rate = i2s_rate;
+        }
+        int channels = (int)(slot->bytes / (slot->frames * sizeof(int16_t)));
+        if (slot->rate != g_sample_rate || channels != g_output_channels) {
+            g_sample_rate = slot->rate;
+            g_output_channels = channels;
+            if (slot->rate != i2s_rate) resample_start(slot->rate, i2s_rate, channels);
+        }
+
+        // First frame of a new track: restart the position, report gapless changes
+        if (slot->track != g_output_track) {
+            g_output_track = slot->track;
+            g_samples_written = 0;
+            g_position_base = (slot->track == g_seek_serial) ? g_position_base : 0;
+            if (slot->track == g_chained_serial && g_playing) {
+                publish_tags();
+                audio_cmd_notify(AUDIO_EVENT_TRACK_CHANGED);
+            } else if (slot->rate != i2s_rate) {
+                // Not continuous with what came before (a start or a seek)
+                resample_reset();
+            }
+        }
+
+        // Pause, resume and cuts ramp this one frame in place
+        fade_t fade = g_fade;
+        if (fade == FADE_IN || fade == FADE_OUT) {
+            gain_ramp_pcm(slot->samples, slot->frames, channels,
+                          (fade == FADE_IN) ? 0.0f : 1.0f, (fade == FADE_IN) ? 1.0f : 0.0f);
+        }
+
+        stats_level(STATS_LEVEL_PCM, pcm_ring_fill());
+        if (g_discard_output) {
+            // Nothing is heard
+            tap_clear();
+        } else {
+            // Metered as it goes out, after any fade
+            tap_publish(slot->samples, slot->frames, channels, slot->rate, slot->has_bands ? slot->bands : NULL);
+            if (slot->rate == i2s_rate) {
+                uint64_t write_start = stats_now_us();
+                asp_audio_write(slot->samples, slot->bytes, 500);
+                stats_time(STATS_WRITE, write_start);
+            } else {
+                write_resampled(slot, channels);
+            }
+        }
+        g_samples_written += slot->frames;
+        pcm_ring_end_read();
+
+        if (fade == FADE_IN || fade == FADE_OUT) finish_fade(fade);
+    }
+
+    asp_log_info("musicplayer", "Output thread exiting");
+    g_output_running = false;
+    return NULL;
+}
+
+// Pin the next thread created to core (-1: any core, back to the defaults)
+static void pin_next_thread(int core, const char* name) {
+#ifdef HAVE_ESP_PTHREAD
+    esp_pthread_cfg_t cfg = esp_pthread_get_default_config();
+    if (core >= 0) {
+        cfg.pin_to_core = core;
+        cfg.thread_name = name;
+    }
+    esp_pthread_set_cfg(&cfg);
+#else
+    if (core >= 0) {
+        asp_log_warn("musicplayer", "Cannot pin %s to core %d: no ESP-IDF pthread config", name, core);
+    }
+#endif
+}
+
 int audio_init(void) {
     // Guard against double initialization
     if (g_audio_initialized) {
@@ -300,54 +1025,88 @@ int audio_init(void) {
 
     asp_log_info("musicplayer", "Allocating audio buffers...");
 
-    // Allocate buffers on heap (PSRAM) - PCM buffer is static in SRAM
-    read_buffer = (uint8_t*)malloc(READ_BUFFER_SIZE);
-    if (!read_buffer) {
-        asp_log_error("musicplayer", "Failed to allocate read_buffer (%d bytes)", READ_BUFFER_SIZE);
+    // Decoder state (internal SRAM) and the MP3 seek index
+    if (decoder_init() != 0) {
+        return -1;
+    }
+
+    // Read-ahead chunks (PSRAM) and its I/O thread
+    if (readahead_init() != 0) {
+        decoder_cleanup();
         return -1;
     }
 
-    g_mp3_decoder = (mp3dec_t*)malloc(sizeof(mp3dec_t));
-    if (!g_mp3_decoder) {
-        asp_log_error("musicplayer", "Failed to allocate mp3_decoder (%d bytes)", (int)sizeof(mp3dec_t));
-        free(read_buffer);
-        read_buffer = NULL;
+    // Filter and output buffer of the resampler, when I2S runs at one rate
+    if (MUSICPLAYER_OUTPUT_RATE && resample_init() != 0) {
+        readahead_cleanup();
+        decoder_cleanup();
         return -1;
     }
 
     asp_log_info("musicplayer", "Buffers allocated, creating decoder thread...");
 
-    // Initialize MP3 decoder
-    mp3dec_init(g_mp3_decoder);
+    // Initialize gain, PCM ring and command queue
+    g_headroom = gain_from_db(-(float)MUSICPLAYER_HEADROOM_DB);
+    g_fade = FADE_NONE;
+    pcm_ring_init();
+    audio_cmd_reset();
 
     // Create decoder thread with larger stack
     pthread_attr_t attr;
     pthread_attr_init(&attr);
     pthread_attr_setstacksize(&attr, DECODER_STACK_SIZE);
+    struct sched_param param = { .sched_priority = MUSICPLAYER_DECODER_PRIORITY };
+    pthread_attr_setschedparam(&attr, &param);
+    pin_next_thread(MUSICPLAYER_DECODER_CORE, "mp_decoder");
 
     g_thread_should_stop = false;
-    g_thread_in_decode = false;
+    g_decoder_boosted = false;
+    g_boost_failed = false;
     int err = pthread_create(&decoder_thread, &attr, decoder_thread_func, NULL);
     pthread_attr_destroy(&attr);
+    pin_next_thread(-1, NULL);
 
     if (err != 0) {
         asp_log_error("musicplayer", "Failed to create decoder thread: %d (need %d bytes stack)",
                      err, DECODER_STACK_SIZE);
         // Thread creation failed - heap may be corrupted or out of memory
         // Try to free our buffers, but be aware this might fail
-        free(read_buffer);
-        free(g_mp3_decoder);
-        read_buffer = NULL;
-        g_mp3_decoder = NULL;
+        resample_cleanup();
+        readahead_cleanup();
+        decoder_cleanup();
         return -1;
     }
 
     g_thread_running = true;
+
+    // Create output thread - small stack, it only copies PCM to I2S
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, OUTPUT_STACK_SIZE);
+    param.sched_priority = OUTPUT_PRIORITY;
+    pthread_attr_setschedparam(&attr, &param);
+    err = pthread_create(&output_thread, &attr, output_thread_func, NULL);
+    pthread_attr_destroy(&attr);
+
+    if (err != 0) {
+        asp_log_error("musicplayer", "Failed to create output thread: %d", err);
+        g_thread_should_stop = true;
+        audio_cmd_post(AUDIO_CMD_QUIT, NULL, 0, 0);
+        pthread_join(decoder_thread, NULL);
+        g_thread_running = false;
+        g_thread_should_stop = false;
+        resample_cleanup();
+        readahead_cleanup();
+        decoder_cleanup();
+        return -1;
+    }
+
+    g_output_running = true;
     g_audio_initialized = true;
 
     // Note: Don't call asp_audio_start() - I2S channel is already enabled by BSP
 
-    asp_log_info("musicplayer", "Audio initialized (32KB decoder stack)");
+    asp_log_info("musicplayer", "Audio initialized (%dKB decoder stack, %d frame PCM ring, priority %d+%d)",
+                 DECODER_STACK_SIZE / 1024, PCM_RING_FRAMES, MUSICPLAYER_DECODER_PRIORITY, MUSICPLAYER_DECODER_BOOST);
     return 0;
 }
 
@@ -358,135 +1117,176 @@ void audio_cleanup(void) {
 
     asp_log_info("musicplayer", "Audio cleanup starting...");
 
-    // First, stop playback to get thread out of decode_loop
-    g_playing = false;
-    g_paused = false;
-    g_new_file_pending = false;
-
-    // Wait for thread to exit decode_loop (it checks g_playing each frame)
-    // asp_audio_write has 500ms timeout, so wait up to 600ms
-    for (int i = 0; i < 30 && g_thread_in_decode; i++) {
-        asp_plugin_delay_ms(20);
-    }
-    if (g_thread_in_decode) {
-        asp_log_warn("musicplayer", "Thread still in decode loop after 600ms");
-    }
-
-    // Now signal thread to fully stop
+    // Signal the threads to stop and wake them from their waits
+    // (the decoder leaves decode_loop within one frame or ring wait)
     g_thread_should_stop = true;
+    audio_cmd_post(AUDIO_CMD_QUIT, NULL, 0, 0);
+    pcm_ring_wake();
+    set_paused(false);
 
     // Wait for decoder thread to exit
     if (g_thread_running) {
         asp_log_info("musicplayer", "Waiting for decoder thread to exit...");
-        // Poll for thread exit (up to 2 seconds)
-        for (int i = 0; i < 100 && g_thread_running; i++) {
-            asp_plugin_delay_ms(20);
-        }
-        if (g_thread_running) {
-            asp_log_warn("musicplayer", "Decoder thread did not set exit flag within timeout");
-        }
-        // pthread_join will block until thread actually exits
         pthread_join(decoder_thread, NULL);
         asp_log_info("musicplayer", "pthread_join completed");
     }
     g_thread_running = false;
 
+    // Output thread wakes from its ring wait within RING_WAIT_MS
+    if (g_output_running) {
+        pthread_join(output_thread, NULL);
+        asp_log_info("musicplayer", "Output thread joined");
+    }
+    g_output_running = false;
+    pcm_ring_cleanup();
+
     // Small delay to let system reclaim thread resources
     asp_plugin_delay_ms(50);
 
-    // Close file if open
-    if (g_current_file) {
-        fclose(g_current_file);
-        g_current_file = NULL;
-    }
+    // Stop the read-ahead thread, close file and free chunks
+    close_decoder();
+    readahead_cleanup();
 
     // Mute output
     asp_audio_set_amplifier(false);
 
-    // Free heap buffers (PCM buffer is static)
-    if (read_buffer) {
-        free(read_buffer);
-        read_buffer = NULL;
-    }
-    if (g_mp3_decoder) {
-        free(g_mp3_decoder);
-        g_mp3_decoder = NULL;
-    }
+    // Free decoders and the resampler, stop the index scan thread (PCM ring is static)
+    decoder_cleanup();
+    resample_cleanup();
 
     // Reset all state for clean plugin reload
     g_playing = false;
     g_paused = false;
     g_song_finished = false;
     g_samples_written = 0;
-    g_sample_rate = 44100;
+    g_position_base = 0;
+    g_seek_serial = 0;
+    g_resume_pending = false;
+    g_checkpoint_valid = false;
+    g_checkpoint_tick = 0;
+    g_sample_rate = 0;
+    g_i2s_rate = 0;
+    g_output_channels = 0;
     g_format_logged = false;
-    g_fill_count = 0;
-    g_warned_buffer_low = false;
-    g_thread_in_decode = false;
-    buffer_pos = 0;
-    buffer_len = 0;
-    g_new_file_pending = false;
+    g_read_stalled = false;
     g_thread_should_stop = false;
-    memset(g_pending_path, 0, sizeof(g_pending_path));
-    // Reset debug counters
-    g_clip_count = 0;
-    g_frame_count = 0;
-    g_max_sample = 0;
-    g_min_sample = 0;
+    memset(g_next_path, 0, sizeof(g_next_path));
+    g_chained_serial = 0;
+    g_output_track = 0;
+    audio_cmd_reset();
 
     g_audio_initialized = false;
     asp_log_info("musicplayer", "Audio cleanup complete");
 }
 
+// Commands that replace the current song make its pending events stale
+#define SONG_EVENTS  (AUDIO_EVENT_FINISHED | AUDIO_EVENT_TRACK_CHANGED)
+
+// Queue a command and wake the decoder if it is blocked on the PCM ring
+static void post_command(audio_cmd_type_t type, const char* path, uint32_t value, uint32_t cancel_events) {
+    if (audio_cmd_post(type, path, value, cancel_events) == 0) {
+        pcm_ring_wake();
+    }
+}
+
 void audio_play_file(const char* path) {
-    // Stop current playback - decoder thread will close file
-    g_playing = false;
-    g_paused = false;
+    post_command(AUDIO_CMD_PLAY, path, 0, SONG_EVENTS);
+}
 
-    // Wait a bit for decoder thread to notice and stop
-    asp_plugin_delay_ms(30);
+void audio_resume_file(const char* path, const audio_checkpoint_t* checkpoint) {
+    if (checkpoint->position_ms == 0) {
+        audio_play_file(path);
+        return;
+    }
+    // The command queue hands g_play_at over to the decoder thread
+    g_play_at = *checkpoint;
+    post_command(AUDIO_CMD_PLAY, path, checkpoint->position_ms, SONG_EVENTS);
+}
 
-    // Signal decoder thread to play new file
-    strncpy(g_pending_path, path, sizeof(g_pending_path) - 1);
-    g_pending_path[sizeof(g_pending_path) - 1] = '\0';
-    g_new_file_pending = true;
+void audio_queue_next(const char* path) {
+    post_command(AUDIO_CMD_QUEUE_NEXT, path, 0, 0);
 }
 
 void audio_stop(void) {
-    g_playing = false;
-    g_paused = false;
-    g_new_file_pending = false;
-    asp_audio_set_amplifier(false);
+    post_command(AUDIO_CMD_STOP, NULL, 0, SONG_EVENTS);
+}
+
+void audio_seek_ms(uint32_t position_ms) {
+    // The song goes on, so a finish reported before the seek is stale
+    post_command(AUDIO_CMD_SEEK, NULL, position_ms, AUDIO_EVENT_FINISHED);
 }
 
 void audio_pause(void) {
-    g_paused = true;
-    asp_audio_set_amplifier(false);
+    post_command(AUDIO_CMD_PAUSE, NULL, 0, 0);
 }
 
 void audio_resume(void) {
-    if (g_playing) {
-        g_paused = false;
-        asp_audio_set_amplifier(true);
-    }
+    post_command(AUDIO_CMD_RESUME, NULL, 0, 0);
 }
 
 void audio_set_volume(uint8_t volume) {
+    // The decoder ramps to the new gain from the next frame on
     if (volume > 100) volume = 100;
-    asp_audio_set_volume((float)volume);
+    g_volume = volume;
+}
+
+void audio_set_discard_output(bool discard) {
+    g_discard_output = discard;
 }
 
 bool audio_is_finished(void) {
-    return g_song_finished;
+    // Not finished any more once a new song or a stop is queued
+    return g_song_finished && !audio_cmd_cancels(AUDIO_EVENT_FINISHED);
+}
+
+// Copy src into an empty text field
+static void fill_empty(char* field, const char* src) {
+    if (field[0] == '\0') memcpy(field, src, ID3_TEXT_MAX);
+}
+
+void audio_get_tags(id3_tags_t* out) {
+    pthread_mutex_lock(&g_tags_lock);
+    *out = g_tags;
+    if (out->title[0] == '\0' && strcmp(g_v1_path, g_tags_path) == 0) {
+        fill_empty(out->title, g_v1_tags.title);
+        fill_empty(out->artist, g_v1_tags.artist);
+        fill_empty(out->album, g_v1_tags.album);
+        if (out->track == 0) out->track = g_v1_tags.track;
+    }
+    pthread_mutex_unlock(&g_tags_lock);
+}
+
+bool audio_get_decoder_stack(uint32_t* out_used, uint32_t* out_size) {
+    *out_used = g_decoder_stack_used;
+    *out_size = DECODER_STACK_SIZE;
+    return *out_used != 0;
+}
+
+void audio_set_v1_tags(const char* path, const id3_tags_t* tags) {
+    pthread_mutex_lock(&g_tags_lock);
+    strncpy(g_v1_path, path, sizeof(g_v1_path) - 1);
+    g_v1_path[sizeof(g_v1_path) - 1] = '\0';
+    g_v1_tags = *tags;
+    pthread_mutex_unlock(&g_tags_lock);
 }
 
 uint32_t audio_get_position_ms(void) {
     if (g_sample_rate == 0) return 0;
-    return (uint32_t)((g_samples_written * 1000ULL) / g_sample_rate);
+    return (uint32_t)(((g_position_base + g_samples_written) * 1000ULL) / g_sample_rate);
+}
+
+bool audio_get_checkpoint(audio_checkpoint_t* out, char* path, size_t path_size) {
+    pthread_mutex_lock(&g_checkpoint_lock);
+    bool valid = g_playing && g_checkpoint_valid;
+    if (valid) {
+        *out = g_checkpoint;
+        strncpy(path, g_checkpoint_path, path_size - 1);
+        path[path_size - 1] = '\0';
+    }
+    pthread_mutex_unlock(&g_checkpoint_lock);
+    return valid;
 }
 
-bool audio_process(void) {
-    // Processing is now done in decoder thread
-    // Just return current state
-    return g_playing && !g_song_finished;
+uint32_t audio_wait_events(uint32_t timeout_ms) {
+    return audio_cmd_wait_events(timeout_ms);
 }
@@ -5,6 +5,21 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include "id3.h"
+
+// Events reported by audio_wait_events()
+#define AUDIO_EVENT_STARTED         (1u << 0)  // A file passed to audio_play_file() started
+#define AUDIO_EVENT_FINISHED        (1u << 1)  // The song played out and nothing follows
+#define AUDIO_EVENT_TRACK_CHANGED   (1u << 2)  // The queued song became audible without a gap
+#define AUDIO_EVENT_ERROR           (1u << 3)  // A file could not be opened
+
+// Where in a song playback is, to start there again after a restart
+typedef struct {
+    uint32_t position_ms;   // Position heard
+    uint64_t offset;        // File offset decoding can restart from for it, 0 if unknown
+    uint64_t sample;        // Stream sample starting at offset
+} audio_checkpoint_t;
 
 // Initialize audio subsystem
 // Returns 0 on success, -1 on failure
@@ -13,10 +28,19 @@ int audio_init(void);
 // Cleanup audio subsystem
 void audio_cleanup(void);
 
-// Start playing an MP3 file
-// path: full path to the MP3 file
+// Start playing an MP3, FLAC or WAV file (returns immediately, AUDIO_EVENT_STARTED follows)
+// path: full path to the audio file
 void audio_play_file(const char* path);
 
+// Start playing a file at a checkpoint taken from it by audio_get_checkpoint()
+// Seeks straight to the checkpoint's restart offset, without waiting for
+// the file to be indexed
+void audio_resume_file(const char* path, const audio_checkpoint_t* checkpoint);
+
+// Set the song to continue with gaplessly when the current one ends
+// path: full path to the audio file, or NULL to stop after the current song
+void audio_queue_next(const char* path);
+
 // Stop current playback
 void audio_stop(void);
 
@@ -26,16 +50,42 @@ void audio_pause(void);
 // Resume playback after pause
 void audio_resume(void);
 
+// Jump to position_ms in the current song
+// Exact when the file has been indexed; uses the VBR tag's TOC, or the bitrate,
+// for positions the background index has not reached yet
+void audio_seek_ms(uint32_t position_ms);
+
 // Set volume (0-100)
 void audio_set_volume(uint8_t volume);
 
+// Drop decoded PCM instead of writing it to I2S, so playback runs as fast
+// as the decoder goes (benchmark mode)
+void audio_set_discard_output(bool discard);
+
 // Check if current song has finished playing
 bool audio_is_finished(void);
 
+// Peak stack use of the decoder thread so far and its stack size, in bytes
+// Returns false where the RTOS cannot tell (host builds) or before it is measured
+bool audio_get_decoder_stack(uint32_t* out_used, uint32_t* out_size);
+
+// Copy the ID3v2 tags of the song being heard (all empty if it has none);
+// without an ID3v2 title, the empty fields come from its ID3v1 tag if one was
+// handed over with audio_set_v1_tags()
+void audio_get_tags(id3_tags_t* out);
+
+// Hand over the ID3v1 tag read from path with id3_read_v1(), which waits on the
+// card: the service thread reads it, so the audio threads never do
+void audio_set_v1_tags(const char* path, const id3_tags_t* tags);
+
 // Get current playback position in milliseconds
 uint32_t audio_get_position_ms(void);
 
-// Process audio - call this regularly from the service loop
-// Decodes and plays audio frames
-// Returns true if still playing, false if song finished or stopped
-bool audio_process(void);
+// Latest checkpoint of the song being heard and its path (refreshed about
+// once a second while it plays)
+// Returns false while nothing is playing
+bool audio_get_checkpoint(audio_checkpoint_t* out, char* path, size_t path_size);
+
+// Wait up to timeout_ms for playback events
+// Returns the AUDIO_EVENT_* bits raised since the last call (0 on timeout)
+uint32_t audio_wait_events(uint32_t timeout_ms);
@@ -0,0 +1,179 @@
+// SPDX-License-Identifier: MIT
+// Music Player Plugin - Audio Command Queue
+// Fixed-size FIFO guarded by one mutex; the decoder thread is the only consumer
+
+#include "audio_cmd.h"
+#include "thread_util.h"
+#include "tanmatsu_plugin.h"
+#include <string.h>
+#include <pthread.h>
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_cond_cmd = PTHREAD_COND_INITIALIZER;    // Signalled when a command is queued
+static pthread_cond_t g_cond_event = PTHREAD_COND_INITIALIZER;  // Signalled when events are raised
+static pthread_cond_t g_cond_space = PTHREAD_COND_INITIALIZER;  // Signalled when a command is taken
+
+// Longest a post waits for the decoder thread to take a command off a full queue
+#define FULL_WAIT_MS    100
+
+static audio_cmd_t g_queue[AUDIO_CMD_QUEUE_DEPTH];
+static uint32_t g_head = 0;     // Next command to take
+static uint32_t g_count = 0;    // Queued commands
+static bool g_handling = false; // Between audio_cmd_take() and audio_cmd_done()
+
+static uint32_t g_events = 0;
+static uint32_t g_handling_cancels = 0;  // cancel_events of the command being handled
+
+// Events cancelled by queued or in-progress commands (lock held)
+static uint32_t cancelled_events(void) {
+    uint32_t mask = g_handling ? g_handling_cancels : 0;
+    for (uint32_t i = 0; i < g_count; i++) {
+        mask |= g_queue[(g_head + i) % AUDIO_CMD_QUEUE_DEPTH].cancel_events;
+    }
+    return mask;
+}
+
+void audio_cmd_reset(void) {
+    pthread_mutex_lock(&g_lock);
+    g_head = 0;
+    g_count = 0;
+    g_handling = false;
+    g_handling_cancels = 0;
+    g_events = 0;
+    pthread_mutex_unlock(&g_lock);
+}
+
+// Seeks and successor changes come in bursts and only the newest matters
+static bool is_transient(audio_cmd_type_t type) {
+    return type == AUDIO_CMD_SEEK || type == AUDIO_CMD_QUEUE_NEXT;
+}
+
+// Entry for a command of type: the newest queued one if it is the same type
+// (the new one supersedes it), else a free entry, else a queued seek or
+// successor change it displaces; NULL if the command has to be dropped (lock held)
+static audio_cmd_t* entry_for(audio_cmd_type_t type, uint32_t* cancel_events) {
+    if (g_count > 0) {
+        audio_cmd_t* last = &g_queue[(g_head + g_count - 1) % AUDIO_CMD_QUEUE_DEPTH];
+        if (last->type == type) {
+            *cancel_events |= last->cancel_events;
+            return last;
+        }
+    }
+
+    // Give the decoder thread a moment to take one
+    if (g_count >= AUDIO_CMD_QUEUE_DEPTH) {
+        cond_wait_ms(&g_cond_space, &g_lock, FULL_WAIT_MS);
+    }
+    if (g_count < AUDIO_CMD_QUEUE_DEPTH) {
+        return &g_queue[(g_head + g_count++) % AUDIO_CMD_QUEUE_DEPTH];
+    }
+
+    // Still full: never drop a state change, rather the newest seek or
+    // successor change queued (or the newest command if all change state)
+    if (is_transient(type)) return NULL;
+    for (uint32_t i = g_count; i-- > 0;) {
+        audio_cmd_t* cmd = &g_queue[(g_head + i) % AUDIO_CMD_QUEUE_DEPTH];
+        if (is_transient(cmd->type)) {
+            asp_log_warn("musicplayer", "Command queue full, command %d replaces %d", (int)type, (int)cmd->type);
+            *cancel_events |= cmd->cancel_events;
+            return cmd;
+        }
+    }
+    audio_cmd_t* last = &g_queue[(g_head + g_count - 1) % AUDIO_CMD_QUEUE_DEPTH];
+    asp_log_warn("musicplayer", "Command queue full, command %d replaces %d", (int)type, (int)last->type);
+    *cancel_events |= last->cancel_events;
+    return last;
+}
+
+int audio_cmd_post(audio_cmd_type_t type, const char* path, uint32_t value, uint32_t cancel_events) {
+    pthread_mutex_lock(&g_lock);
+    audio_cmd_t* cmd = entry_for(type, &cancel_events);
+    if (!cmd) {
+        pthread_mutex_unlock(&g_lock);
+        asp_log_warn("musicplayer", "Command queue full, dropping command %d", (int)type);
+        return -1;
+    }
+
+    cmd->type = type;
+    cmd->cancel_events = cancel_events;
+    cmd->value = value;
+    cmd->path[0] = '\0';
+    if (path) {
+        strncpy(cmd->path, path, sizeof(cmd->path) - 1);
+        cmd->path[sizeof(cmd->path) - 1] = '\0';
+    }
+    g_events &= ~cancel_events;
+    pthread_cond_signal(&g_cond_cmd);
+    pthread_mutex_unlock(&g_lock);
+    return 0;
+}
+
+bool audio_cmd_take(audio_cmd_t* out, uint32_t timeout_ms) {
+    pthread_mutex_lock(&g_lock);
+    if (g_count == 0 && timeout_ms > 0) {
+        if (timeout_ms == AUDIO_CMD_WAIT_FOREVER) {
+            while (g_count == 0) {
+                pthread_cond_wait(&g_cond_cmd, &g_lock);
+            }
+        } else {
+            cond_wait_ms(&g_cond_cmd, &g_lock, timeout_ms);
+        }
+    }
+
+    bool taken = g_count > 0;
+    if (taken) {
+        memcpy(out, &g_queue[g_head], sizeof(*out));
+        g_head = (g_head + 1) % AUDIO_CMD_QUEUE_DEPTH;
+        g_count--;
+        g_handling = true;
+        pthread_cond_signal(&g_cond_space);
+        g_handling_cancels = out->cancel_events;
+    }
+    pthread_mutex_unlock(&g_lock);
+    return taken;
+}
+
+void audio_cmd_done(void) {
+    pthread_mutex_lock(&g_lock);
+    g_handling = false;
+    g_handling_cancels = 0;
+    pthread_mutex_unlock(&g_lock);
+}
+
+bool audio_cmd_pending(void) {
+    pthread_mutex_lock(&g_lock);
+    bool pending = g_count > 0;
+    pthread_mutex_unlock(&g_lock);
+    return pending;
+}
+
+bool audio_cmd_cancels(uint32_t events) {
+    pthread_mutex_lock(&g_lock);
+    bool cancels = (cancelled_events() & events) != 0;
+    pthread_mutex_unlock(&g_lock);
+    return cancels;
+}
+
+uint32_t audio_cmd_notify(uint32_t events) {
+    pthread_mutex_lock(&g_lock);
+    // Checked under the same lock as audio_cmd_post(), so an event is never
+    // raised for a song that a just-posted command already replaced
+    events &= ~cancelled_events();
+    if (events) {
+        g_events |= events;
+        pthread_cond_broadcast(&g_cond_event);
+    }
+    pthread_mutex_unlock(&g_lock);
+    return events;
+}
+
+uint32_t audio_cmd_wait_events(uint32_t timeout_ms) {
+    pthread_mutex_lock(&g_lock);
+    if (g_events == 0 && timeout_ms > 0) {
+        cond_wait_ms(&g_cond_event, &g_lock, timeout_ms);
+    }
+    uint32_t events = g_events;
+    g_events = 0;
+    pthread_mutex_unlock(&g_lock);
+    return events;
+}
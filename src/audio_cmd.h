@@ -0,0 +1,65 @@
+// SPDX-License-Identifier: MIT
+// Music Player Plugin - Audio Command Queue
+// Control requests from the input hook and service loop to the decoder thread,
+// and event notifications back from the audio threads to the service loop.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "readahead.h"
+
+// Commands that can be queued before the decoder thread picks them up
+#define AUDIO_CMD_QUEUE_DEPTH   8
+
+// Timeout value for waiting without a limit
+#define AUDIO_CMD_WAIT_FOREVER  UINT32_MAX
+
+typedef enum {
+    AUDIO_CMD_PLAY,         // Start playing path
+    AUDIO_CMD_STOP,         // Stop playback and drop queued frames
+    AUDIO_CMD_PAUSE,        // Hold output, keep queued frames
+    AUDIO_CMD_RESUME,       // Continue after pause
+    AUDIO_CMD_QUEUE_NEXT,   // Set the gapless successor (empty path clears it)
+    AUDIO_CMD_SEEK,         // Jump to value milliseconds into the current song
+    AUDIO_CMD_QUIT,         // Decoder thread exits
+} audio_cmd_type_t;
+
+typedef struct {
+    audio_cmd_type_t type;
+    uint32_t cancel_events;         // Events that no longer apply once this is queued
+    uint32_t value;                 // Command argument (seek position)
+    char path[READAHEAD_PATH_MAX];
+} audio_cmd_t;
+
+// Empty the queue and drop all pending events
+void audio_cmd_reset(void);
+
+// Queue a command; path may be NULL, value is the command argument. Events in cancel_events that were not
+// delivered yet are dropped, and are not raised until the command is handled
+// A command replaces the newest queued one of the same type (a burst of seeks
+// keeps the last). On a full queue it waits briefly for the decoder thread,
+// then a state change (play, stop, pause, resume, quit) displaces a queued seek
+// or successor change, or else the newest command
+// Returns 0 on success, -1 if a seek or successor change was dropped (queue full)
+int audio_cmd_post(audio_cmd_type_t type, const char* path, uint32_t value, uint32_t cancel_events);
+
+// Take the oldest command, waiting up to timeout_ms (0 only polls)
+// Its cancel_events stay in effect until audio_cmd_done() is called
+bool audio_cmd_take(audio_cmd_t* out, uint32_t timeout_ms);
+
+// Mark the command returned by audio_cmd_take() as handled
+void audio_cmd_done(void);
+
+// True while commands are queued
+bool audio_cmd_pending(void);
+
+// True while a queued or in-progress command cancels any of events
+bool audio_cmd_cancels(uint32_t events);
+
+// Raise events for audio_cmd_wait_events(), except those a command cancels
+// Returns the events actually raised
+uint32_t audio_cmd_notify(uint32_t events);
+
+// Wait up to timeout_ms for events; returns and clears the raised events (0 on timeout)
+uint32_t audio_cmd_wait_events(uint32_t timeout_ms);
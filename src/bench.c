@@ -0,0 +1,295 @@
+// SPDX-License-Identifier: MIT
+// Music Player Plugin - Benchmark Mode
+
+#include "bench.h"
+#include "audio.h"
+#include "playlist.h"
+#include "mp3_info.h"
+#include "mp3_decoder.h"
+#include "stats.h"
+#include "mem.h"
+#include "../include/music_player.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+
+// Placement passes run in their own thread; the decoder thread's stack size plus
+// room for the host's thread bookkeeping below the painted area
+#define BENCH_STACK_SIZE    (16 * 1024)
+
+// Stack painted below the placement thread's entry frame to find its high-water
+// mark; the gap leaves the painting loop's own frame alone, the rest of the
+// stack covers the thread's entry frame and the RTOS bookkeeping
+#define BENCH_PAINT_GAP     512
+#define BENCH_PAINT_BYTES   (BENCH_STACK_SIZE - 8 * 1024)
+#define BENCH_PAINT_WORD    0xA5A5A5A5u
+
+// Start of the song decoded by each placement pass (loaded to PSRAM up front)
+#define BENCH_CLIP_BYTES    (192 * 1024)
+
+// Give up on the pipeline pass after this long
+#define BENCH_TIMEOUT_MS    (10 * 60 * 1000)
+#define BENCH_WAIT_MS       200
+
+#define BENCH_DIALOG_MS     30000
+
+typedef struct {
+    const char* name;
+    mem_place_t place;
+} bench_place_t;
+
+static const bench_place_t g_places[] = {
+    { "SRAM",  MEM_INTERNAL },
+    { "PSRAM", MEM_PSRAM },
+};
+#define BENCH_PLACES  (int)(sizeof(g_places) / sizeof(g_places[0]))
+
+typedef struct {
+    bool ok;
+    uint32_t frames;
+    uint32_t avg_us;
+    uint32_t max_us;
+} bench_result_t;
+
+// Placement thread input and output
+static const uint8_t* g_clip = NULL;
+static size_t g_clip_len = 0;
+static bench_result_t g_results[BENCH_PLACES][BENCH_PLACES];  // [state][pcm]
+static uint32_t g_stack_used = 0;
+static bool g_stack_past_paint = false;  // Reached the end of the painted area
+
+// Load the start of the audio data (after any ID3v2 tag) into PSRAM
+static int load_clip(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (!file) return -1;
+
+    uint8_t header[10];
+    size_t tag = 0;
+    if (fread(header, 1, sizeof(header), file) == sizeof(header)) {
+        tag = mp3_info_id3v2_size(header, sizeof(header));
+    }
+
+    uint8_t* clip = (uint8_t*)mem_alloc(BENCH_CLIP_BYTES, MEM_PSRAM);
+    size_t len = 0;
+    if (clip && fseek(file, (long)tag, SEEK_SET) == 0) {
+        len = fread(clip, 1, BENCH_CLIP_BYTES, file);
+    }
+    fclose(file);
+
+    if (len == 0) {
+        free(clip);
+        return -1;
+    }
+    g_clip = clip;
+    g_clip_len = len;
+    return 0;
+}
+
+// Decode the whole clip with the given decoder state and scratch, and PCM buffer
+static void decode_clip(mp3dec_t* dec, mp3dec_scratch_t* scratch, int16_t* pcm, bench_result_t* result) {
+    mp3dec_init(dec);
+
+    size_t offset = 0;
+    uint64_t total_us = 0;
+    memset(result, 0, sizeof(*result));
+
+    while (offset < g_clip_len) {
+        mp3dec_frame_info_t info;
+        uint64_t start = stats_now_us();
+        int samples = mp3dec_decode_frame_scratch(dec, g_clip + offset, (int)(g_clip_len - offset), pcm, &info,
+                                                  scratch, NULL);
+        uint64_t elapsed = stats_now_us() - start;
+
+        if (info.frame_bytes == 0) break;  // No more frames in the clip
+        offset += info.frame_bytes;
+        if (samples == 0) continue;  // Skipped data, not a decoded frame
+
+        result->frames++;
+        total_us += elapsed;
+        if (elapsed > result->max_us) result->max_us = (uint32_t)elapsed;
+    }
+
+    if (result->frames > 0) {
+        result->ok = true;
+        result->avg_us = (uint32_t)(total_us / result->frames);
+    }
+}
+
+static void* placement_thread_func(void* arg) {
+    (void)arg;
+
+    // Paint the unused part of the stack; words the decoder overwrites mark its depth
+    uintptr_t entry_sp = (uintptr_t)__builtin_frame_address(0);
+    volatile uint32_t* paint_top = (volatile uint32_t*)((entry_sp - BENCH_PAINT_GAP) & ~(uintptr_t)3);
+    volatile uint32_t* paint_end = paint_top - BENCH_PAINT_BYTES / sizeof(uint32_t);
+    for (volatile uint32_t* p = paint_end; p < paint_top; p++) {
+        *p = BENCH_PAINT_WORD;
+    }
+
+    for (int s = 0; s < BENCH_PLACES; s++) {
+        for (int p = 0; p < BENCH_PLACES; p++) {
+            mp3dec_t* dec = (mp3dec_t*)mem_alloc_strict(sizeof(mp3dec_t), g_places[s].place);
+            mp3dec_scratch_t* scratch = (mp3dec_scratch_t*)mem_alloc_strict(mp3dec_scratch_size(),
+                                                                            g_places[s].place);
+            int16_t* pcm = (int16_t*)mem_alloc_strict(MINIMP3_MAX_SAMPLES_PER_FRAME * sizeof(int16_t),
+                                                      g_places[p].place);
+            if (dec && scratch && pcm) {
+                decode_clip(dec, scratch, pcm, &g_results[s][p]);
+            } else {
+                asp_log_warn("musicplayer", "Bench: no %s/%s memory for state/PCM",
+                             g_places[s].name, g_places[p].name);
+            }
+            free(pcm);
+            free(scratch);
+            free(dec);
+        }
+    }
+
+    volatile uint32_t* deepest = paint_end;
+    while (deepest < paint_top && *deepest == BENCH_PAINT_WORD) {
+        deepest++;
+    }
+    g_stack_used = (uint32_t)(entry_sp - (uintptr_t)deepest);
+    g_stack_past_paint = (deepest == paint_end);
+    return NULL;
+}
+
+// Decode the clip once per placement in a thread sized like the decoder's
+static int run_placements(void) {
+    memset(g_results, 0, sizeof(g_results));
+    g_stack_used = 0;
+    g_stack_past_paint = false;
+
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, BENCH_STACK_SIZE);
+    int err = pthread_create(&thread, &attr, placement_thread_func, NULL);
+    pthread_attr_destroy(&attr);
+
+    if (err != 0) {
+        asp_log_warn("musicplayer", "Failed to create bench thread: %d", err);
+        return -1;
+    }
+    pthread_join(thread, NULL);
+    return 0;
+}
+
+// Play the song through the whole pipeline without waiting for I2S
+// Returns the audio played in ms, and the wall time taken in *wall_us
+static uint32_t run_pipeline(plugin_context_t* ctx, const char* path, uint64_t* wall_us,
+                             stats_snapshot_t* snap) {
+    audio_set_discard_output(true);
+    audio_wait_events(0);  // Drop events from before the run
+
+    uint64_t start = stats_now_us();
+    audio_play_file(path);
+
+    while (!asp_plugin_should_stop(ctx) && stats_now_us() - start < BENCH_TIMEOUT_MS * 1000ULL) {
+        uint32_t events = audio_wait_events(BENCH_WAIT_MS);
+        if (events & AUDIO_EVENT_ERROR) break;
+        if ((events & AUDIO_EVENT_FINISHED) && audio_is_finished()) break;
+    }
+
+    *wall_us = stats_now_us() - start;
+    stats_snapshot(snap);
+    uint32_t audio_ms = audio_get_position_ms();
+
+    audio_stop();
+    audio_set_discard_output(false);
+    return audio_ms;
+}
+
+int bench_run(plugin_context_t* ctx, int index) {
+    const char* filename = playlist_get_filename(index);
+    if (!filename) return -1;
+
+    char path[MAX_FILENAME_LENGTH + sizeof(MUSIC_DIR)];
+    snprintf(path, sizeof(path), "%s/%s", MUSIC_DIR, filename);
+    asp_log_info("musicplayer", "Benchmarking %s", path);
+
+    if (load_clip(path) != 0) {
+        asp_log_warn("musicplayer", "Bench: cannot read %s", path);
+        return -1;
+    }
+
+    uint64_t wall_us = 0;
+    stats_snapshot_t snap;
+    uint32_t audio_ms = run_pipeline(ctx, path, &wall_us, &snap);
+    int placed = run_placements();
+
+    free((void*)g_clip);
+    g_clip = NULL;
+    g_clip_len = 0;
+
+    if (audio_ms == 0 || wall_us == 0) {
+        asp_log_warn("musicplayer", "Bench: nothing decoded from %s", path);
+        return -1;
+    }
+
+    // Build report lines
+    static char line1[128];
+    static char line2[64];
+    static char line3[64];
+    static char line4[64];
+    static char line5[64];
+    static char line6[64];
+    static char place_lines[BENCH_PLACES * BENCH_PLACES][64];
+
+    const stats_hist_t* decode = &snap.timers[STATS_DECODE];
+    const stats_hist_t* read = &snap.timers[STATS_READ];
+    uint32_t realtime_x10 = (uint32_t)((uint64_t)audio_ms * 10000 / wall_us);
+
+    snprintf(line1, sizeof(line1), "%s", filename);
+    snprintf(line2, sizeof(line2), "Realtime x%u.%u (%u ms in %u ms)",
+             (unsigned)(realtime_x10 / 10), (unsigned)(realtime_x10 % 10),
+             (unsigned)audio_ms, (unsigned)(wall_us / 1000));
+    snprintf(line3, sizeof(line3), "Decode: avg %u us, p99 <%u us, max %u us",
+             decode->count ? (unsigned)(decode->total_us / decode->count) : 0,
+             (unsigned)stats_percentile_us(decode, 99), (unsigned)decode->max_us);
+    snprintf(line4, sizeof(line4), "SD read: avg %u us, max %u us, stalls %u",
+             read->count ? (unsigned)(read->total_us / read->count) : 0,
+             (unsigned)read->max_us, (unsigned)snap.counters[STATS_READ_STALL]);
+    snprintf(line5, sizeof(line5), "Decode stack: %s%u of %u bytes",
+             g_stack_past_paint ? ">" : "", (unsigned)g_stack_used, (unsigned)BENCH_STACK_SIZE);
+
+    const char* lines[6 + BENCH_PLACES * BENCH_PLACES] = { line1, line2, line3, line4, line5 };
+    int count = 5;
+
+    // The whole pipeline's peak on the decoder thread, from the RTOS
+    uint32_t thread_used, thread_size;
+    if (audio_get_decoder_stack(&thread_used, &thread_size)) {
+        snprintf(line6, sizeof(line6), "Decoder thread stack: %u of %u bytes",
+                 (unsigned)thread_used, (unsigned)thread_size);
+        lines[count++] = line6;
+    }
+
+    if (placed == 0) {
+        for (int s = 0; s < BENCH_PLACES; s++) {
+            for (int p = 0; p < BENCH_PLACES; p++) {
+                const bench_result_t* result = &g_results[s][p];
+                char* line = place_lines[s * BENCH_PLACES + p];
+                if (result->ok) {
+                    snprintf(line, sizeof(place_lines[0]), "State %s, PCM %s: avg %u us, max %u us",
+                             g_places[s].name, g_places[p].name,
+                             (unsigned)result->avg_us, (unsigned)result->max_us);
+                } else {
+                    snprintf(line, sizeof(place_lines[0]), "State %s, PCM %s: n/a",
+                             g_places[s].name, g_places[p].name);
+                }
+                lines[count++] = line;
+            }
+        }
+    }
+
+    asp_log_info("musicplayer", "Bench results:");
+    for (int i = 0; i < count; i++) {
+        asp_log_info("musicplayer", "  %s", lines[i]);
+    }
+    stats_dump();
+
+    asp_plugin_show_text_dialog("Music Player Benchmark", lines, count, BENCH_DIALOG_MS);
+    return 0;
+}
@@ -0,0 +1,16 @@
+// SPDX-License-Identifier: MIT
+// Music Player Plugin - Benchmark Mode
+// Decodes one song flat out with the I2S write bypassed and reports the
+// realtime factor, per-frame decode times and the stack use of the decoder and
+// of the whole decoder thread, then decodes the start of it once for each
+// SRAM/PSRAM placement of the decoder state (scratch included) and PCM buffer.
+// Enabled by the "bench" plugin setting.
+
+#pragma once
+
+#include "tanmatsu_plugin.h"
+
+// Benchmark playlist entry index; blocks until done or the plugin is stopped
+// Results go to the log and a text dialog
+// Returns 0 on success, -1 if the song could not be benchmarked
+int bench_run(plugin_context_t* ctx, int index);
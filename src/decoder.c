@@ -0,0 +1,46 @@
+// SPDX-License-Identifier: MIT
+// Music Player Plugin - Decoders
+
+#include "decoder.h"
+#include <string.h>
+#include <strings.h>
+
+// Probed in order; MP3 (which accepts anything) comes last
+static const decoder_ops_t* const g_decoders[] = {
+    &decoder_flac,
+    &decoder_wav,
+    &decoder_mp3,
+};
+#define DECODER_COUNT  (int)(sizeof(g_decoders) / sizeof(g_decoders[0]))
+
+int decoder_init(void) {
+    for (int i = 0; i < DECODER_COUNT; i++) {
+        if (g_decoders[i]->init() != 0) {
+            while (--i >= 0) g_decoders[i]->cleanup();
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void decoder_cleanup(void) {
+    for (int i = DECODER_COUNT - 1; i >= 0; i--) {
+        g_decoders[i]->cleanup();
+    }
+}
+
+const decoder_ops_t* decoder_find(const uint8_t* buf, size_t len) {
+    for (int i = 0; i < DECODER_COUNT - 1; i++) {
+        if (g_decoders[i]->probe(buf, len)) return g_decoders[i];
+    }
+    return &decoder_mp3;
+}
+
+bool decoder_plays_file(const char* filename) {
+    const char* ext = strrchr(filename, '.');
+    if (!ext) return false;
+    for (int i = 0; i < DECODER_COUNT; i++) {
+        if (strcasecmp(ext, g_decoders[i]->extension) == 0) return true;
+    }
+    return false;
+}
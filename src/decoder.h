@@ -0,0 +1,126 @@
+// SPDX-License-Identifier: MIT
+// Music Player Plugin - Decoders
+// Each format's decoder sits behind one table of functions, so the decoder
+// thread's pipeline (read-ahead, ID3 tags, gapless trimming, output gain, PCM
+// ring, seeking) is shared. Decoders work on the read-ahead's contiguous view
+// of the stream and write PCM straight into a ring slot with the output gain
+// applied. All of them run on the decoder thread, one track at a time, and keep
+// their state in static storage.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "mp3_info.h"
+#include "gain.h"
+
+// Stream data handed to a decoder
+typedef struct {
+    const uint8_t* data;    // Buffered bytes at the read cursor
+    size_t len;
+    bool eof;               // Nothing follows data
+    uint64_t offset;        // File offset of data (read_header only)
+    const char* path;       // File being played
+} decoder_input_t;
+
+// Stream layout, from the header
+typedef struct {
+    bool valid;                 // Fields below are known (MP3 can play without)
+    uint32_t sample_rate;
+    int channels;
+    uint32_t frame_samples;     // Most sample frames one decode step produces
+    size_t min_bytes;           // Stream bytes to have buffered for a decode step
+    uint32_t trim_start;        // Samples per channel to drop at the start
+    uint64_t total_samples;     // Samples per channel (after trimming), 0 if unknown
+    mp3_replaygain_t replaygain;  // From the encoder, if the format has one
+} decoder_stream_t;
+
+typedef enum {
+    DECODER_HEADER_MORE,    // Call again after moving past *skip bytes (0: wait for more data)
+    DECODER_HEADER_DONE,    // Audio data starts after *skip bytes
+    DECODER_HEADER_BAD,     // The stream cannot be played
+} decoder_header_t;
+
+// Result of one decode step
+typedef struct {
+    size_t consumed;        // Stream bytes used
+    uint32_t frames;        // Sample frames written, 0 if none
+    uint32_t rate;          // Sample rate and channels of what was written
+    int channels;
+    uint32_t bitrate_kbps;
+    bool damaged;           // consumed held no good frame (junk or a broken frame skipped)
+    const uint16_t* bands;  // PCM_RING_BANDS shares of the frame's energy (Q16), NULL if not known
+} decoder_frame_t;
+
+// Where to restart reading for a seek
+typedef struct {
+    uint64_t offset;        // File offset to read from
+    uint32_t discard;       // Samples per channel to drop from what follows
+    const char* method;     // For the log
+} decoder_seek_t;
+
+// A place decoding can start from without searching, e.g. to resume a song
+typedef struct {
+    uint64_t sample;        // Stream sample starting there (start trim included)
+    uint64_t offset;        // File offset
+} decoder_point_t;
+
+typedef struct {
+    const char* name;       // For the log
+    const char* extension;  // File name extension of the format, e.g. ".mp3"
+
+    // True if the stream at buf (past any ID3v2 tag) is in this format
+    bool (*probe)(const uint8_t* buf, size_t len);
+
+    // Allocate decoder state at audio_init(); returns 0 on success, -1 on failure
+    int (*init)(void);
+    void (*cleanup)(void);
+
+    // Read the stream header, starting at the first byte probe() was given;
+    // fills stream once done. *skip can go past in->len to skip large metadata
+    decoder_header_t (*read_header)(const decoder_input_t* in, decoder_stream_t* stream, uint64_t* skip);
+
+    // Decode the next frame into pcm (PCM_RING_SLOT_SAMPLES) with the gain
+    // ramped across it. consumed and frames both 0 means the frame is not all in
+    // in->data (with in->eof, the stream is used up). On damage, consume what
+    // was scanned without finding a frame, so a resync never rescans it
+    void (*decode)(const decoder_input_t* in, int16_t* pcm, const gain_ramp_t* gain, decoder_frame_t* out);
+
+    // Prepare for reading on from out->offset so that sample sample of the
+    // track (counted past the start trim) comes first after out->discard more
+    // hint, if not NULL, is a restart_point() found earlier for this file
+    // Returns 0 on success, -1 if not possible
+    int (*seek)(uint64_t sample, const decoder_point_t* hint, decoder_seek_t* out);
+
+    // Restart point seek() would use for sample from what is known of the
+    // stream so far, to find it again later without that knowledge
+    // Returns false if there is none; NULL if seek() needs no hint
+    bool (*restart_point)(uint64_t sample, decoder_point_t* out);
+
+    // Forget the stream (stops any background work on its file)
+    void (*close)(void);
+
+    // Duration in ms of the stream whose first len bytes (past any ID3v2 tag)
+    // are at buf, the stream being stream_bytes long; 0 if it cannot be told
+    // Reentrant: called from the duration scan thread
+    uint32_t (*duration_ms)(const uint8_t* buf, size_t len, uint64_t stream_bytes);
+} decoder_ops_t;
+
+extern const decoder_ops_t decoder_mp3;
+extern const decoder_ops_t decoder_flac;
+extern const decoder_ops_t decoder_wav;
+
+// Initialize all decoders
+// Returns 0 on success, -1 on failure
+int decoder_init(void);
+
+// Free all decoders
+void decoder_cleanup(void);
+
+// Decoder for the stream at buf (past any ID3v2 tag); MP3 unless another format
+// is recognized, since minimp3 resyncs over whatever precedes its first frame
+const decoder_ops_t* decoder_find(const uint8_t* buf, size_t len);
+
+// True if filename has the extension of a playable format
+bool decoder_plays_file(const char* filename);
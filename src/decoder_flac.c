@@ -0,0 +1,763 @@
+// SPDX-License-Identifier: MIT
+// Music Player Plugin - FLAC Decoder
+// Integer-only FLAC decoding (8 to 24 bits, mono or stereo). A frame is decoded
+// whole into per-channel blocks, checked against its CRC-16 and handed to the
+// PCM ring a slot at a time, converted to 16 bits with the output gain.
+// Metadata is walked as it streams in: STREAMINFO and the SEEKTABLE are kept,
+// everything else (pictures, tags) is skipped or seeked over. Seeks start at a
+// seek point, or at an estimate from the file size, then sync on the next frame
+// header and drop samples up to the target (frame headers carry their position).
+
+#include "decoder.h"
+#include "pcm_ring.h"
+#include "readahead.h"
+#include "mem.h"
+#include "tanmatsu_plugin.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// Largest block of the streamable subset at up to 48 kHz
+#define FLAC_MAX_BLOCK      4608
+#define FLAC_MAX_CHANNELS   2
+#define FLAC_MAX_ORDER      32
+
+// Seek points kept from the SEEKTABLE (evenly thinned out if it has more)
+#define FLAC_SEEK_POINTS    128
+
+#define METADATA_HEADER     4
+#define STREAMINFO_SIZE     34
+#define SEEK_POINT_SIZE     18
+#define METADATA_STREAMINFO 0
+#define METADATA_SEEKTABLE  3
+
+// Longest frame header: sync, codes, 7-byte number, block size, rate, CRC-8
+#define FRAME_HEADER_MAX    16
+
+// Buffered data wanted for a frame when STREAMINFO does not give the largest
+// frame; frames are decoded in place, so none can be larger than the guard
+#define FLAC_WINDOW         READAHEAD_GUARD_SIZE
+
+// Estimated seeks land this many of the largest frames early, so they rarely
+// land past the target
+#define SEEK_BACKOFF_FRAMES 2
+
+typedef struct {
+    uint64_t sample;
+    uint64_t offset;        // From the first frame
+} seek_point_t;
+
+typedef enum {
+    HEADER_MAGIC,           // "fLaC"
+    HEADER_BLOCK,           // Next metadata block header
+    HEADER_SEEKTABLE,       // Inside the SEEKTABLE
+} header_state_t;
+
+typedef struct {
+    uint32_t block_size;
+    uint32_t rate;
+    int channel_mode;       // 0-7 independent channels, 8 left/side, 9 side/right, 10 mid/side
+    int channels;
+    int bits;
+    uint64_t sample;        // First sample of the frame
+    size_t header_bytes;
+} frame_header_t;
+
+typedef struct {
+    const uint8_t* p;
+    const uint8_t* end;
+    uint64_t cache;         // Next bits, left aligned; bits below them are 0
+    int bits;               // Valid bits in cache
+    uint32_t padded;        // Zero bytes fed in after end
+} bitreader_t;
+
+static uint8_t g_crc8[256];
+static uint16_t g_crc16[256];
+
+// Per-channel samples of the current frame (internal SRAM, allocated on first use)
+static int32_t* g_block[FLAC_MAX_CHANNELS];
+
+// STREAMINFO
+static uint32_t g_min_block = 0;
+static uint32_t g_max_block = 0;
+static uint32_t g_max_frame = 0;
+static uint32_t g_rate = 0;
+static int g_channels = 0;
+static int g_bits = 0;
+static uint64_t g_total_samples = 0;
+static bool g_have_info = false;
+
+// Header walk
+static header_state_t g_header_state = HEADER_MAGIC;
+static bool g_last_block = false;       // The metadata block being read is the last
+static uint32_t g_table_left = 0;       // SEEKTABLE bytes not read yet
+static uint32_t g_table_index = 0;      // Index of the next seek point
+static uint32_t g_table_stride = 1;     // Seek points kept: every stride-th
+
+static seek_point_t g_points[FLAC_SEEK_POINTS];
+static int g_point_count = 0;
+
+// Stream layout
+static uint64_t g_data_start = 0;       // File offset of the first frame
+static uint64_t g_data_bytes = 0;       // Bytes from the first frame to the end of the file, 0 if unknown
+static size_t g_window = FLAC_WINDOW;   // Bytes buffered before a frame is decoded
+
+// Decoded frame still going out
+static uint64_t g_block_sample = 0;     // Stream sample of g_block[][0]
+static uint32_t g_block_frames = 0;
+static uint32_t g_block_pos = 0;
+static uint32_t g_frame_bytes = 0;      // Size of the frame, for the bitrate
+static uint64_t g_seek_target = 0;      // Samples before this are dropped
+static bool g_lost_logged = false;
+
+static uint32_t read_be(const uint8_t* p, int bytes) {
+    uint32_t v = 0;
+    for (int i = 0; i < bytes; i++) v = (v << 8) | p[i];
+    return v;
+}
+
+static uint64_t read_be64(const uint8_t* p) {
+    return ((uint64_t)read_be(p, 4) << 32) | read_be(p + 4, 4);
+}
+
+static void build_crc_tables(void) {
+    for (int i = 0; i < 256; i++) {
+        uint8_t c8 = (uint8_t)i;
+        uint16_t c16 = (uint16_t)(i << 8);
+        for (int b = 0; b < 8; b++) {
+            c8 = (uint8_t)((c8 & 0x80) ? (c8 << 1) ^ 0x07 : c8 << 1);
+            c16 = (uint16_t)((c16 & 0x8000) ? (c16 << 1) ^ 0x8005 : c16 << 1);
+        }
+        g_crc8[i] = c8;
+        g_crc16[i] = c16;
+    }
+}
+
+// Bit reader
+
+static void br_init(bitreader_t* br, const uint8_t* p, const uint8_t* end) {
+    br->p = p;
+    br->end = end;
+    br->cache = 0;
+    br->bits = 0;
+    br->padded = 0;
+}
+
+static inline void br_refill(bitreader_t* br) {
+    while (br->bits <= 56) {
+        if (br->p < br->end) {
+            br->cache |= (uint64_t)*br->p++ << (56 - br->bits);
+        } else {
+            br->padded++;
+        }
+        br->bits += 8;
+    }
+}
+
+// True once bits past the end of the data were read
+static inline bool br_overrun(const bitreader_t* br) {
+    return br->padded * 8 > (uint32_t)br->bits;
+}
+
+// Bits read so far
+static inline size_t br_position(const bitreader_t* br, const uint8_t* start) {
+    return (size_t)(br->p - start + br->padded) * 8 - (size_t)br->bits;
+}
+
+// Read n (0-32) bits
+static inline uint32_t br_bits(bitreader_t* br, int n) {
+    if (n == 0) return 0;
+    if (br->bits < n) br_refill(br);
+    uint32_t v = (uint32_t)(br->cache >> (64 - n));
+    br->cache <<= n;
+    br->bits -= n;
+    return v;
+}
+
+// Read n (1-32) bits as a two's complement number
+static inline int32_t br_signed(bitreader_t* br, int n) {
+    uint32_t v = br_bits(br, n);
+    uint32_t sign = 1u << (n - 1);
+    return (int32_t)((v ^ sign) - sign);
+}
+
+// Count 0 bits up to the next 1 bit, which is read as well
+static inline uint32_t br_unary(bitreader_t* br) {
+    uint32_t zeros = 0;
+    for (;;) {
+        if (br->cache != 0) {
+            int z = __builtin_clzll(br->cache);
+            br->cache <<= z;
+            br->cache <<= 1;
+            br->bits -= z + 1;
+            return zeros + (uint32_t)z;
+        }
+        zeros += (uint32_t)br->bits;
+        br->cache = 0;
+        br->bits = 0;
+        if (br->p >= br->end) {
+            // Only padding left
+            br->padded += 8;
+            return zeros;
+        }
+        br_refill(br);
+    }
+}
+
+// Frame headers
+
+// Parse the frame header at p; returns 1 if it is one of this stream's,
+// 0 if it is not, -1 if len is too short to tell
+static int parse_frame_header(const uint8_t* p, size_t len, frame_header_t* h) {
+    if (len < 5) return -1;
+    if (p[0] != 0xFF || (p[1] & 0xFE) != 0xF8 || (p[3] & 0x01)) return 0;
+
+    bool variable = p[1] & 0x01;
+    int size_code = p[2] >> 4;
+    int rate_code = p[2] & 0x0F;
+    int mode = p[3] >> 4;
+    int bits_code = (p[3] >> 1) & 0x07;
+    if (size_code == 0 || rate_code == 15 || mode > 10 || bits_code == 3 || bits_code == 7) return 0;
+
+    // Frame (fixed blocks) or sample (variable blocks) number, UTF-8 style
+    size_t pos = 4;
+    int extra;
+    if (p[pos] < 0x80) extra = 0;
+    else if ((p[pos] & 0xE0) == 0xC0) extra = 1;
+    else if ((p[pos] & 0xF0) == 0xE0) extra = 2;
+    else if ((p[pos] & 0xF8) == 0xF0) extra = 3;
+    else if ((p[pos] & 0xFC) == 0xF8) extra = 4;
+    else if ((p[pos] & 0xFE) == 0xFC) extra = 5;
+    else if (p[pos] == 0xFE) extra = 6;
+    else return 0;
+    if (len < pos + 1 + extra + 5) return -1;
+    uint64_t number = p[pos] & (extra ? 0x7F >> (extra + 1) : 0x7F);
+    pos++;
+    for (int i = 0; i < extra; i++, pos++) {
+        if ((p[pos] & 0xC0) != 0x80) return 0;
+        number = (number << 6) | (p[pos] & 0x3F);
+    }
+
+    static const uint16_t sizes[16] = { 0, 192, 576, 1152, 2304, 4608, 0, 0,
+                                        256, 512, 1024, 2048, 4096, 8192, 16384, 32768 };
+    if (size_code == 6) {
+        h->block_size = (uint32_t)p[pos++] + 1;
+    } else if (size_code == 7) {
+        h->block_size = read_be(p + pos, 2) + 1;
+        pos += 2;
+    } else {
+        h->block_size = sizes[size_code];
+    }
+
+    static const uint32_t rates[12] = { 0, 88200, 176400, 192000, 8000, 16000,
+                                        22050, 24000, 32000, 44100, 48000, 96000 };
+    if (rate_code == 12) {
+        h->rate = (uint32_t)p[pos++] * 1000;
+    } else if (rate_code == 13) {
+        h->rate = read_be(p + pos, 2);
+        pos += 2;
+    } else if (rate_code == 14) {
+        h->rate = read_be(p + pos, 2) * 10;
+        pos += 2;
+    } else {
+        h->rate = rate_code ? rates[rate_code] : g_rate;
+    }
+
+    static const uint8_t bit_depths[8] = { 0, 8, 12, 0, 16, 20, 24, 0 };
+    h->bits = bits_code ? bit_depths[bits_code] : g_bits;
+    h->channel_mode = mode;
+    h->channels = (mode < 8) ? mode + 1 : 2;
+
+    uint8_t crc = 0;
+    for (size_t i = 0; i < pos; i++) crc = g_crc8[crc ^ p[i]];
+    if (crc != p[pos]) return 0;
+    h->header_bytes = pos + 1;
+
+    // Only frames that fit this stream (a false sync rarely does)
+    if (h->block_size > FLAC_MAX_BLOCK || h->rate != g_rate || h->channels != g_channels || h->bits != g_bits) {
+        return 0;
+    }
+    h->sample = variable ? number : number * g_max_block;
+    return 1;
+}
+
+// Offset of the next frame header after the first byte of data; len (eof) or
+// where a header may start too close to the end to tell, if there is none
+static size_t next_frame(const uint8_t* data, size_t len, bool eof) {
+    frame_header_t h;
+    for (size_t i = 1; i + 1 < len; i++) {
+        if (data[i] != 0xFF || (data[i + 1] & 0xFE) != 0xF8) continue;
+        int found = parse_frame_header(data + i, len - i, &h);
+        if (found == 1) return i;
+        if (found < 0) return eof ? len : i;
+    }
+    return (eof || len == 0) ? len : len - 1;
+}
+
+// Subframes
+
+// Read the residual of a subframe with predictor order order into out[order..]
+static bool read_residual(bitreader_t* br, int32_t* out, uint32_t block_size, uint32_t order) {
+    uint32_t method = br_bits(br, 2);
+    if (method > 1) return false;
+    int param_bits = method ? 5 : 4;
+    uint32_t escape = method ? 31 : 15;
+
+    int partition_order = (int)br_bits(br, 4);
+    uint32_t partition_samples = block_size >> partition_order;
+    if ((partition_samples << partition_order) != block_size || partition_samples < order) return false;
+
+    uint32_t i = order;
+    for (uint32_t part = 0; part < (1u << partition_order); part++) {
+        uint32_t end = (part + 1) * partition_samples;
+        uint32_t param = br_bits(br, param_bits);
+        if (param == escape) {
+            int raw_bits = (int)br_bits(br, 5);
+            for (; i < end; i++) {
+                out[i] = raw_bits ? br_signed(br, raw_bits) : 0;
+            }
+        } else {
+            for (; i < end; i++) {
+                uint32_t u = (br_unary(br) << param) | br_bits(br, (int)param);
+                out[i] = (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+            }
+        }
+        if (br_overrun(br)) return false;
+    }
+    return true;
+}
+
+static void predict_fixed(int32_t* s, uint32_t block_size, uint32_t order) {
+    switch (order) {
+        case 1:
+            for (uint32_t i = 1; i < block_size; i++) s[i] += s[i - 1];
+            break;
+        case 2:
+            for (uint32_t i = 2; i < block_size; i++) s[i] += 2 * s[i - 1] - s[i - 2];
+            break;
+        case 3:
+            for (uint32_t i = 3; i < block_size; i++) s[i] += 3 * (s[i - 1] - s[i - 2]) + s[i - 3];
+            break;
+        case 4:
+            for (uint32_t i = 4; i < block_size; i++) {
+                s[i] += 4 * (s[i - 1] + s[i - 3]) - 6 * s[i - 2] - s[i - 4];
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static void predict_lpc(int32_t* s, uint32_t block_size, const int32_t* coefs, uint32_t order, int shift,
+                        bool wide) {
+    if (!wide) {
+        // Sums fit in 32 bits for 16-bit audio with the usual precision
+        for (uint32_t i = order; i < block_size; i++) {
+            int32_t sum = 0;
+            for (uint32_t j = 0; j < order; j++) sum += coefs[j] * s[i - 1 - j];
+            s[i] += sum >> shift;
+        }
+    } else {
+        for (uint32_t i = order; i < block_size; i++) {
+            int64_t sum = 0;
+            for (uint32_t j = 0; j < order; j++) sum += (int64_t)coefs[j] * s[i - 1 - j];
+            s[i] += (int32_t)(sum >> shift);
+        }
+    }
+}
+
+static int ilog2(uint32_t v) {
+    int log = 0;
+    while (v >>= 1) log++;
+    return log;
+}
+
+static bool read_subframe(bitreader_t* br, int32_t* s, uint32_t block_size, int bits) {
+    uint32_t header = br_bits(br, 8);
+    if (header & 0x80) return false;
+    uint32_t type = (header >> 1) & 0x3F;
+
+    // Wasted bits: low bits that are 0 in every sample
+    int wasted = 0;
+    if (header & 0x01) {
+        wasted = (int)br_unary(br) + 1;
+        if (wasted >= bits) return false;
+        bits -= wasted;
+    }
+
+    if (type == 0) {
+        int32_t v = br_signed(br, bits);
+        for (uint32_t i = 0; i < block_size; i++) s[i] = v;
+    } else if (type == 1) {
+        for (uint32_t i = 0; i < block_size; i++) s[i] = br_signed(br, bits);
+    } else if (type >= 8 && type <= 12) {
+        uint32_t order = type - 8;
+        if (order > block_size) return false;
+        for (uint32_t i = 0; i < order; i++) s[i] = br_signed(br, bits);
+        if (!read_residual(br, s, block_size, order)) return false;
+        predict_fixed(s, block_size, order);
+    } else if (type >= 32) {
+        uint32_t order = type - 31;
+        if (order > block_size) return false;
+        for (uint32_t i = 0; i < order; i++) s[i] = br_signed(br, bits);
+        int precision = (int)br_bits(br, 4) + 1;
+        if (precision == 16) return false;
+        int shift = br_signed(br, 5);
+        if (shift < 0) return false;
+        int32_t coefs[FLAC_MAX_ORDER];
+        for (uint32_t j = 0; j < order; j++) coefs[j] = br_signed(br, precision);
+        if (!read_residual(br, s, block_size, order)) return false;
+        predict_lpc(s, block_size, coefs, order, shift, bits + precision + ilog2(order) > 32);
+    } else {
+        return false;
+    }
+
+    if (br_overrun(br)) return false;
+    if (wasted > 0) {
+        for (uint32_t i = 0; i < block_size; i++) s[i] = (int32_t)((uint32_t)s[i] << wasted);
+    }
+    return true;
+}
+
+// Frames
+
+typedef enum {
+    FRAME_OK,
+    FRAME_LOST,     // Not a frame, or a damaged one
+    FRAME_MORE,     // Not all buffered (or damaged past the buffered data)
+} frame_result_t;
+
+// Decode the frame at data into g_block; *used receives its size
+static frame_result_t decode_frame(const uint8_t* data, size_t len, size_t* used) {
+    frame_header_t h;
+    int found = parse_frame_header(data, len, &h);
+    if (found < 0) return FRAME_MORE;
+    if (found == 0) return FRAME_LOST;
+
+    bitreader_t br;
+    br_init(&br, data + h.header_bytes, data + len);
+    for (int ch = 0; ch < h.channels; ch++) {
+        // The side channel has one more bit
+        bool side = (h.channel_mode == 8 && ch == 1) || (h.channel_mode == 9 && ch == 0) ||
+                    (h.channel_mode == 10 && ch == 1);
+        if (!read_subframe(&br, g_block[ch], h.block_size, h.bits + (side ? 1 : 0))) {
+            return br_overrun(&br) ? FRAME_MORE : FRAME_LOST;
+        }
+    }
+
+    // Zero padding to a byte, then the CRC-16 of the frame
+    size_t bytes = h.header_bytes + (br_position(&br, data + h.header_bytes) + 7) / 8;
+    if (bytes + 2 > len) return FRAME_MORE;
+    uint16_t crc = 0;
+    for (size_t i = 0; i < bytes; i++) crc = (uint16_t)((crc << 8) ^ g_crc16[(crc >> 8) ^ data[i]]);
+    if (crc != read_be(data + bytes, 2)) return FRAME_LOST;
+    *used = bytes + 2;
+
+    // Undo the stereo decorrelation
+    int32_t* a = g_block[0];
+    int32_t* b = g_block[1];
+    if (h.channel_mode == 8) {
+        for (uint32_t i = 0; i < h.block_size; i++) b[i] = a[i] - b[i];
+    } else if (h.channel_mode == 9) {
+        for (uint32_t i = 0; i < h.block_size; i++) a[i] += b[i];
+    } else if (h.channel_mode == 10) {
+        for (uint32_t i = 0; i < h.block_size; i++) {
+            int32_t mid = (int32_t)((uint32_t)a[i] << 1) | (b[i] & 1);
+            int32_t side = b[i];
+            a[i] = (mid + side) >> 1;
+            b[i] = (mid - side) >> 1;
+        }
+    }
+
+    g_block_sample = h.sample;
+    g_block_frames = h.block_size;
+    g_block_pos = 0;
+    g_frame_bytes = (uint32_t)*used;
+    return FRAME_OK;
+}
+
+// Decoder interface
+
+static bool flac_probe(const uint8_t* buf, size_t len) {
+    return len >= 4 && memcmp(buf, "fLaC", 4) == 0;
+}
+
+static int flac_init(void) {
+    build_crc_tables();
+    return 0;
+}
+
+static void flac_cleanup(void) {
+    for (int ch = 0; ch < FLAC_MAX_CHANNELS; ch++) {
+        free(g_block[ch]);
+        g_block[ch] = NULL;
+    }
+}
+
+static void parse_streaminfo(const uint8_t* p) {
+    g_min_block = read_be(p, 2);
+    g_max_block = read_be(p + 2, 2);
+    g_max_frame = read_be(p + 7, 3);
+    g_rate = read_be(p + 10, 3) >> 4;
+    g_channels = ((p[12] >> 1) & 0x07) + 1;
+    g_bits = (int)(((uint32_t)(p[12] & 0x01) << 4 | p[13] >> 4) + 1);
+    g_total_samples = ((uint64_t)(p[13] & 0x0F) << 32) | read_be(p + 14, 4);
+    g_have_info = true;
+}
+
+// Metadata is read; audio starts at in->offset + skip
+static decoder_header_t finish_header(const decoder_input_t* in, decoder_stream_t* stream, uint64_t skip) {
+    g_header_state = HEADER_MAGIC;
+    if (!g_have_info) {
+        asp_log_warn("musicplayer", "FLAC stream without STREAMINFO");
+        return DECODER_HEADER_BAD;
+    }
+    if (g_channels > FLAC_MAX_CHANNELS || g_bits < 8 || g_bits > 24 || g_rate == 0 ||
+        g_max_block > FLAC_MAX_BLOCK || g_min_block > g_max_block) {
+        asp_log_warn("musicplayer", "Unsupported FLAC stream (%d ch, %d-bit, blocks up to %u)",
+                    g_channels, g_bits, (unsigned)g_max_block);
+        return DECODER_HEADER_BAD;
+    }
+
+    for (int ch = 0; ch < FLAC_MAX_CHANNELS; ch++) {
+        if (!g_block[ch]) g_block[ch] = (int32_t*)mem_alloc(FLAC_MAX_BLOCK * sizeof(int32_t), MEM_INTERNAL);
+        if (!g_block[ch]) {
+            asp_log_error("musicplayer", "Failed to allocate FLAC blocks");
+            return DECODER_HEADER_BAD;
+        }
+    }
+
+    g_data_start = in->offset + skip;
+    g_data_bytes = 0;
+    struct stat st;
+    if (stat(in->path, &st) == 0 && (uint64_t)st.st_size > g_data_start) {
+        g_data_bytes = (uint64_t)st.st_size - g_data_start;
+    }
+
+    g_window = FLAC_WINDOW;
+    if (g_max_frame > 0 && g_max_frame + FRAME_HEADER_MAX < FLAC_WINDOW) {
+        g_window = g_max_frame + FRAME_HEADER_MAX;
+    } else if (g_max_frame > FLAC_WINDOW) {
+        asp_log_warn("musicplayer", "FLAC frames up to %u bytes, frames over %u are skipped",
+                    (unsigned)g_max_frame, (unsigned)FLAC_WINDOW);
+    }
+
+    g_block_frames = 0;
+    g_block_pos = 0;
+    g_seek_target = 0;
+    g_lost_logged = false;
+
+    memset(stream, 0, sizeof(*stream));
+    uint32_t slot_frames = PCM_RING_SLOT_SAMPLES / (uint32_t)g_channels;
+    stream->valid = true;
+    stream->sample_rate = g_rate;
+    stream->channels = g_channels;
+    stream->frame_samples = (g_max_block < slot_frames) ? g_max_block : slot_frames;
+    stream->min_bytes = g_window;
+    stream->total_samples = g_total_samples;
+
+    asp_log_info("musicplayer", "FLAC: %d-bit, blocks of %u, %d seek points",
+                g_bits, (unsigned)g_max_block, g_point_count);
+    return DECODER_HEADER_DONE;
+}
+
+// Keep the seek points in buf (whole points only); returns the bytes read
+static size_t read_seek_points(const uint8_t* buf, size_t len) {
+    size_t used = 0;
+    while (g_table_left >= SEEK_POINT_SIZE && used + SEEK_POINT_SIZE <= len) {
+        uint64_t sample = read_be64(buf + used);
+        // Placeholder points are all ones
+        if (sample != UINT64_MAX && g_table_index % g_table_stride == 0 && g_point_count < FLAC_SEEK_POINTS) {
+            g_points[g_point_count].sample = sample;
+            g_points[g_point_count].offset = read_be64(buf + used + 8);
+            g_point_count++;
+        }
+        g_table_index++;
+        g_table_left -= SEEK_POINT_SIZE;
+        used += SEEK_POINT_SIZE;
+    }
+    return used;
+}
+
+// All seek points are read; *skip is the bytes read in this call
+static decoder_header_t end_seek_table(const decoder_input_t* in, decoder_stream_t* stream, uint64_t* skip) {
+    // Bytes after the last whole point
+    *skip += g_table_left;
+    g_header_state = HEADER_BLOCK;
+    if (g_last_block) return finish_header(in, stream, *skip);
+    return DECODER_HEADER_MORE;
+}
+
+static decoder_header_t flac_read_header(const decoder_input_t* in, decoder_stream_t* stream, uint64_t* skip) {
+    const uint8_t* p = in->data;
+    *skip = 0;
+
+    switch (g_header_state) {
+        case HEADER_MAGIC:
+            if (in->len < 4) return DECODER_HEADER_MORE;
+            g_have_info = false;
+            g_point_count = 0;
+            g_header_state = HEADER_BLOCK;
+            *skip = 4;
+            return DECODER_HEADER_MORE;
+
+        case HEADER_BLOCK: {
+            if (in->len < METADATA_HEADER) break;
+            int type = p[0] & 0x7F;
+            uint32_t size = read_be(p + 1, 3);
+            g_last_block = p[0] & 0x80;
+
+            if (type == METADATA_STREAMINFO && !g_have_info) {
+                if (size < STREAMINFO_SIZE) {
+                    g_header_state = HEADER_MAGIC;
+                    return DECODER_HEADER_BAD;
+                }
+                if (in->len < METADATA_HEADER + STREAMINFO_SIZE) break;
+                parse_streaminfo(p + METADATA_HEADER);
+            } else if (type == METADATA_SEEKTABLE && g_point_count == 0) {
+                uint32_t points = size / SEEK_POINT_SIZE;
+                g_table_left = size;
+                g_table_index = 0;
+                g_table_stride = (points + FLAC_SEEK_POINTS - 1) / FLAC_SEEK_POINTS;
+                if (g_table_stride == 0) g_table_stride = 1;
+                g_header_state = HEADER_SEEKTABLE;
+                *skip = METADATA_HEADER + read_seek_points(p + METADATA_HEADER, in->len - METADATA_HEADER);
+                return (g_table_left >= SEEK_POINT_SIZE) ? DECODER_HEADER_MORE : end_seek_table(in, stream, skip);
+            }
+
+            *skip = METADATA_HEADER + (uint64_t)size;
+            if (g_last_block) return finish_header(in, stream, *skip);
+            return DECODER_HEADER_MORE;
+        }
+
+        case HEADER_SEEKTABLE:
+            *skip = read_seek_points(p, in->len);
+            if (g_table_left >= SEEK_POINT_SIZE) {
+                if (*skip > 0) return DECODER_HEADER_MORE;
+                break;
+            }
+            return end_seek_table(in, stream, skip);
+    }
+
+    // Wait for the rest of the metadata block
+    if (in->eof) {
+        g_header_state = HEADER_MAGIC;
+        return DECODER_HEADER_BAD;
+    }
+    return DECODER_HEADER_MORE;
+}
+
+static void flac_decode(const decoder_input_t* in, int16_t* pcm, const gain_ramp_t* gain, decoder_frame_t* out) {
+    memset(out, 0, sizeof(*out));
+
+    if (g_block_pos >= g_block_frames) {
+        size_t used = 0;
+        frame_result_t result = decode_frame(in->data, in->len, &used);
+        // A whole window that does not hold the frame: damaged
+        if (result == FRAME_MORE && (in->eof || in->len >= g_window)) result = FRAME_LOST;
+        if (result == FRAME_MORE) return;
+        if (result == FRAME_LOST) {
+            // After a seek the data starts mid-frame; anywhere else it is damaged
+            if (!g_lost_logged && g_seek_target == 0) {
+                asp_log_warn("musicplayer", "FLAC: lost sync after sample %llu",
+                            (unsigned long long)(g_block_sample + g_block_frames));
+                g_lost_logged = true;
+            }
+            out->consumed = next_frame(in->data, in->len, in->eof);
+            if (out->consumed == 0) out->consumed = 1;
+            out->damaged = (g_seek_target == 0);
+            return;
+        }
+        out->consumed = used;
+    }
+
+    // Samples before a seek target are dropped
+    uint64_t sample = g_block_sample + g_block_pos;
+    if (sample < g_seek_target) {
+        uint64_t drop = g_seek_target - sample;
+        uint32_t left = g_block_frames - g_block_pos;
+        g_block_pos += (drop < left) ? (uint32_t)drop : left;
+        if (g_block_pos >= g_block_frames) return;
+    }
+    g_seek_target = 0;
+
+    uint32_t frames = g_block_frames - g_block_pos;
+    uint32_t slot_frames = PCM_RING_SLOT_SAMPLES / (uint32_t)g_channels;
+    if (frames > slot_frames) frames = slot_frames;
+
+    const int32_t* planes[FLAC_MAX_CHANNELS] = { g_block[0] + g_block_pos, g_block[1] + g_block_pos };
+    gain_convert_planar(pcm, planes, frames, g_channels, g_bits, gain);
+    g_block_pos += frames;
+
+    out->frames = frames;
+    out->rate = g_rate;
+    out->channels = g_channels;
+    out->bitrate_kbps = (uint32_t)((uint64_t)g_frame_bytes * 8 * g_rate / ((uint64_t)g_block_frames * 1000));
+}
+
+static int flac_seek(uint64_t sample, const decoder_point_t* hint, decoder_seek_t* out) {
+    (void)hint;
+    // The last seek point at or before the target
+    int point = -1;
+    for (int i = 0; i < g_point_count && g_points[i].sample <= sample; i++) {
+        point = i;
+    }
+
+    uint64_t offset = 0;
+    if (point >= 0) {
+        offset = g_points[point].offset;
+        out->method = "seek table";
+    }
+    if (g_total_samples > 0 && g_data_bytes > 0 && (point < 0 || sample - g_points[point].sample > g_rate * 2)) {
+        // Between seek points (or without any), estimate from the average bitrate
+        uint64_t estimate = sample * g_data_bytes / g_total_samples;
+        uint64_t backoff = (uint64_t)(g_max_frame ? g_max_frame : FLAC_WINDOW) * SEEK_BACKOFF_FRAMES;
+        estimate = (estimate > backoff) ? estimate - backoff : 0;
+        if (estimate > offset) {
+            offset = estimate;
+            out->method = "estimate";
+        }
+    }
+    if (point < 0 && offset == 0) {
+        out->method = "start";
+    }
+
+    out->offset = g_data_start + offset;
+    out->discard = 0;
+    g_seek_target = sample;
+    g_block_frames = 0;
+    g_block_pos = 0;
+    return 0;
+}
+
+static void flac_close(void) {
+    g_header_state = HEADER_MAGIC;
+    g_block_frames = 0;
+    g_block_pos = 0;
+}
+
+static uint32_t flac_duration_ms(const uint8_t* buf, size_t len, uint64_t stream_bytes) {
+    (void)stream_bytes;
+    // STREAMINFO is always the first metadata block
+    if (len < 4 + METADATA_HEADER + STREAMINFO_SIZE || (buf[4] & 0x7F) != METADATA_STREAMINFO) return 0;
+
+    const uint8_t* p = buf + 4 + METADATA_HEADER;
+    uint32_t rate = read_be(p + 10, 3) >> 4;
+    uint64_t samples = ((uint64_t)(p[13] & 0x0F) << 32) | read_be(p + 14, 4);
+    if (rate == 0) return 0;
+    return (uint32_t)(samples * 1000 / rate);
+}
+
+const decoder_ops_t decoder_flac = {
+    .name = "FLAC",
+    .extension = ".flac",
+    .probe = flac_probe,
+    .init = flac_init,
+    .cleanup = flac_cleanup,
+    .read_header = flac_read_header,
+    .decode = flac_decode,
+    .seek = flac_seek,
+    .restart_point = NULL,
+    .close = flac_close,
+    .duration_ms = flac_duration_ms,
+};
@@ -0,0 +1,353 @@
+// SPDX-License-Identifier: MIT
+// Music Player Plugin - MP3 Decoder
+// minimp3 behind the decoder interface. Stream info comes from the first frame
+// and its Xing/Info/VBRI tag; seeks use the VBR tag's TOC, or a frame index
+// built in the background (seek_index.h), and then walk and prime a few frames.
+
+#include "decoder.h"
+#include "seek_index.h"
+#include "stats.h"
+#include "mem.h"
+#include "tap.h"
+#include "tanmatsu_plugin.h"
+#include <string.h>
+#include <stdlib.h>
+
+// Include minimp3 implementation (decoder options in mp3_decoder.h)
+// MUSICPLAYER_CLIP_METER counts saturated samples where minimp3 clamps them
+// The level tap sums the energy of each granule's subbands before synthesis
+#define MINIMP3_IMPLEMENTATION
+#ifdef MUSICPLAYER_CLIP_METER
+#define MINIMP3_ON_CLIP()   stats_count(STATS_CLIPPED)
+#endif
+#if MUSICPLAYER_LEVEL_TAP
+static void add_subband_energy(const void* grbuf, int nch);
+#define MINIMP3_ON_SUBBANDS(grbuf, nch)  add_subband_energy(grbuf, nch)
+#endif
+#include "mp3_decoder.h"
+#include "pcm_ring.h"
+
+// Buffer sizes
+#define MAX_FRAME_SIZE      (1152 * 2)   // Max samples per MP3 frame (stereo)
+
+_Static_assert(MAX_FRAME_SIZE <= PCM_RING_SLOT_SAMPLES, "PCM ring slot too small for an MP3 frame");
+
+// Contiguous MP3 data to have for a frame (several frames)
+#define MP3_MIN_BYTES       4096
+
+// Frames decoded and thrown away before a seek target: main data reaches up to
+// 511 bytes back into earlier frames, and the first frame lacks MDCT overlap
+#define SEEK_PRIME_FRAMES   2
+
+// Decoder state and scratch (internal SRAM, minimp3's work area is not the stack)
+static mp3dec_t* g_mp3_decoder = NULL;
+static mp3dec_scratch_t* g_mp3_scratch = NULL;
+
+// Current track's stream layout, for seeking
+static mp3_info_t g_info;
+static bool g_info_valid = false;
+static uint64_t g_stream_start = 0;     // File offset of the first frame (VBR tag frame included)
+static uint64_t g_audio_start = 0;      // File offset of the first audio frame
+static uint32_t g_walk_frames = 0;      // Frames to pass over by header only after a seek
+static uint32_t g_prime_frames = 0;     // Frames to decode and discard after a seek
+
+#if MUSICPLAYER_LEVEL_TAP
+// Subbands where each of the level tap's bands starts (32 subbands of 1/64 of
+// the sample rate): finer at the low end, where most of the music is
+static const uint8_t g_band_edges[PCM_RING_BANDS + 1] = { 0, 1, 2, 3, 5, 8, 12, 18, 32 };
+
+// Energy per subband of the frame being decoded; Q24 samples are squared at
+// 1/256 of their scale, which leaves headroom for a frame's sum in 64 bits
+#ifdef MINIMP3_FIXED_POINT
+typedef uint64_t subband_energy_t;
+#define SUBBAND_SHIFT       8
+#else
+typedef float subband_energy_t;
+#endif
+static subband_energy_t g_subband_energy[32];
+static uint16_t g_bands[PCM_RING_BANDS];
+
+static void add_subband_energy(const void* grbuf, int nch) {
+    const mp3d_real* x = (const mp3d_real*)grbuf;
+    for (int ch = 0; ch < nch; ch++) {
+        for (int sb = 0; sb < 32; sb++) {
+            subband_energy_t sum = 0;
+            for (int i = 0; i < 18; i++, x++) {
+#ifdef MINIMP3_FIXED_POINT
+                int32_t v = *x >> SUBBAND_SHIFT;
+                sum += (uint64_t)((int64_t)v * v);
+#else
+                sum += *x * *x;
+#endif
+            }
+            g_subband_energy[sb] += sum;
+        }
+    }
+}
+
+// Shares of the frame's energy per band, in Q16
+static const uint16_t* frame_bands(void) {
+    float energy[PCM_RING_BANDS];
+    float total = 0.0f;
+    for (int b = 0; b < PCM_RING_BANDS; b++) {
+        subband_energy_t sum = 0;
+        for (int sb = g_band_edges[b]; sb < g_band_edges[b + 1]; sb++) sum += g_subband_energy[sb];
+        energy[b] = (float)sum;
+        total += energy[b];
+    }
+    float scale = (total > 0.0f) ? 65535.0f / total : 0.0f;
+    for (int b = 0; b < PCM_RING_BANDS; b++) {
+        g_bands[b] = (uint16_t)(energy[b] * scale + 0.5f);
+    }
+    return g_bands;
+}
+#endif
+
+static void free_decoder(void) {
+    free(g_mp3_scratch);
+    g_mp3_scratch = NULL;
+    free(g_mp3_decoder);
+    g_mp3_decoder = NULL;
+}
+
+static int mp3_init(void) {
+    // Decoder state and scratch are used all through every frame: internal SRAM
+    // (the PCM ring is static in SRAM)
+    g_mp3_decoder = (mp3dec_t*)mem_alloc(sizeof(mp3dec_t), MEM_INTERNAL);
+    g_mp3_scratch = (mp3dec_scratch_t*)mem_alloc(sizeof(mp3dec_scratch_t), MEM_INTERNAL);
+    if (!g_mp3_decoder || !g_mp3_scratch) {
+        asp_log_error("musicplayer", "Failed to allocate mp3 decoder (%d + %d bytes)",
+                     (int)sizeof(mp3dec_t), (int)sizeof(mp3dec_scratch_t));
+        free_decoder();
+        return -1;
+    }
+
+    // Frame index for seeking in files without a VBR TOC, and its scan thread
+    if (seek_index_init() != 0) {
+        free_decoder();
+        return -1;
+    }
+
+    mp3dec_init(g_mp3_decoder);
+    return 0;
+}
+
+static void mp3_cleanup(void) {
+    seek_index_cleanup();
+    free_decoder();
+}
+
+static bool mp3_probe(const uint8_t* buf, size_t len) {
+    (void)buf;
+    (void)len;
+    return true;
+}
+
+static decoder_header_t mp3_read_header(const decoder_input_t* in, decoder_stream_t* stream, uint64_t* skip) {
+    mp3dec_init(g_mp3_decoder);
+    g_walk_frames = 0;
+    g_prime_frames = 0;
+    memset(stream, 0, sizeof(*stream));
+    *skip = 0;
+
+    mp3_info_t info;
+    g_info_valid = mp3_info_parse(in->data, in->len, &info) == 0;
+    if (!g_info_valid) {
+        // No recognizable header - minimp3 resyncs on its own
+        stream->min_bytes = MP3_MIN_BYTES;
+        return DECODER_HEADER_DONE;
+    }
+
+    g_info = info;
+    g_stream_start = in->offset + info.frame_offset;
+    g_audio_start = g_stream_start + info.tag_frame_bytes;
+
+    // The TOC only has 1/256-of-file resolution, so index the frames as well
+    seek_index_start(in->path, g_audio_start);
+
+    // The Xing/Info/VBRI frame holds no audio
+    if (info.tag_frame_bytes > 0) {
+        *skip = info.frame_offset + info.tag_frame_bytes;
+    }
+
+    stream->valid = true;
+    stream->sample_rate = info.sample_rate;
+    stream->channels = info.channels;
+    stream->frame_samples = info.samples_per_frame;
+    stream->min_bytes = MP3_MIN_BYTES;
+    stream->trim_start = info.trim_start;
+    stream->total_samples = info.total_samples;
+    stream->replaygain = info.replaygain;
+
+    if (info.trim_start > 0 || info.total_samples > 0) {
+        asp_log_info("musicplayer", "Gapless info: trim %u/%u samples, length %u samples",
+                    (unsigned)info.trim_start, (unsigned)info.trim_end, (unsigned)info.total_samples);
+    }
+    return DECODER_HEADER_DONE;
+}
+
+static void mp3_decode(const decoder_input_t* in, int16_t* pcm, const gain_ramp_t* gain, decoder_frame_t* out) {
+    mp3dec_frame_info_t info;
+    memset(out, 0, sizeof(*out));
+
+    // After a seek: pass over frames by their headers only (no PCM output)
+    // info.hz stays 0 when minimp3 only skipped junk
+    if (g_walk_frames > 0) {
+        info.hz = 0;
+        mp3dec_decode_frame_scratch(g_mp3_decoder, in->data, (int)in->len, NULL, &info, g_mp3_scratch, NULL);
+        out->consumed = (size_t)info.frame_bytes;
+        if (info.frame_bytes > 0 && info.hz > 0) g_walk_frames--;
+        return;
+    }
+
+    // minimp3 synthesizes the frame straight into the ring slot with the gain applied
+    info.hz = 0;
+#if MUSICPLAYER_LEVEL_TAP
+    memset(g_subband_energy, 0, sizeof(g_subband_energy));
+#endif
+    mp3dec_gain_t mp3_gain = { gain->start, gain->end };
+    int samples = mp3dec_decode_frame_scratch(g_mp3_decoder, in->data, (int)in->len, pcm, &info,
+                                              g_mp3_scratch, &mp3_gain);
+    out->consumed = (size_t)info.frame_bytes;
+
+    // Frames that only refill the bit reservoir after a seek are not played
+    if (g_prime_frames > 0 && info.frame_bytes > 0) {
+        if (info.hz > 0) g_prime_frames--;
+        return;
+    }
+
+    // Junk skipped or a frame that did not decode; the part of the file read
+    // ahead to its end is not counted, as trailing tags (ID3v1, APE) are junk too
+    out->damaged = samples == 0 && info.frame_bytes > 0 && !in->eof;
+
+    if (samples > 0) {
+        out->frames = (uint32_t)samples;
+        out->rate = (uint32_t)info.hz;
+        out->channels = info.channels;
+        out->bitrate_kbps = (uint32_t)info.bitrate_kbps;
+#if MUSICPLAYER_LEVEL_TAP
+        out->bands = frame_bands();
+#endif
+    }
+}
+
+// File offset of frame from the Xing/VBRI TOC (linear between percent entries)
+static uint64_t toc_offset(uint32_t frame) {
+    const mp3_info_t* info = &g_info;
+    uint64_t scaled = (uint64_t)frame * MP3_TOC_ENTRIES;
+    uint32_t i = (uint32_t)(scaled / info->total_frames);
+    uint64_t rem = scaled % info->total_frames;
+    if (i >= MP3_TOC_ENTRIES) {
+        return g_stream_start + info->total_bytes;
+    }
+    uint32_t a = info->toc[i];
+    uint32_t b = (i + 1 < MP3_TOC_ENTRIES) ? info->toc[i + 1] : 256;
+    if (b < a) b = a;
+    uint64_t pos256 = (uint64_t)a * info->total_frames + (uint64_t)(b - a) * rem;
+    return g_stream_start + pos256 * info->total_bytes / (256ULL * info->total_frames);
+}
+
+// First frame to decode for sample (counted past the start trim), and the
+// frames before it to prime the bit reservoir with
+static uint32_t start_frame(uint64_t sample, uint32_t* prime) {
+    uint64_t raw = sample + g_info.trim_start;
+    uint32_t frame = (uint32_t)(raw / g_info.samples_per_frame);
+    *prime = (frame < SEEK_PRIME_FRAMES) ? frame : SEEK_PRIME_FRAMES;
+    return frame - *prime;
+}
+
+static int mp3_seek(uint64_t sample, const decoder_point_t* hint, decoder_seek_t* out) {
+    if (!g_info_valid) return -1;
+
+    const mp3_info_t* info = &g_info;
+    uint32_t spf = info->samples_per_frame;
+
+    // Stream sample (encoder delay included) -> frame, decode from a few frames earlier
+    uint64_t raw = sample + info->trim_start;
+    uint32_t frame = (uint32_t)(raw / spf);
+    uint32_t prime;
+    uint32_t start = start_frame(sample, &prime);
+
+    // The index, or the hint where the index has not got to yet (or is sparser)
+    uint32_t walk = 0;
+    uint32_t indexed_frame;
+    uint64_t indexed_offset;
+    bool indexed = seek_index_lookup(start, &indexed_frame, &indexed_offset);
+    out->method = "index";
+    if (hint && hint->sample % spf == 0 && hint->sample / spf <= start &&
+        (!indexed || hint->sample / spf > indexed_frame)) {
+        indexed_frame = (uint32_t)(hint->sample / spf);
+        indexed_offset = hint->offset;
+        indexed = true;
+        out->method = "checkpoint";
+    }
+
+    if (indexed) {
+        out->offset = indexed_offset;
+        walk = start - indexed_frame;
+    } else if (info->has_toc) {
+        out->offset = toc_offset(start);
+        out->method = "TOC";
+    } else {
+        // Index not there yet - assume a constant bitrate
+        out->offset = g_audio_start + (uint64_t)start * spf * info->bitrate_kbps * 125 / info->sample_rate;
+        out->method = "bitrate";
+    }
+    out->discard = (uint32_t)(raw - (uint64_t)frame * spf);
+
+    // Restart the decoder at the new position
+    mp3dec_init(g_mp3_decoder);
+    g_walk_frames = walk;
+    g_prime_frames = prime;
+    return 0;
+}
+
+static bool mp3_restart_point(uint64_t sample, decoder_point_t* out) {
+    if (!g_info_valid) return false;
+
+    uint32_t prime;
+    uint32_t frame;
+    uint64_t offset;
+    if (!seek_index_lookup(start_frame(sample, &prime), &frame, &offset)) return false;
+    out->sample = (uint64_t)frame * g_info.samples_per_frame;
+    out->offset = offset;
+    return true;
+}
+
+static void mp3_close(void) {
+    seek_index_clear();
+    g_info_valid = false;
+}
+
+static uint32_t mp3_duration_ms(const uint8_t* buf, size_t len, uint64_t stream_bytes) {
+    mp3_info_t info;
+    if (len == 0 || mp3_info_parse(buf, len, &info) != 0) return 0;
+
+    uint64_t samples = info.total_samples;
+    if (samples == 0) {
+        samples = (uint64_t)info.total_frames * info.samples_per_frame;
+    }
+
+    if (samples > 0) {
+        return (uint32_t)(samples * 1000 / info.sample_rate);
+    }
+    if (info.bitrate_kbps > 0 && stream_bytes > info.frame_offset) {
+        // No VBR tag - assume a constant bitrate over the rest of the file
+        return (uint32_t)((stream_bytes - info.frame_offset) * 8 / info.bitrate_kbps);
+    }
+    return 0;
+}
+
+const decoder_ops_t decoder_mp3 = {
+    .name = "MP3",
+    .extension = ".mp3",
+    .probe = mp3_probe,
+    .init = mp3_init,
+    .cleanup = mp3_cleanup,
+    .read_header = mp3_read_header,
+    .decode = mp3_decode,
+    .seek = mp3_seek,
+    .restart_point = mp3_restart_point,
+    .close = mp3_close,
+    .duration_ms = mp3_duration_ms,
+};
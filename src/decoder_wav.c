@@ -0,0 +1,193 @@
+// SPDX-License-Identifier: MIT
+// Music Player Plugin - WAV Decoder
+// 16 and 24-bit PCM in a RIFF/WAVE file. There is nothing to decode: samples
+// are copied from the read-ahead into the ring slot in the same pass that
+// applies the output gain. Chunks other than "fmt " and "data" (LIST, id3 and
+// the like) are skipped, seeks are exact.
+
+#include "decoder.h"
+#include "pcm_ring.h"
+#include "tanmatsu_plugin.h"
+#include <string.h>
+
+#define RIFF_HEADER_SIZE    12
+#define CHUNK_HEADER_SIZE   8
+
+// Smallest usable "fmt " chunk (WAVEFORMAT plus wBitsPerSample), and a bound
+// on the size of one that is read whole (WAVEFORMATEXTENSIBLE is 40 bytes)
+#define FMT_MIN_SIZE        16
+#define FMT_MAX_SIZE        256
+
+#define WAVE_FORMAT_PCM         0x0001
+#define WAVE_FORMAT_EXTENSIBLE  0xFFFE
+
+// Samples read per step when the read-ahead holds plenty
+#define WAV_MIN_BYTES       4096
+
+typedef struct {
+    int channels;
+    uint32_t sample_rate;
+    int bytes_per_sample;
+    uint32_t block_align;   // Bytes per sample frame
+} wav_format_t;
+
+// Current track
+static bool g_in_riff = false;          // RIFF header read, walking the chunks
+static bool g_have_format = false;
+static wav_format_t g_format;
+static uint64_t g_data_start = 0;       // File offset of the first sample
+
+static uint32_t read_le(const uint8_t* p, int bytes) {
+    uint32_t v = 0;
+    for (int i = bytes - 1; i >= 0; i--) v = (v << 8) | p[i];
+    return v;
+}
+
+// Parse a "fmt " chunk body; returns false if it is not a supported format
+static bool parse_format(const uint8_t* p, uint32_t size, wav_format_t* format) {
+    if (size < FMT_MIN_SIZE) return false;
+
+    uint32_t tag = read_le(p, 2);
+    if (tag == WAVE_FORMAT_EXTENSIBLE && size >= 40) {
+        // Sub-format GUID starts with the format tag
+        tag = read_le(p + 24, 2);
+    }
+    format->channels = (int)read_le(p + 2, 2);
+    format->sample_rate = read_le(p + 4, 4);
+    format->block_align = read_le(p + 12, 2);
+    uint32_t bits = read_le(p + 14, 2);
+    format->bytes_per_sample = (int)((bits + 7) / 8);
+
+    return tag == WAVE_FORMAT_PCM && (bits == 16 || bits == 24) &&
+           format->channels >= 1 && format->channels <= 2 && format->sample_rate > 0 &&
+           format->block_align == (uint32_t)(format->channels * format->bytes_per_sample);
+}
+
+static bool wav_probe(const uint8_t* buf, size_t len) {
+    return len >= RIFF_HEADER_SIZE && memcmp(buf, "RIFF", 4) == 0 && memcmp(buf + 8, "WAVE", 4) == 0;
+}
+
+static int wav_init(void) {
+    return 0;
+}
+
+static void wav_cleanup(void) {
+}
+
+static decoder_header_t wav_read_header(const decoder_input_t* in, decoder_stream_t* stream, uint64_t* skip) {
+    *skip = 0;
+    if (!g_in_riff) {
+        g_have_format = false;
+        if (in->len < RIFF_HEADER_SIZE) return DECODER_HEADER_MORE;
+        g_in_riff = true;
+        *skip = RIFF_HEADER_SIZE;
+        return DECODER_HEADER_MORE;
+    }
+
+    if (in->len < CHUNK_HEADER_SIZE) return in->eof ? DECODER_HEADER_BAD : DECODER_HEADER_MORE;
+    const uint8_t* chunk = in->data;
+    uint32_t size = read_le(chunk + 4, 4);
+
+    if (memcmp(chunk, "data", 4) == 0) {
+        g_in_riff = false;
+        if (!g_have_format) {
+            asp_log_warn("musicplayer", "WAV data before its format");
+            return DECODER_HEADER_BAD;
+        }
+
+        memset(stream, 0, sizeof(*stream));
+        g_data_start = in->offset + CHUNK_HEADER_SIZE;
+        stream->valid = true;
+        stream->sample_rate = g_format.sample_rate;
+        stream->channels = g_format.channels;
+        stream->frame_samples = PCM_RING_SLOT_SAMPLES / (uint32_t)g_format.channels;
+        stream->min_bytes = WAV_MIN_BYTES;
+        // Streamed files leave the size 0 or at its largest: play to the end
+        if (size != 0 && size != UINT32_MAX) {
+            stream->total_samples = size / g_format.block_align;
+        }
+        *skip = CHUNK_HEADER_SIZE;
+        return DECODER_HEADER_DONE;
+    }
+
+    if (memcmp(chunk, "fmt ", 4) == 0) {
+        // Small, so it is always buffered unless the file ends
+        if (size <= FMT_MAX_SIZE && in->len < CHUNK_HEADER_SIZE + size) {
+            return in->eof ? DECODER_HEADER_BAD : DECODER_HEADER_MORE;
+        }
+        if (size > FMT_MAX_SIZE || !parse_format(chunk + CHUNK_HEADER_SIZE, size, &g_format)) {
+            g_in_riff = false;
+            asp_log_warn("musicplayer", "Unsupported WAV format (16/24-bit PCM, 1-2 channels play)");
+            return DECODER_HEADER_BAD;
+        }
+        g_have_format = true;
+    }
+
+    // Chunks are padded to an even size
+    *skip = CHUNK_HEADER_SIZE + (uint64_t)size + (size & 1);
+    return DECODER_HEADER_MORE;
+}
+
+static void wav_decode(const decoder_input_t* in, int16_t* pcm, const gain_ramp_t* gain, decoder_frame_t* out) {
+    memset(out, 0, sizeof(*out));
+
+    uint32_t frames = (uint32_t)(in->len / g_format.block_align);
+    uint32_t slot_frames = PCM_RING_SLOT_SAMPLES / (uint32_t)g_format.channels;
+    if (frames > slot_frames) frames = slot_frames;
+    if (frames == 0) return;
+
+    gain_convert_le(pcm, in->data, frames, g_format.channels, g_format.bytes_per_sample, gain);
+    out->consumed = frames * g_format.block_align;
+    out->frames = frames;
+    out->rate = g_format.sample_rate;
+    out->channels = g_format.channels;
+    out->bitrate_kbps = g_format.sample_rate * g_format.block_align * 8 / 1000;
+}
+
+static int wav_seek(uint64_t sample, const decoder_point_t* hint, decoder_seek_t* out) {
+    (void)hint;
+    out->offset = g_data_start + sample * g_format.block_align;
+    out->discard = 0;
+    out->method = "PCM";
+    return 0;
+}
+
+static void wav_close(void) {
+    g_in_riff = false;
+}
+
+static uint32_t wav_duration_ms(const uint8_t* buf, size_t len, uint64_t stream_bytes) {
+    (void)stream_bytes;
+    wav_format_t format;
+    bool have_format = false;
+
+    // Walk the chunks that are in buf
+    uint64_t pos = RIFF_HEADER_SIZE;
+    while (pos + CHUNK_HEADER_SIZE <= len) {
+        const uint8_t* chunk = buf + pos;
+        uint32_t size = read_le(chunk + 4, 4);
+        if (memcmp(chunk, "fmt ", 4) == 0) {
+            if (pos + CHUNK_HEADER_SIZE + size > len) break;
+            have_format = parse_format(chunk + CHUNK_HEADER_SIZE, size, &format);
+        } else if (memcmp(chunk, "data", 4) == 0) {
+            if (!have_format || size == 0 || size == UINT32_MAX) break;
+            return (uint32_t)((uint64_t)(size / format.block_align) * 1000 / format.sample_rate);
+        }
+        pos += CHUNK_HEADER_SIZE + (uint64_t)size + (size & 1);
+    }
+    return 0;
+}
+
+const decoder_ops_t decoder_wav = {
+    .name = "WAV",
+    .extension = ".wav",
+    .probe = wav_probe,
+    .init = wav_init,
+    .cleanup = wav_cleanup,
+    .read_header = wav_read_header,
+    .decode = wav_decode,
+    .seek = wav_seek,
+    .restart_point = NULL,
+    .close = wav_close,
+    .duration_ms = wav_duration_ms,
+};
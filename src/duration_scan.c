@@ -0,0 +1,128 @@
+// SPDX-License-Identifier: MIT
+// Music Player Plugin - Duration Scanner
+// Reads one small block per file (two if an ID3v2 tag has to be skipped)
+
+#include "duration_scan.h"
+#include "mp3_info.h"
+#include "decoder.h"
+#include "playlist.h"
+#include "../include/music_player.h"
+#include "tanmatsu_plugin.h"
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+// Lowest priority of the plugin's threads: playback and seek indexing go first
+// The stack is the library walker's: playlist_cache_stale() walks the folders
+// recursively (a path buffer per level) on this thread
+#define SCAN_STACK_SIZE     (8 * 1024)
+#define SCAN_PRIORITY       2
+
+// Bytes read at the start of the audio data (covers any Xing/VBRI frame)
+#define SCAN_BYTES          2048
+
+// Let playback fill its buffers before the first file, and pause between files
+#define SCAN_START_DELAY_MS 2000
+#define SCAN_PAUSE_MS       20
+
+// Poll interval while waiting for the library scan to add songs
+#define SCAN_WAIT_MS        200
+
+static uint8_t g_buf[SCAN_BYTES];
+
+static pthread_t g_thread;
+static bool g_running = false;
+static volatile bool g_should_stop = false;
+
+// Duration of an audio file in ms, 0 if it cannot be determined
+static uint32_t scan_file(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (!file) return 0;
+
+    uint32_t duration_ms = 0;
+    long file_size = (fseek(file, 0, SEEK_END) == 0) ? ftell(file) : -1;
+    fseek(file, 0, SEEK_SET);
+
+    // Skip an ID3v2 tag (it can hold cover art of any size)
+    size_t got = fread(g_buf, 1, SCAN_BYTES, file);
+    size_t start = mp3_info_id3v2_size(g_buf, got);
+    if (start > 0) {
+        got = (fseek(file, (long)start, SEEK_SET) == 0) ? fread(g_buf, 1, SCAN_BYTES, file) : 0;
+    }
+
+    if (got > 0) {
+        uint64_t stream_bytes = (file_size > (long)start) ? (uint64_t)(file_size - (long)start) : 0;
+        duration_ms = decoder_find(g_buf, got)->duration_ms(g_buf, got, stream_bytes);
+    }
+
+    fclose(file);
+    return duration_ms;
+}
+
+static void* scan_thread_func(void* arg) {
+    (void)arg;
+    music_player_state_t* state = music_player_get_state();
+    char path[256];
+
+    for (int i = 0; i < SCAN_START_DELAY_MS / SCAN_PAUSE_MS && !g_should_stop; i++) {
+        asp_plugin_delay_ms(SCAN_PAUSE_MS);
+    }
+
+    int scanned = 0;
+    for (int i = 0; !g_should_stop; i++) {
+        // Catch up with the library scan, which may still be adding songs
+        while (i >= state->playlist.count && !playlist_scan_done() && !g_should_stop) {
+            asp_plugin_delay_ms(SCAN_WAIT_MS);
+        }
+        const char* filename = playlist_get_filename(i);
+        if (!filename) break;
+        if (playlist_get_duration_ms(i) != 0) continue;
+
+        snprintf(path, sizeof(path), "%s/%s", MUSIC_DIR, filename);
+        playlist_set_duration_ms(i, scan_file(path));
+        scanned++;
+
+        asp_plugin_delay_ms(SCAN_PAUSE_MS);
+    }
+
+    if (g_should_stop) return NULL;
+    asp_log_info("musicplayer", "Duration scan finished (%d files)", scanned);
+
+    // Persist new durations; a stale index is dropped so the next start rescans
+    if (!playlist_cache_stale(&g_should_stop) && scanned > 0 && !g_should_stop) {
+        playlist_save_cache();
+    }
+    return NULL;
+}
+
+int duration_scan_start(void) {
+    if (g_running) return 0;
+
+    g_should_stop = false;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, SCAN_STACK_SIZE);
+    struct sched_param param = { .sched_priority = SCAN_PRIORITY };
+    pthread_attr_setschedparam(&attr, &param);
+    int err = pthread_create(&g_thread, &attr, scan_thread_func, NULL);
+    pthread_attr_destroy(&attr);
+
+    if (err != 0) {
+        asp_log_warn("musicplayer", "Failed to create duration scan thread: %d", err);
+        return -1;
+    }
+
+    g_running = true;
+    return 0;
+}
+
+void duration_scan_stop(void) {
+    if (!g_running) return;
+
+    g_should_stop = true;
+    pthread_join(g_thread, NULL);
+    g_running = false;
+}
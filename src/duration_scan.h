@@ -0,0 +1,14 @@
+// SPDX-License-Identifier: MIT
+// Music Player Plugin - Duration Scanner
+// Fills song_info_t::duration_ms for the playlist from the first few KB of each
+// file (VBR tag frame count, or bitrate and file size), in a low-priority thread,
+// and saves them to the library index when done.
+
+#pragma once
+
+// Start scanning the playlist in the background
+// Returns 0 on success, -1 if the thread could not be created
+int duration_scan_start(void);
+
+// Stop the scanner and wait for it to exit
+void duration_scan_stop(void);
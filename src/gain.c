@@ -0,0 +1,114 @@
+// SPDX-License-Identifier: MIT
+// Music Player Plugin - Output Gain
+
+#include "gain.h"
+#include "stats.h"
+
+// Fixed-point gain of the integer conversions
+#define GAIN_Q_BITS     16
+#define GAIN_Q_MAX      (16 << GAIN_Q_BITS)
+
+float gain_from_db(float db) {
+    if (db > 60.0f) db = 60.0f;
+    if (db < -60.0f) db = -60.0f;
+
+    // 10^(db/20) = 2^x: whole powers of two times a polynomial for 2^frac
+    float x = db * 0.16609640f;
+    int whole = (int)x;
+    if ((float)whole > x) whole--;
+    float frac = x - (float)whole;
+    float gain = 1.0f + frac * (0.69314718f + frac * (0.24022651f + frac * (0.05550411f +
+                 frac * (0.00961813f + frac * 0.00133336f))));
+
+    for (; whole > 0; whole--) gain *= 2.0f;
+    for (; whole < 0; whole++) gain *= 0.5f;
+    return gain;
+}
+
+float gain_from_volume(uint8_t volume) {
+    if (volume >= 100) return 1.0f;
+    float v = (float)volume / 100.0f;
+    return v * v * v;
+}
+
+float gain_approach(float current, float target, float max_step) {
+    if (target > current + max_step) return current + max_step;
+    if (target < current - max_step) return current - max_step;
+    return target;
+}
+
+void gain_ramp_pcm(int16_t* pcm, uint32_t frames, int channels, float from, float to) {
+    if (frames == 0) return;
+
+    float step = (to - from) / (float)frames;
+    float gain = from;
+    for (uint32_t i = 0; i < frames; i++, gain += step) {
+        for (int ch = 0; ch < channels; ch++, pcm++) {
+            // |gain| <= 1, so the product stays in range
+            *pcm = (int16_t)((float)*pcm * gain);
+        }
+    }
+}
+
+// Gain in fixed point, clamped so the products stay in an int64
+static int32_t gain_q(float gain) {
+    if (gain <= 0.0f) return 0;
+    if (gain >= (float)GAIN_Q_MAX / (1 << GAIN_Q_BITS)) return GAIN_Q_MAX;
+    return (int32_t)(gain * (float)(1 << GAIN_Q_BITS));
+}
+
+// MUSICPLAYER_CLIP_METER counts the clamped samples, as minimp3 does for MP3
+#ifdef MUSICPLAYER_CLIP_METER
+#define COUNT_CLIP()    stats_count(STATS_CLIPPED)
+#else
+#define COUNT_CLIP()    ((void)0)
+#endif
+
+// Decoder thread only (the clip counter's writer)
+static int16_t saturate(int64_t v) {
+    if (v > INT16_MAX) { COUNT_CLIP(); return INT16_MAX; }
+    if (v < INT16_MIN) { COUNT_CLIP(); return INT16_MIN; }
+    return (int16_t)v;
+}
+
+void gain_convert_le(int16_t* out, const uint8_t* in, uint32_t frames, int channels, int bytes_per_sample,
+                     const gain_ramp_t* gain) {
+    if (frames == 0) return;
+
+    // 24-bit samples are read into the top of an int32 and scaled down with the gain
+    int shift = GAIN_Q_BITS + ((bytes_per_sample == 3) ? 16 : 0);
+    int32_t g = gain_q(gain->start);
+    int32_t step = (gain_q(gain->end) - g) / (int32_t)frames;
+    for (uint32_t i = 0; i < frames; i++, g += step) {
+        for (int ch = 0; ch < channels; ch++) {
+            int32_t s;
+            if (bytes_per_sample == 2) {
+                s = (int16_t)(in[0] | in[1] << 8);
+            } else {
+                s = (int32_t)((uint32_t)in[0] << 8 | (uint32_t)in[1] << 16 | (uint32_t)in[2] << 24);
+            }
+            in += bytes_per_sample;
+            *out++ = saturate(((int64_t)s * g) >> shift);
+        }
+    }
+}
+
+void gain_convert_planar(int16_t* out, const int32_t* const* in, uint32_t frames, int channels, int bits,
+                         const gain_ramp_t* gain) {
+    if (frames == 0) return;
+
+    // Fewer than 16 bits are scaled up through the gain
+    int32_t g = gain_q(gain->start);
+    int32_t step = (gain_q(gain->end) - g) / (int32_t)frames;
+    int shift = GAIN_Q_BITS + bits - 16;
+    if (shift < GAIN_Q_BITS) {
+        g <<= GAIN_Q_BITS - shift;
+        step <<= GAIN_Q_BITS - shift;
+        shift = GAIN_Q_BITS;
+    }
+    for (uint32_t i = 0; i < frames; i++, g += step) {
+        for (int ch = 0; ch < channels; ch++) {
+            *out++ = saturate(((int64_t)in[ch][i] * g) >> shift);
+        }
+    }
+}
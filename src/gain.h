@@ -0,0 +1,37 @@
+// SPDX-License-Identifier: MIT
+// Music Player Plugin - Output Gain
+// Gain math for the output stage that the decoders run inside their PCM
+// conversion (headroom, software volume and ramps between them), and for the
+// one-frame fades the output thread puts on pause, resume, stop and skip.
+
+#pragma once
+
+#include <stdint.h>
+
+// Output gain ramped linearly from start at a frame's first sample to end
+// after its last (1.0 is unity)
+typedef struct {
+    float start, end;
+} gain_ramp_t;
+
+// Linear gain of a level in dB (-60 to +60)
+float gain_from_db(float db);
+
+// Linear gain of a volume setting 0-100 (cubic: -18 dB at 50%, -60 dB at 10%)
+float gain_from_volume(uint8_t volume);
+
+// current moved toward target by at most max_step
+float gain_approach(float current, float target, float max_step);
+
+// Scale interleaved PCM in place by a gain ramped linearly from from to to
+void gain_ramp_pcm(int16_t* pcm, uint32_t frames, int channels, float from, float to);
+
+// Convert interleaved little-endian PCM of bytes_per_sample (2 or 3) bytes per
+// sample to 16-bit PCM with the gain applied, saturating
+void gain_convert_le(int16_t* out, const uint8_t* in, uint32_t frames, int channels, int bytes_per_sample,
+                     const gain_ramp_t* gain);
+
+// Convert planar samples of bits (8-24) bits to interleaved 16-bit PCM with the
+// gain applied, saturating
+void gain_convert_planar(int16_t* out, const int32_t* const* in, uint32_t frames, int channels, int bits,
+                         const gain_ramp_t* gain);
@@ -0,0 +1,247 @@
+// SPDX-License-Identifier: MIT
+// Music Player Plugin - ID3 Tags
+
+#include "id3.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+// Largest wanted frame that is parsed; bigger ones are skipped like cover art
+#define ID3_FRAME_MAX   1024
+
+// ID3v1 tag: "TAG", then fixed-size fields
+#define ID3V1_SIZE      128
+
+typedef enum {
+    FIELD_NONE,
+    FIELD_TITLE,
+    FIELD_ARTIST,
+    FIELD_ALBUM,
+    FIELD_TRACK,
+    FIELD_USER,     // TXXX: ReplayGain
+} field_t;
+
+typedef struct {
+    char id[5];     // ID3v2.3/2.4 frame
+    char id22[4];   // ID3v2.2 frame
+    field_t field;
+} frame_type_t;
+
+static const frame_type_t g_frame_types[] = {
+    { "TIT2", "TT2", FIELD_TITLE },
+    { "TPE1", "TP1", FIELD_ARTIST },
+    { "TALB", "TAL", FIELD_ALBUM },
+    { "TRCK", "TRK", FIELD_TRACK },
+    { "TXXX", "TXX", FIELD_USER },
+};
+
+static uint32_t read_be(const uint8_t* p, int bytes) {
+    uint32_t v = 0;
+    for (int i = 0; i < bytes; i++) v = (v << 8) | p[i];
+    return v;
+}
+
+static uint32_t read_syncsafe(const uint8_t* p) {
+    return ((uint32_t)p[0] << 21) | ((uint32_t)p[1] << 14) | ((uint32_t)p[2] << 7) | p[3];
+}
+
+// Copy an ID3v2 string of the given text encoding as ASCII (other characters
+// become '?'); returns the bytes used, terminator included
+static size_t read_text(const uint8_t* p, size_t len, uint8_t encoding, char* out, size_t out_size) {
+    bool wide = (encoding == 1 || encoding == 2);
+    bool big_endian = (encoding == 2);
+    size_t pos = 0;
+    size_t n = 0;
+
+    if (encoding == 1 && len >= 2) {
+        // Byte order mark
+        big_endian = (p[0] == 0xFE && p[1] == 0xFF);
+        if ((p[0] == 0xFE && p[1] == 0xFF) || (p[0] == 0xFF && p[1] == 0xFE)) pos = 2;
+    }
+
+    while (pos + (wide ? 2 : 1) <= len) {
+        uint32_t c = wide ? (big_endian ? read_be(p + pos, 2) : ((uint32_t)p[pos + 1] << 8 | p[pos])) : p[pos];
+        pos += wide ? 2 : 1;
+        if (c == 0) break;
+        // UTF-8 sequences become one '?'
+        if (encoding == 3 && (c & 0xC0) == 0x80) continue;
+        if (n + 1 < out_size) out[n++] = (c < 0x80) ? (char)c : '?';
+    }
+    out[n] = '\0';
+    return pos;
+}
+
+static field_t frame_field(const uint8_t* frame, uint8_t version) {
+    for (size_t i = 0; i < sizeof(g_frame_types) / sizeof(g_frame_types[0]); i++) {
+        const frame_type_t* type = &g_frame_types[i];
+        if (version == 2 ? memcmp(frame, type->id22, 3) == 0 : memcmp(frame, type->id, 4) == 0) {
+            return type->field;
+        }
+    }
+    return FIELD_NONE;
+}
+
+static void parse_frame(field_t field, const uint8_t* body, size_t len, id3_tags_t* tags) {
+    if (len < 2) return;
+    uint8_t encoding = body[0];
+    const uint8_t* text = body + 1;
+    size_t text_len = len - 1;
+
+    switch (field) {
+        case FIELD_TITLE:
+            read_text(text, text_len, encoding, tags->title, sizeof(tags->title));
+            break;
+
+        case FIELD_ARTIST:
+            read_text(text, text_len, encoding, tags->artist, sizeof(tags->artist));
+            break;
+
+        case FIELD_ALBUM:
+            read_text(text, text_len, encoding, tags->album, sizeof(tags->album));
+            break;
+
+        case FIELD_TRACK: {
+            // "3" or "3/12"
+            char number[8];
+            read_text(text, text_len, encoding, number, sizeof(number));
+            unsigned long track = strtoul(number, NULL, 10);
+            tags->track = (uint16_t)(track > UINT16_MAX ? 0 : track);
+            break;
+        }
+
+        case FIELD_USER: {
+            char desc[ID3_TEXT_MAX];
+            char value[ID3_TEXT_MAX];
+            size_t used = read_text(text, text_len, encoding, desc, sizeof(desc));
+            read_text(text + used, text_len - used, encoding, value, sizeof(value));
+
+            // Values look like "-6.54 dB" and "0.988831"; strtof stops at the unit
+            char* value_end;
+            float v = strtof(value, &value_end);
+            if (value_end == value) break;
+            if (strcasecmp(desc, "REPLAYGAIN_TRACK_GAIN") == 0) {
+                tags->replaygain.gain_db = v;
+                tags->replaygain.valid = true;
+            } else if (strcasecmp(desc, "REPLAYGAIN_TRACK_PEAK") == 0 && v > 0.0f) {
+                tags->replaygain.peak = v;
+            }
+            break;
+        }
+
+        case FIELD_NONE:
+            break;
+    }
+}
+
+uint32_t id3_begin(id3_reader_t* reader, const uint8_t* buf, size_t len, id3_tags_t* tags) {
+    size_t size = mp3_info_id3v2_size(buf, len);
+    if (size == 0) return 0;
+
+    memset(tags, 0, sizeof(*tags));
+    uint8_t flags = buf[5];
+    reader->version = buf[3];
+    reader->size = (uint32_t)size;
+    reader->frames_end = reader->size - ((flags & 0x10) ? 10 : 0);
+    reader->pos = 10;
+
+    // Unsynchronised tags (and compressed v2.2 ones) are only skipped
+    reader->readable = reader->version >= 2 && reader->version <= 4 && !(flags & 0x80) &&
+                       !(reader->version == 2 && (flags & 0x40));
+    if (reader->readable && reader->version >= 3 && (flags & 0x40)) {
+        // Extended header: v2.4 counts its own size, v2.3 does not
+        if (len < 14) {
+            reader->readable = false;
+        } else {
+            reader->pos += (reader->version == 4) ? read_syncsafe(buf + 10) : read_be(buf + 10, 4) + 4;
+        }
+    }
+    if (reader->pos > reader->frames_end) reader->pos = reader->frames_end;
+    return reader->pos;
+}
+
+uint32_t id3_feed(id3_reader_t* reader, const uint8_t* buf, size_t len, id3_tags_t* tags) {
+    uint32_t header = (reader->version == 2) ? 6 : 10;
+    uint32_t used = 0;
+
+    for (;;) {
+        if (!reader->readable || reader->pos + header > reader->frames_end) {
+            return used + id3_skip_rest(reader);
+        }
+        if (used + header > len) return used;
+
+        // Padding ends the frames
+        const uint8_t* frame = buf + used;
+        if (frame[0] == 0) return used + id3_skip_rest(reader);
+
+        uint32_t body_size;
+        bool plain = true;
+        if (reader->version == 2) {
+            body_size = read_be(frame + 3, 3);
+        } else if (reader->version == 3) {
+            body_size = read_be(frame + 4, 4);
+            plain = !(frame[9] & 0xE0);     // Compression, encryption, grouping
+        } else {
+            body_size = read_syncsafe(frame + 4);
+            plain = !(frame[9] & 0x4F);     // Grouping, compression, encryption, unsync, data length
+        }
+        if (body_size > reader->frames_end - reader->pos - header) {
+            return used + id3_skip_rest(reader);
+        }
+
+        uint32_t total = header + body_size;
+        field_t field = plain ? frame_field(frame, reader->version) : FIELD_NONE;
+        if (field != FIELD_NONE && body_size <= ID3_FRAME_MAX) {
+            // Wanted: wait until it is all buffered
+            if (used + total > len) return used;
+            parse_frame(field, frame + header, body_size, tags);
+        }
+
+        used += total;
+        reader->pos += total;
+        if (used > len) return used;
+    }
+}
+
+uint32_t id3_skip_rest(id3_reader_t* reader) {
+    uint32_t rest = reader->size - reader->pos;
+    reader->pos = reader->size;
+    return rest;
+}
+
+bool id3_done(const id3_reader_t* reader) {
+    return reader->pos >= reader->size;
+}
+
+// Copy a space or NUL padded ID3v1 field into out if out is empty
+static void copy_v1_field(char* out, const uint8_t* field, size_t len) {
+    if (out[0] != '\0') return;
+
+    while (len > 0 && (field[len - 1] == ' ' || field[len - 1] == '\0')) len--;
+    size_t n = 0;
+    for (size_t i = 0; i < len && field[i] != '\0' && n + 1 < ID3_TEXT_MAX; i++) {
+        out[n++] = (field[i] < 0x80) ? (char)field[i] : '?';
+    }
+    out[n] = '\0';
+}
+
+bool id3_read_v1(const char* path, id3_tags_t* tags) {
+    FILE* file = fopen(path, "rb");
+    if (!file) return false;
+
+    uint8_t tag[ID3V1_SIZE];
+    bool found = fseek(file, -ID3V1_SIZE, SEEK_END) == 0 &&
+                 fread(tag, 1, ID3V1_SIZE, file) == ID3V1_SIZE &&
+                 memcmp(tag, "TAG", 3) == 0;
+    fclose(file);
+    if (!found) return false;
+
+    copy_v1_field(tags->title, tag + 3, 30);
+    copy_v1_field(tags->artist, tag + 33, 30);
+    copy_v1_field(tags->album, tag + 63, 30);
+    // ID3v1.1: track number in the last byte of the comment
+    if (tags->track == 0 && tag[125] == 0 && tag[126] != 0) {
+        tags->track = tag[126];
+    }
+    return true;
+}
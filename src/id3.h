@@ -0,0 +1,54 @@
+// SPDX-License-Identifier: MIT
+// Music Player Plugin - ID3 Tags
+// Streaming ID3v2 reader: walks the frames of a tag as the read-ahead delivers
+// them, keeps the text fields shown to the user and the ReplayGain values, and
+// tells the caller how far to move on - right past cover art and other large
+// frames, so they can be seeked over instead of read. ID3v1 tags at the end of
+// a file are read on request.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "mp3_info.h"
+
+// Longest text field kept, terminator included
+#define ID3_TEXT_MAX    64
+
+typedef struct {
+    char title[ID3_TEXT_MAX];   // Empty if unknown
+    char artist[ID3_TEXT_MAX];
+    char album[ID3_TEXT_MAX];
+    uint16_t track;             // Track number, 0 if unknown
+    mp3_replaygain_t replaygain;
+} id3_tags_t;
+
+typedef struct {
+    uint8_t version;        // Major version: 2, 3 or 4
+    bool readable;          // Frames can be parsed (tag not unsynchronised as a whole)
+    uint32_t pos;           // Offset of the next frame from the start of the tag
+    uint32_t frames_end;    // End of the frame area (footer excluded)
+    uint32_t size;          // Tag size, header and footer included
+} id3_reader_t;
+
+// Start reading the ID3v2 tag at buf and clear tags
+// Returns the header bytes to move past, 0 if buf does not start with a tag
+uint32_t id3_begin(id3_reader_t* reader, const uint8_t* buf, size_t len, id3_tags_t* tags);
+
+// Read the frames in buf, which holds len bytes from the reader's position on
+// Returns the bytes to move past; this goes beyond len when a frame that is not
+// wanted is larger than what is buffered, or when the rest of the tag is skipped.
+// 0 means the next frame is wanted but not all in buf yet; with no more data
+// coming, id3_skip_rest() gives up on it
+uint32_t id3_feed(id3_reader_t* reader, const uint8_t* buf, size_t len, id3_tags_t* tags);
+
+// Give up on the remaining frames; returns the bytes left in the tag
+uint32_t id3_skip_rest(id3_reader_t* reader);
+
+// True once the reader has moved past the whole tag
+bool id3_done(const id3_reader_t* reader);
+
+// Fill the empty text fields of tags from the ID3v1 tag at the end of path
+// Returns true if the file has one
+bool id3_read_v1(const char* path, id3_tags_t* tags);
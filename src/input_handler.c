@@ -5,14 +5,20 @@
 #include "input_handler.h"
 #include "audio.h"
 #include "playlist.h"
+#include "play_queue.h"
+#include "stats.h"
 #include "../include/music_player.h"
 #include "tanmatsu_plugin.h"
 #include <stdio.h>
+#include <string.h>
 
 // Modifier flags (from bsp/input.h)
 #define BSP_INPUT_MODIFIER_SUPER_L   (1 << 7)
 #define BSP_INPUT_MODIFIER_SUPER_R   (1 << 8)
 #define BSP_INPUT_MODIFIER_SUPER     (BSP_INPUT_MODIFIER_SUPER_L | BSP_INPUT_MODIFIER_SUPER_R)
+#define BSP_INPUT_MODIFIER_SHIFT_L   (1 << 1)
+#define BSP_INPUT_MODIFIER_SHIFT_R   (1 << 2)
+#define BSP_INPUT_MODIFIER_SHIFT     (BSP_INPUT_MODIFIER_SHIFT_L | BSP_INPUT_MODIFIER_SHIFT_R)
 
 // Navigation keys (from bsp/input.h enum - counted from 0)
 // BSP_INPUT_NAVIGATION_KEY_NONE = 0
@@ -33,8 +39,15 @@
 #define NAV_KEY_VOLUME_UP   37
 #define NAV_KEY_VOLUME_DOWN 38
 
+// SUPER+Shift+Left/Right seek step
+#define SEEK_STEP_MS        10000
+
 static int g_hook_id = -1;
 
+static const char* const g_repeat_names[PLAY_QUEUE_REPEAT_COUNT] = {
+    "all", "off", "one",
+};
+
 // Show song info dialog
 static void show_song_info(void) {
     music_player_state_t* state = music_player_get_state();
@@ -42,21 +55,73 @@ static void show_song_info(void) {
 
     if (!filename) return;
 
+    // ID3v2 tags, or ID3v1 where there are none (read by the service thread)
+    id3_tags_t tags;
+    audio_get_tags(&tags);
+
     // Build info lines
     static char line1[64];
     static char line2[128];
-    static char line3[64];
+    static char line3[160];
     static char line4[64];
+    static char line5[64];
+    static char line6[64];
+    static char line7[64];
+    static char line8[64];
 
     snprintf(line1, sizeof(line1), "Now Playing:");
-    snprintf(line2, sizeof(line2), "%s", filename);
-    snprintf(line3, sizeof(line3), "Track %d of %d",
-             state->playlist.current_index + 1, state->playlist.count);
-    snprintf(line4, sizeof(line4), "Volume: %d%%", state->volume);
+    snprintf(line2, sizeof(line2), "%s", tags.title[0] ? tags.title : filename);
+
+    // Artist and album, when tagged
+    const char* separator = (tags.artist[0] && tags.album[0]) ? " - " : "";
+    snprintf(line3, sizeof(line3), "%s%s%s", tags.artist, separator, tags.album);
+    if (tags.track > 0) {
+        snprintf(line4, sizeof(line4), "Track %d of %d (album track %u)",
+                 state->playlist.current_index + 1, state->playlist.count, (unsigned)tags.track);
+    } else {
+        snprintf(line4, sizeof(line4), "Track %d of %d",
+                 state->playlist.current_index + 1, state->playlist.count);
+    }
+
+    // Position, and duration and remaining time once the scanner has found it
+    uint32_t position = audio_get_position_ms() / 1000;
+    uint32_t duration = playlist_get_duration_ms(state->playlist.current_index) / 1000;
+    if (duration > 0) {
+        uint32_t remaining = (duration > position) ? duration - position : 0;
+        snprintf(line5, sizeof(line5), "%u:%02u / %u:%02u (-%u:%02u)",
+                 (unsigned)(position / 60), (unsigned)(position % 60),
+                 (unsigned)(duration / 60), (unsigned)(duration % 60),
+                 (unsigned)(remaining / 60), (unsigned)(remaining % 60));
+    } else {
+        snprintf(line5, sizeof(line5), "%u:%02u",
+                 (unsigned)(position / 60), (unsigned)(position % 60));
+    }
+    snprintf(line6, sizeof(line6), "Volume: %d%%, shuffle %s, repeat %s", state->volume,
+             play_queue_get_shuffle() ? "on" : "off", g_repeat_names[play_queue_get_repeat()]);
+
+    // Decoder health for the current song
+    stats_snapshot_t snap;
+    stats_snapshot(&snap);
+    const stats_hist_t* decode = &snap.timers[STATS_DECODE];
+    snprintf(line7, sizeof(line7), "Decode: avg %u us, max %u us, CPU %u%%",
+             decode->count ? (unsigned)(decode->total_us / decode->count) : 0,
+             (unsigned)decode->max_us, stats_load_percent(&snap, STATS_DECODE));
+    snprintf(line8, sizeof(line8), "Underruns: %u, SD stalls: %u",
+             (unsigned)snap.counters[STATS_UNDERRUN], (unsigned)snap.counters[STATS_READ_STALL]);
 
-    const char* lines[] = { line1, line2, line3, line4 };
+    // The artist line is left out for untagged songs
+    const char* lines[8];
+    int count = 0;
+    lines[count++] = line1;
+    lines[count++] = line2;
+    if (line3[0] != '\0') lines[count++] = line3;
+    lines[count++] = line4;
+    lines[count++] = line5;
+    lines[count++] = line6;
+    lines[count++] = line7;
+    lines[count++] = line8;
 
-    asp_plugin_show_text_dialog("Music Player", lines, 4, 5000);  // 5 second timeout
+    asp_plugin_show_text_dialog("Music Player", lines, count, 5000);  // 5 second timeout
 }
 
 // Input hook callback
@@ -73,6 +138,13 @@ static bool input_hook_callback(plugin_input_event_t* event, void* user_data) {
 
         // Check if SUPER (meta/logo) modifier is held
         bool super_held = (event->modifiers & BSP_INPUT_MODIFIER_SUPER) != 0;
+        bool shift_held = (event->modifiers & BSP_INPUT_MODIFIER_SHIFT) != 0;
+
+        // SUPER + Shift + Up: Write the playback statistics to the log
+        if (super_held && shift_held && event->key == NAV_KEY_UP) {
+            stats_dump();
+            return true;  // Consume event
+        }
 
         // SUPER + Up: Show song info
         if (super_held && event->key == NAV_KEY_UP) {
@@ -81,17 +153,49 @@ static bool input_hook_callback(plugin_input_event_t* event, void* user_data) {
             return true;  // Consume event
         }
 
+        // SUPER + Shift + Down: Toggle shuffle
+        if (super_held && shift_held && event->key == NAV_KEY_DOWN) {
+            play_queue_set_shuffle(!play_queue_get_shuffle());
+            asp_log_info("musicplayer", "Shuffle %s", play_queue_get_shuffle() ? "on" : "off");
+            return true;  // Consume event
+        }
+
+        // SUPER + Shift + Select: Cycle repeat mode
+        if (super_held && shift_held && event->key == NAV_KEY_SELECT) {
+            play_queue_repeat_t repeat = (play_queue_repeat_t)((play_queue_get_repeat() + 1) % PLAY_QUEUE_REPEAT_COUNT);
+            play_queue_set_repeat(repeat);
+            asp_log_info("musicplayer", "Repeat %s", g_repeat_names[repeat]);
+            return true;  // Consume event
+        }
+
+        // SUPER + Shift + Left/Right: Seek back/forward
+        if (super_held && shift_held && (event->key == NAV_KEY_LEFT || event->key == NAV_KEY_RIGHT)) {
+            if (state->state != PLAYBACK_STOPPED) {
+                uint32_t position = audio_get_position_ms();
+                if (event->key == NAV_KEY_LEFT) {
+                    position = (position > SEEK_STEP_MS) ? position - SEEK_STEP_MS : 0;
+                } else {
+                    position += SEEK_STEP_MS;
+                }
+                audio_seek_ms(position);
+                asp_log_info("musicplayer", "Seek to %u:%02u",
+                            (unsigned)(position / 60000), (unsigned)(position / 1000 % 60));
+            }
+            return true;  // Consume event
+        }
+
         // SUPER + Left: Previous/restart
         if (super_held && event->key == NAV_KEY_LEFT) {
             asp_log_info("musicplayer", "SUPER+LEFT: Previous");
             int old_index = state->playlist.current_index;
-            playlist_prev_or_restart();
+            play_queue_prev_or_restart(audio_get_position_ms());
 
             const char* path = playlist_get_current_path();
             if (path) {
                 audio_play_file(path);
                 state->song_start_time = asp_plugin_get_tick_ms();
                 state->state = PLAYBACK_PLAYING;
+                music_player_state_changed();
 
                 if (state->playlist.current_index != old_index) {
                     asp_log_info("musicplayer", "Previous track");
@@ -105,12 +209,12 @@ static bool input_hook_callback(plugin_input_event_t* event, void* user_data) {
         // SUPER + Right: Next song
         if (super_held && event->key == NAV_KEY_RIGHT) {
             asp_log_info("musicplayer", "SUPER+RIGHT: Next");
-            playlist_next();
-            const char* path = playlist_get_current_path();
+            const char* path = play_queue_next(true) ? playlist_get_current_path() : NULL;
             if (path) {
                 audio_play_file(path);
                 state->song_start_time = asp_plugin_get_tick_ms();
                 state->state = PLAYBACK_PLAYING;
+                music_player_state_changed();
                 asp_log_info("musicplayer", "Next track");
             }
             return true;  // Consume event
@@ -128,6 +232,7 @@ static bool input_hook_callback(plugin_input_event_t* event, void* user_data) {
                 state->state = PLAYBACK_PLAYING;
                 asp_log_info("musicplayer", "Resumed");
             }
+            music_player_state_changed();
             return true;  // Consume event
         }
 
@@ -143,6 +248,7 @@ static bool input_hook_callback(plugin_input_event_t* event, void* user_data) {
                 state->state = PLAYBACK_PLAYING;
                 asp_log_info("musicplayer", "Resumed");
             }
+            music_player_state_changed();
             return true;  // Consume event
         }
 
@@ -160,6 +266,7 @@ static bool input_hook_callback(plugin_input_event_t* event, void* user_data) {
                 state->state = PLAYBACK_PLAYING;
                 asp_log_info("musicplayer", "Resumed");
             }
+            music_player_state_changed();
             return true;  // Consume event
         }
 
@@ -171,6 +278,7 @@ static bool input_hook_callback(plugin_input_event_t* event, void* user_data) {
                 state->volume = 100;
             }
             audio_set_volume(state->volume);
+            music_player_state_changed();
             asp_log_info("musicplayer", "Volume: %d%%", state->volume);
             return true;  // Consume event
         }
@@ -183,6 +291,7 @@ static bool input_hook_callback(plugin_input_event_t* event, void* user_data) {
                 state->volume = 0;
             }
             audio_set_volume(state->volume);
+            music_player_state_changed();
             asp_log_info("musicplayer", "Volume: %d%%", state->volume);
             return true;  // Consume event
         }
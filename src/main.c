@@ -1,36 +1,80 @@
 // SPDX-License-Identifier: MIT
 // Music Player Plugin - Main Entry Point
 //
-// Background music player for MP3 files from /sd/music
+// Background music player for MP3, FLAC and WAV files from /sd/music and its subfolders
 // Controls:
 //   META+Space: Pause/resume
 //   META+Left:  Restart or previous track (if <10s)
 //   META+Right: Next track
+//   META+Shift+Left/Right: Seek back/forward 10s
 //   META+Up:    Show song info
+//   META+Shift+Up: Log playback statistics
+//   META+Shift+Down: Toggle shuffle
+//   META+Shift+Select: Cycle repeat (all, off, one)
 //   Volume keys: Adjust volume
+//
+// Setting "bench" = N > 0 benchmarks song N once at the next start (see bench.h)
+// Playback resumes where it was left, in the song it was left in
 
 #include "tanmatsu_plugin.h"
 #include "../include/music_player.h"
 #include "playlist.h"
+#include "play_queue.h"
 #include "audio.h"
+#include "id3.h"
+#include "duration_scan.h"
+#include "bench.h"
 #include "input_handler.h"
 #include "widget.h"
+#include <string.h>
+
+// Longest the service loop sleeps between checks of asp_plugin_should_stop()
+#define SERVICE_WAIT_MS  200
+
+// Least time between saving resume checkpoints to the settings while playing
+// (0: saved at cleanup only)
+#ifndef MUSICPLAYER_RESUME_SAVE_MS
+#define MUSICPLAYER_RESUME_SAVE_MS  5000
+#endif
 
 // Global state
 static music_player_state_t g_state = {0};
 static plugin_context_t* g_ctx = NULL;
 
+// Song (1-based) to benchmark before playback starts, 0 for none
+static int32_t g_bench_song = 0;
+
+// Checkpoint the first song starts at, and the one last saved: the song is
+// kept as its path hash, 0 for none
+static uint32_t g_resume_hash = 0;
+static audio_checkpoint_t g_resume;
+static uint32_t g_saved_hash = 0;
+static uint32_t g_saved_ms = 0;
+static uint32_t g_saved_tick = 0;
+
+// Song whose ID3v1 tag was read last, so a restart or a repeat of it reads once
+static char g_v1_path[256] = "";
+
 music_player_state_t* music_player_get_state(void) {
     return &g_state;
 }
 
+void music_player_state_changed(void) {
+    __atomic_fetch_add(&g_state.version, 1, __ATOMIC_RELAXED);
+}
+
+// The service loop picks the new following song up for gapless playback
+int music_player_add_up_next(int index) {
+    return play_queue_add_up_next(index);
+}
+
 // Plugin metadata
 static const plugin_info_t plugin_info = {
     .name = "Music Player",
     .slug = "musicplayer",
     .version = "1.0.0",
     .author = "Tanmatsu",
-    .description = "Background MP3 music player",
+    .description = "Background MP3/FLAC/WAV music player",
     .api_version = TANMATSU_PLUGIN_API_VERSION,
     .type = PLUGIN_TYPE_SERVICE,
     .flags = 0,
@@ -40,6 +84,58 @@ static const plugin_info_t* get_info(void) {
     return &plugin_info;
 }
 
+// Load the resume checkpoint; settings only hold 32-bit values, so a restart
+// point past 4GB or 2^32 samples is saved as unknown
+static void load_checkpoint(plugin_context_t* ctx) {
+    int32_t hash = 0;
+    int32_t position_ms = 0;
+    int32_t offset = 0;
+    int32_t sample = 0;
+    asp_plugin_settings_get_int(ctx, "resume_song", &hash);
+    asp_plugin_settings_get_int(ctx, "resume_ms", &position_ms);
+    asp_plugin_settings_get_int(ctx, "resume_offset", &offset);
+    asp_plugin_settings_get_int(ctx, "resume_sample", &sample);
+
+    g_resume_hash = (uint32_t)hash;
+    g_resume.position_ms = (uint32_t)position_ms;
+    g_resume.offset = (uint32_t)offset;
+    g_resume.sample = (uint32_t)sample;
+    g_saved_hash = g_resume_hash;
+    g_saved_ms = g_resume.position_ms;
+}
+
+static void store_checkpoint(plugin_context_t* ctx, uint32_t hash, const audio_checkpoint_t* checkpoint) {
+    bool point = checkpoint->offset <= UINT32_MAX && checkpoint->sample <= UINT32_MAX;
+    asp_plugin_settings_set_int(ctx, "resume_song", (int32_t)hash);
+    asp_plugin_settings_set_int(ctx, "resume_ms", (int32_t)checkpoint->position_ms);
+    asp_plugin_settings_set_int(ctx, "resume_offset", point ? (int32_t)(uint32_t)checkpoint->offset : 0);
+    asp_plugin_settings_set_int(ctx, "resume_sample", point ? (int32_t)(uint32_t)checkpoint->sample : 0);
+    g_saved_hash = hash;
+    g_saved_ms = checkpoint->position_ms;
+}
+
+// Save where playback is, unless it was saved less than MUSICPLAYER_RESUME_SAVE_MS
+// ago (force ignores that) or has not moved since (paused)
+static void save_checkpoint(plugin_context_t* ctx, bool force) {
+    uint32_t now = asp_plugin_get_tick_ms();
+    if (!force && (MUSICPLAYER_RESUME_SAVE_MS == 0 || now - g_saved_tick < MUSICPLAYER_RESUME_SAVE_MS)) return;
+    g_saved_tick = now;
+
+    audio_checkpoint_t checkpoint;
+    char path[256];
+    if (!audio_get_checkpoint(&checkpoint, path, sizeof(path))) return;
+    uint32_t hash = playlist_path_hash(path);
+    if (hash == g_saved_hash && checkpoint.position_ms == g_saved_ms) return;
+    store_checkpoint(ctx, hash, &checkpoint);
+}
+
+// Start from the beginning next time (the playlist played out)
+static void clear_checkpoint(plugin_context_t* ctx) {
+    if (g_saved_hash == 0) return;
+    audio_checkpoint_t none = {0};
+    store_checkpoint(ctx, 0, &none);
+}
+
 static int plugin_init(plugin_context_t* ctx) {
     g_ctx = ctx;
 
@@ -60,15 +156,49 @@ static int plugin_init(plugin_context_t* ctx) {
         }
     }
 
+    // Load the saved play order
+    int32_t saved_shuffle = 0;
+    int32_t saved_repeat = PLAY_QUEUE_REPEAT_ALL;
+    asp_plugin_settings_get_int(ctx, "shuffle", &saved_shuffle);
+    asp_plugin_settings_get_int(ctx, "repeat", &saved_repeat);
+
+    // Play time shown by the status widget
+    int32_t saved_widget_time = WIDGET_TIME_OFF;
+    asp_plugin_settings_get_int(ctx, "widget_time", &saved_widget_time);
+
+    // Where playback was left
+    load_checkpoint(ctx);
+
+    // Benchmark request, cleared so it runs once
+    int32_t bench_song;
+    if (asp_plugin_settings_get_int(ctx, "bench", &bench_song) && bench_song > 0) {
+        g_bench_song = bench_song;
+        asp_plugin_settings_set_int(ctx, "bench", 0);
+    }
+
     // Initialize playlist (checks /sd/music)
     if (playlist_init() != 0) {
         asp_log_warn("musicplayer", "No music found, plugin will not start");
         return -1;  // Exit if no music
     }
 
+    // Continue with the song playback was left in, if the library (or the
+    // part of it scanned so far) still has it
+    int resume_index = (g_resume_hash != 0) ? playlist_find_hash(g_resume_hash) : -1;
+    if (resume_index >= 0) {
+        playlist_set_current_index(resume_index);
+        asp_log_info("musicplayer", "Resuming song %d at %u ms", resume_index + 1, (unsigned)g_resume.position_ms);
+    } else {
+        g_resume_hash = 0;
+    }
+
+    // Shuffling falls back to playlist order if it cannot be set up
+    play_queue_init(saved_shuffle != 0, (play_queue_repeat_t)saved_repeat);
+
     // Initialize audio subsystem
     if (audio_init() != 0) {
         asp_log_error("musicplayer", "Failed to initialize audio");
+        play_queue_cleanup();
         playlist_cleanup();
         return -1;
     }
@@ -80,12 +210,13 @@ static int plugin_init(plugin_context_t* ctx) {
     if (input_handler_init() != 0) {
         asp_log_error("musicplayer", "Failed to register input hook");
         audio_cleanup();
+        play_queue_cleanup();
         playlist_cleanup();
         return -1;
     }
 
     // Register status widget (optional - continue even if it fails)
-    if (widget_init() != 0) {
+    if (widget_init((widget_time_t)saved_widget_time) != 0) {
         asp_log_warn("musicplayer", "Status widget not available");
     }
 
@@ -97,8 +228,11 @@ static int plugin_init(plugin_context_t* ctx) {
 static void plugin_cleanup(plugin_context_t* ctx) {
     asp_log_info("musicplayer", "Cleaning up music player...");
 
-    // Save volume setting
+    // Save volume and play order settings, and where playback is
+    save_checkpoint(ctx, true);
     asp_plugin_settings_set_int(ctx, "volume", g_state.volume);
+    asp_plugin_settings_set_int(ctx, "shuffle", play_queue_get_shuffle() ? 1 : 0);
+    asp_plugin_settings_set_int(ctx, "repeat", (int32_t)play_queue_get_repeat());
 
     // Stop playback
     audio_stop();
@@ -107,55 +241,111 @@ static void plugin_cleanup(plugin_context_t* ctx) {
     // Cleanup in reverse order
     widget_cleanup();
     input_handler_cleanup();
+    duration_scan_stop();
     audio_cleanup();
+    play_queue_cleanup();
     playlist_cleanup();
 
     g_ctx = NULL;
     asp_log_info("musicplayer", "Music player cleaned up");
 }
 
+// Read the ID3v1 tag of the current song for the song info. It is one seek
+// and a small read at the end of the file, done here so that neither the audio
+// threads nor the input hook wait on the card for it
+static void read_v1_tags(void) {
+    const char* path = playlist_get_current_path();
+    if (!path || strcmp(path, g_v1_path) == 0) return;
+    strncpy(g_v1_path, path, sizeof(g_v1_path) - 1);
+
+    id3_tags_t tags;
+    memset(&tags, 0, sizeof(tags));
+    id3_read_v1(path, &tags);
+    audio_set_v1_tags(path, &tags);
+}
+
 static void plugin_service_run(plugin_context_t* ctx) {
     asp_log_info("musicplayer", "Music player service starting...");
 
-    // Start playing first song
+    // Benchmark first, so the background scans do not skew it
+    if (g_bench_song > 0 && g_state.playlist.count > 0) {
+        bench_run(ctx, (g_bench_song - 1) % g_state.playlist.count);
+    }
+
+    // Start playing first song, where it was left if resuming
     if (g_state.playlist.count > 0) {
         const char* path = playlist_get_current_path();
         if (path) {
-            audio_play_file(path);
+            if (g_resume_hash != 0) {
+                audio_resume_file(path, &g_resume);
+            } else {
+                audio_play_file(path);
+            }
             g_state.state = PLAYBACK_PLAYING;
             g_state.song_start_time = asp_plugin_get_tick_ms();
+            music_player_state_changed();
         }
     }
 
-    // Main service loop
+    // Fill in song durations once the first song is under way
+    duration_scan_start();
+
+    // Playlist index and path the gapless successor was queued for
+    int queued_for_index = -1;
+    char queued_path[256] = "";
+
+    // Main service loop - sleeps until the audio threads report an event
     while (!asp_plugin_should_stop(ctx)) {
-        // Process audio (decode and play frames)
+        uint32_t events = audio_wait_events(SERVICE_WAIT_MS);
+
+        if (events & AUDIO_EVENT_ERROR) {
+            asp_log_warn("musicplayer", "Could not start playback");
+        }
+
         if (g_state.state == PLAYBACK_PLAYING) {
-            // Update position
-            g_state.current_position_ms = audio_get_position_ms();
+            // Queued song became audible without a gap
+            if (events & AUDIO_EVENT_TRACK_CHANGED) {
+                play_queue_next(false);
+                queued_for_index = -1;  // The successor was used up (also when repeating one song)
+                g_state.song_start_time = asp_plugin_get_tick_ms();
+                asp_log_info("musicplayer", "Gapless advance to next track");
+            }
 
-            // Process some audio frames
-            if (!audio_process()) {
-                // Song finished - advance to next
-                if (audio_is_finished()) {
-                    playlist_next();
-                    const char* path = playlist_get_current_path();
-                    if (path) {
-                        audio_play_file(path);
-                        g_state.song_start_time = asp_plugin_get_tick_ms();
-                        asp_log_info("musicplayer", "Auto-advancing to next track");
-                    }
+            // Song finished - advance to next (unless a skip was queued meanwhile)
+            if ((events & AUDIO_EVENT_FINISHED) && audio_is_finished()) {
+                const char* path = play_queue_next(false) ? playlist_get_current_path() : NULL;
+                if (!path) {
+                    g_state.state = PLAYBACK_STOPPED;
+                    music_player_state_changed();
+                    clear_checkpoint(ctx);
+                    asp_log_info("musicplayer", "End of playlist");
+                } else {
+                    audio_play_file(path);
+                    g_state.song_start_time = asp_plugin_get_tick_ms();
+                    asp_log_info("musicplayer", "Auto-advancing to next track");
                 }
             }
+
+            // Keep the following song queued (also after skips from the input hook,
+            // which wake this loop through AUDIO_EVENT_STARTED, and when the library
+            // scan appends a song after the last one); an empty path clears it when
+            // the queue ends after this song
+            const char* next_path = play_queue_get_next_path();
+            if (!next_path) next_path = "";
+            if (queued_for_index != g_state.playlist.current_index || strcmp(next_path, queued_path) != 0) {
+                queued_for_index = g_state.playlist.current_index;
+                strncpy(queued_path, next_path, sizeof(queued_path) - 1);
+                audio_queue_next(next_path);
+            }
+
+            // Update position
+            g_state.current_position_ms = audio_get_position_ms();
+            save_checkpoint(ctx, false);
         }
 
-        // Small delay to avoid busy loop
-        // When playing, we process frequently for smooth audio
-        // When paused/stopped, we can sleep longer
-        if (g_state.state == PLAYBACK_PLAYING) {
-            asp_plugin_delay_ms(10);
-        } else {
-            asp_plugin_delay_ms(50);
+        // A song started or became audible (the playlist has moved on to it)
+        if (events & (AUDIO_EVENT_STARTED | AUDIO_EVENT_TRACK_CHANGED)) {
+            read_v1_tags();
         }
     }
 
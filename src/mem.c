@@ -0,0 +1,78 @@
+// SPDX-License-Identifier: MIT
+// Music Player Plugin - Memory Placement
+
+#include "mem.h"
+#include "tanmatsu_plugin.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+// ESP-IDF's capability allocator (blocks from it are released with free())
+#if defined(__has_include)
+#if __has_include("esp_heap_caps.h")
+#include "esp_heap_caps.h"
+#define HAVE_HEAP_CAPS 1
+#endif
+#endif
+
+#ifdef HAVE_HEAP_CAPS
+
+static const uint32_t g_caps[] = {
+    [MEM_INTERNAL] = MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT,
+    [MEM_PSRAM]    = MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT,
+};
+
+static void* alloc_in(size_t align, size_t size, mem_place_t place) {
+    if (align == 0) return heap_caps_malloc(size, g_caps[place]);
+    return heap_caps_aligned_alloc(align, size, g_caps[place]);
+}
+
+#else
+
+// Host builds have a single heap; so does a device build without
+// esp_heap_caps.h, which says so once in the log
+static void* alloc_in(size_t align, size_t size, mem_place_t place) {
+    (void)place;
+#if defined(__riscv)
+    static bool warned = false;
+    if (!warned) {
+        warned = true;
+        asp_log_warn("musicplayer", "Built without esp_heap_caps.h: no SRAM/PSRAM placement");
+    }
+#endif
+    if (align == 0) return malloc(size);
+    return aligned_alloc(align, size);
+}
+
+#endif
+
+static const char* const g_place_names[] = {
+    [MEM_INTERNAL] = "internal SRAM",
+    [MEM_PSRAM]    = "PSRAM",
+};
+
+static void* alloc_anywhere(size_t align, size_t size, mem_place_t place) {
+    void* ptr = alloc_in(align, size, place);
+    if (ptr) return ptr;
+
+    mem_place_t other = (place == MEM_INTERNAL) ? MEM_PSRAM : MEM_INTERNAL;
+    ptr = alloc_in(align, size, other);
+    if (ptr) {
+        asp_log_warn("musicplayer", "No %s for %u bytes, using %s",
+                     g_place_names[place], (unsigned)size, g_place_names[other]);
+    }
+    return ptr;
+}
+
+void* mem_alloc(size_t size, mem_place_t place) {
+    return alloc_anywhere(0, size, place);
+}
+
+void* mem_alloc_aligned(size_t align, size_t size, mem_place_t place) {
+    size = (size + align - 1) & ~(align - 1);
+    return alloc_anywhere(align, size, place);
+}
+
+void* mem_alloc_strict(size_t size, mem_place_t place) {
+    return alloc_in(0, size, place);
+}
@@ -0,0 +1,37 @@
+// SPDX-License-Identifier: MIT
+// Music Player Plugin - Memory Placement
+// Puts data the decoder touches on every frame in internal SRAM, where loads
+// never miss to PSRAM, and large buffers that are filled and read in bulk in
+// PSRAM. Blocks are released with free(). Placement needs ESP-IDF's
+// esp_heap_caps.h; without it everything comes from the default heap.
+
+#pragma once
+
+#include <stddef.h>
+
+typedef enum {
+    MEM_INTERNAL,   // On-chip SRAM: decoder state and scratch
+    MEM_PSRAM,      // External PSRAM: SD read buffers, seek index and other bulk data
+} mem_place_t;
+
+// Cache line size; PSRAM buffers used for DMA start and end on a line
+#define MEM_CACHE_LINE  64
+
+// Constant tables read in the inner decode loops, kept out of flash/PSRAM
+// (the device linker script maps .dram1.* to internal SRAM)
+#if defined(__riscv)
+#define MEM_HOT_DATA    __attribute__((section(".dram1.musicplayer")))
+#else
+#define MEM_HOT_DATA
+#endif
+
+// Allocate size bytes in place, or elsewhere (with a warning) if it is full
+// Returns NULL if there is no memory at all
+void* mem_alloc(size_t size, mem_place_t place);
+
+// Like mem_alloc, aligned to align bytes (a power of two); size is rounded up
+// to a multiple of align so no other block shares its last cache line
+void* mem_alloc_aligned(size_t align, size_t size, mem_place_t place);
+
+// Allocate size bytes in place only; NULL if it is full
+void* mem_alloc_strict(size_t size, mem_place_t place);
@@ -7,6 +7,7 @@
     See <http://creativecommons.org/publicdomain/zero/1.0/>.
 */
 #include <stdint.h>
+#include <stddef.h>
 
 #define MINIMP3_MAX_SAMPLES_PER_FRAME (1152*2)
 
@@ -15,9 +16,16 @@ typedef struct
     int frame_bytes, frame_offset, channels, hz, layer, bitrate_kbps;
 } mp3dec_frame_info_t;
 
+#ifdef MINIMP3_FIXED_POINT
+/* Layer III pipeline in Q24 integers, no FPU use (see MP3D_FRAC_BITS) */
+typedef int32_t mp3d_real;
+#else /* MINIMP3_FIXED_POINT */
+typedef float mp3d_real;
+#endif /* MINIMP3_FIXED_POINT */
+
 typedef struct
 {
-    float mdct_overlap[2][9*32], qmf_state[15*2*32];
+    mp3d_real mdct_overlap[2][9*32], qmf_state[15*2*32];
     int reserv, free_format_bytes;
     unsigned char header[4], reserv_buf[511];
 } mp3dec_t;
@@ -35,6 +43,22 @@ void mp3dec_f32_to_s16(const float *in, int16_t *out, int num_samples);
 #endif /* MINIMP3_FLOAT_OUTPUT */
 int mp3dec_decode_frame(mp3dec_t *dec, const uint8_t *mp3, int mp3_bytes, mp3d_sample_t *pcm, mp3dec_frame_info_t *info);
 
+/* Per-call work area (~16 KB), which mp3dec_decode_frame keeps on the stack; callers
+   with small stacks pass their own. Holds nothing between frames, so one can be
+   shared by decoders that never run at the same time */
+typedef struct mp3dec_scratch mp3dec_scratch_t;
+size_t mp3dec_scratch_size(void);
+
+/* Output gain applied in the synthesis filter's PCM conversion, ramped linearly
+   from start at the frame's first sample to end after its last (1.0 is unity,
+   which mp3dec_decode_frame uses) */
+typedef struct
+{
+    float start, end;
+} mp3dec_gain_t;
+
+int mp3dec_decode_frame_scratch(mp3dec_t *dec, const uint8_t *mp3, int mp3_bytes, mp3d_sample_t *pcm, mp3dec_frame_info_t *info, mp3dec_scratch_t *scratch, const mp3dec_gain_t *gain);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -46,6 +70,11 @@ int mp3dec_decode_frame(mp3dec_t *dec, const uint8_t *mp3, int mp3_bytes, mp3d_s
 #include <stdlib.h>
 #include <string.h>
 
+/* Placement of the tables read in the inner loops (dequantization, IMDCT, synthesis) */
+#ifndef MINIMP3_HOT_DATA
+#define MINIMP3_HOT_DATA
+#endif /* MINIMP3_HOT_DATA */
+
 #define MAX_FREE_FORMAT_FRAME_SIZE  2304    /* more than ISO spec's */
 #ifndef MAX_FRAME_SYNC_MATCHES
 #define MAX_FRAME_SYNC_MATCHES      10
@@ -84,8 +113,74 @@ int mp3dec_decode_frame(mp3dec_t *dec, const uint8_t *mp3, int mp3_bytes, mp3d_s
 #define MINIMP3_MIN(a, b)           ((a) > (b) ? (b) : (a))
 #define MINIMP3_MAX(a, b)           ((a) < (b) ? (b) : (a))
 
+/* Called for each output sample that saturates in mp3d_scale_pcm (scalar,
+ * generic-SIMD and fixed-point output paths); only runs on the clamp branch */
+#ifndef MINIMP3_ON_CLIP
+#define MINIMP3_ON_CLIP()           ((void)0)
+#endif
+
+/* Called for each Layer III granule after the hybrid filterbank, just before
+ * synthesis, with grbuf[0]: per channel (the second at +576) 32 subbands of 18
+ * samples each, subband-major */
+#ifndef MINIMP3_ON_SUBBANDS
+#define MINIMP3_ON_SUBBANDS(grbuf, nch) ((void)0)
+#endif
+
+#ifdef MINIMP3_FIXED_POINT
+#if !defined(MINIMP3_ONLY_MP3) || defined(MINIMP3_FLOAT_OUTPUT)
+#error "MINIMP3_FIXED_POINT supports Layer III with int16 output only"
+#endif
+#ifndef MINIMP3_NO_SIMD
+#define MINIMP3_NO_SIMD /* SIMD paths are float */
+#endif
+#endif /* MINIMP3_FIXED_POINT */
+
 #if !defined(MINIMP3_NO_SIMD)
 
+#if defined(MINIMP3_GENERIC_SIMD)
+/* Portable 4-wide backend on GCC vector extensions, for cores without SSE/NEON
+ * (e.g. RISC-V). The compiler maps f4 ops onto the target's vector unit or
+ * schedules them as unrolled scalar float code. */
+#define HAVE_SSE 0
+#define HAVE_SIMD 1
+#define HAVE_GENERIC_SIMD 1
+typedef float f4 __attribute__((vector_size(16)));
+static __inline__ __attribute__((always_inline)) f4 mp3d_vld(const float *p)
+{
+    f4 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+static __inline__ __attribute__((always_inline)) void mp3d_vstore(float *p, f4 v)
+{
+    memcpy(p, &v, sizeof(v));
+}
+static __inline__ __attribute__((always_inline)) f4 mp3d_vset(float x)
+{
+    f4 v = { x, x, x, x };
+    return v;
+}
+static __inline__ __attribute__((always_inline)) f4 mp3d_vrev(f4 x)
+{
+    f4 v = { x[3], x[2], x[1], x[0] };
+    return v;
+}
+#define VSTORE mp3d_vstore
+#define VLD mp3d_vld
+#define VSET mp3d_vset
+#define VADD(a, b) ((a) + (b))
+#define VSUB(a, b) ((a) - (b))
+#define VMUL(a, b) ((a)*(b))
+#define VMAC(a, x, y) ((a) + (x)*(y))
+#define VMSB(a, x, y) ((a) - (x)*(y))
+#define VMUL_S(x, s)  ((x)*mp3d_vset(s))
+#define VREV(x) mp3d_vrev(x)
+static int have_simd(void)
+{
+    return 1;
+}
+#else /* MINIMP3_GENERIC_SIMD */
+
 #if !defined(MINIMP3_ONLY_SIMD) && (defined(_M_X64) || defined(__x86_64__) || defined(__aarch64__) || defined(_M_ARM64))
 /* x64 always have SSE2, arm64 always have neon, no need for generic code */
 #define MINIMP3_ONLY_SIMD
@@ -187,9 +282,13 @@ static int have_simd()
 #error MINIMP3_ONLY_SIMD used, but SSE/NEON not enabled
 #endif /* MINIMP3_ONLY_SIMD */
 #endif /* SIMD checks... */
+#endif /* MINIMP3_GENERIC_SIMD */
 #else /* !defined(MINIMP3_NO_SIMD) */
 #define HAVE_SIMD 0
 #endif /* !defined(MINIMP3_NO_SIMD) */
+#ifndef HAVE_GENERIC_SIMD
+#define HAVE_GENERIC_SIMD 0
+#endif /* HAVE_GENERIC_SIMD */
 
 #if defined(__ARM_ARCH) && (__ARM_ARCH >= 6) && !defined(__aarch64__) && !defined(_M_ARM64)
 #define HAVE_ARMV6 1
@@ -203,6 +302,70 @@ static __inline__ __attribute__((always_inline)) int32_t minimp3_clip_int16_arm(
 #define HAVE_ARMV6 0
 #endif
 
+#ifdef MINIMP3_FIXED_POINT
+/* Samples are Q24. Constants are Q31 when |c| < 1 (MP3D_K) and Q27 when |c| < 16
+ * (MP3D_K4), so a multiply by a constant is one 32x32 high-word multiply and a
+ * shift: a single mulh on RV32. */
+#define MP3D_FRAC_BITS  24
+#define MP3D_FIX(x, q)  ((int32_t)((x) >= (double)(1u << (31 - (q))) ? 2147483647.0 : (x)*(double)(1u << (q)) + ((x) < 0 ? -0.5 : 0.5)))
+#define MP3D_K(x)       MP3D_FIX(x, 31)
+#define MP3D_K4(x)      MP3D_FIX(x, 27)
+#define MP3D_MUL(x, k)  (mp3d_mulh(x, k) << 1)
+#define MP3D_MUL4(x, k) mp3d_mul4(x, k)
+/* The DCT-II butterflies grow up to ~20x before the odd terms fold back, so it
+ * runs 3 bits down (Q21) and saturates its outputs on the way back to Q24 */
+#define MP3D_DCT_HEADROOM 3
+#define MP3D_DCT_IN(x)  ((x) >> MP3D_DCT_HEADROOM)
+#define MP3D_DCT_OUT(x) mp3d_dct_out(x)
+/* Synthesis window taps are integers; scaled to Q30 the accumulator is 64x PCM */
+#define MP3D_WIN_SHIFT  14
+#define MP3D_MULW(x, w) mp3d_mulh(x, (w)*(1 << MP3D_WIN_SHIFT))
+typedef int32_t mp3d_coef;
+typedef int32_t mp3d_scf; /* scalefactor as a quarter-step exponent */
+/* Output gain in Q24, applied with a 32x32->64 multiply */
+#define MP3D_GAIN_BITS  24
+#define MP3D_GAIN(x, g) ((int32_t)(((int64_t)(x)*(g)) >> MP3D_GAIN_BITS))
+typedef int32_t mp3d_gain;
+
+static __inline__ __attribute__((always_inline)) int32_t mp3d_mulh(int32_t a, int32_t b)
+{
+    return (int32_t)(((int64_t)a*b) >> 32);
+}
+
+/* Times a Q27 constant of up to 16: the product leaves Q24 range on loud
+ * material (g_sec reaches 10.19), so saturate instead of wrapping to the
+ * opposite sign */
+static __inline__ __attribute__((always_inline)) int32_t mp3d_mul4(int32_t a, int32_t b)
+{
+    int64_t x = ((int64_t)a*b) >> 27;
+    return (int32_t)MINIMP3_MIN(MINIMP3_MAX(x, -2147483647 - 1), 2147483647);
+}
+
+static __inline__ __attribute__((always_inline)) int32_t mp3d_dct_out(int32_t a)
+{
+    int64_t x = (int64_t)a*(1 << MP3D_DCT_HEADROOM);
+    return (int32_t)MINIMP3_MIN(MINIMP3_MAX(x, -2147483647 - 1), 2147483647);
+}
+#else /* MINIMP3_FIXED_POINT */
+#define MP3D_K(x)       (x)
+#define MP3D_K4(x)      (x)
+#define MP3D_MUL(x, k)  ((x)*(k))
+#define MP3D_MUL4(x, k) ((x)*(k))
+#define MP3D_DCT_IN(x)  (x)
+#define MP3D_DCT_OUT(x) (x)
+#define MP3D_MULW(x, w) ((x)*(w))
+#define MP3D_GAIN(x, g) ((x)*(g))
+typedef float mp3d_coef;
+typedef float mp3d_scf;
+typedef float mp3d_gain;
+#endif /* MINIMP3_FIXED_POINT */
+
+/* Output gain g at a block's first sample frame, plus step per sample frame */
+typedef struct
+{
+    mp3d_gain g, step;
+} mp3d_ramp_t;
+
 typedef struct
 {
     const uint8_t *buf;
@@ -229,14 +392,15 @@ typedef struct
     uint8_t preflag, scalefac_scale, count1_table, scfsi;
 } L3_gr_info_t;
 
-typedef struct
+struct mp3dec_scratch
 {
     bs_t bs;
     uint8_t maindata[MAX_BITRESERVOIR_BYTES + MAX_L3_FRAME_PAYLOAD_BYTES];
     L3_gr_info_t gr_info[4];
-    float grbuf[2][576], scf[40], syn[18 + 15][2*32];
+    mp3d_real grbuf[2][576], syn[18 + 15][2*32];
+    mp3d_scf scf[40];
     uint8_t ist_pos[2][39];
-} mp3dec_scratch_t;
+};
 
 static void bs_init(bs_t *bs, const uint8_t *data, int bytes)
 {
@@ -639,6 +803,18 @@ static void L3_read_scalefactors(uint8_t *scf, uint8_t *ist_pos, const uint8_t *
     scf[0] = scf[1] = scf[2] = 0;
 }
 
+#ifdef MINIMP3_FIXED_POINT
+/* 2^(k/4) in Q30 */
+static const int32_t g_expfrac_fix[4] = { 1073741824,1276901417,1518500250,1805811301 };
+
+static int32_t L3_ldexp_q2(int32_t y, int exp_q2)
+{
+    int e = -exp_q2;
+    int sh = -2 - (e >> 2);
+    y = mp3d_mulh(y, g_expfrac_fix[e & 3]);
+    return sh < 0 ? y << -sh : (sh < 31 ? y >> sh : 0);
+}
+#else /* MINIMP3_FIXED_POINT */
 static float L3_ldexp_q2(float y, int exp_q2)
 {
     static const float g_expfrac[4] = { 9.31322575e-10f,7.83145814e-10f,6.58544508e-10f,5.53767716e-10f };
@@ -650,8 +826,9 @@ static float L3_ldexp_q2(float y, int exp_q2)
     } while ((exp_q2 -= e) > 0);
     return y;
 }
+#endif /* MINIMP3_FIXED_POINT */
 
-static void L3_decode_scalefactors(const uint8_t *hdr, uint8_t *ist_pos, bs_t *bs, const L3_gr_info_t *gr, float *scf, int ch)
+static void L3_decode_scalefactors(const uint8_t *hdr, uint8_t *ist_pos, bs_t *bs, const L3_gr_info_t *gr, mp3d_scf *scf, int ch)
 {
     static const uint8_t g_scf_partitions[3][28] = {
         { 6,5,5, 5,6,5,5,5,6,5, 7,3,11,10,0,0, 7, 7, 7,0, 6, 6,6,3, 8, 8,5,0 },
@@ -661,7 +838,9 @@ static void L3_decode_scalefactors(const uint8_t *hdr, uint8_t *ist_pos, bs_t *b
     const uint8_t *scf_partition = g_scf_partitions[!!gr->n_short_sfb + !gr->n_long_sfb];
     uint8_t scf_size[4], iscf[40];
     int i, scf_shift = gr->scalefac_scale + 1, gain_exp, scfsi = gr->scfsi;
+#ifndef MINIMP3_FIXED_POINT
     float gain;
+#endif /* MINIMP3_FIXED_POINT */
 
     if (HDR_TEST_MPEG1(hdr))
     {
@@ -706,14 +885,69 @@ static void L3_decode_scalefactors(const uint8_t *hdr, uint8_t *ist_pos, bs_t *b
     }
 
     gain_exp = gr->global_gain + BITS_DEQUANTIZER_OUT*4 - 210 - (HDR_IS_MS_STEREO(hdr) ? 2 : 0);
+#ifdef MINIMP3_FIXED_POINT
+    /* keep the exponent; L3_huffman applies 2^(scf/4) with shifts */
+    for (i = 0; i < (int)(gr->n_long_sfb + gr->n_short_sfb); i++)
+    {
+        scf[i] = gain_exp - (iscf[i] << scf_shift);
+    }
+#else /* MINIMP3_FIXED_POINT */
     gain = L3_ldexp_q2(1 << (MAX_SCFI/4),  MAX_SCFI - gain_exp);
     for (i = 0; i < (int)(gr->n_long_sfb + gr->n_short_sfb); i++)
     {
         scf[i] = L3_ldexp_q2(gain, iscf[i] << scf_shift);
     }
+#endif /* MINIMP3_FIXED_POINT */
+}
+
+#ifdef MINIMP3_FIXED_POINT
+static const int32_t g_pow43[129 + 16] MINIMP3_HOT_DATA = { /* Q21 */
+    0,-2097152,-5284492,-9073850,-13316085,-17930397,-22864669,-28081952,-33554432,-39260268,-45181770,-51304267,-57615354,-64104381,-70762085,-77580324,
+    0,2097152,5284492,9073850,13316085,17930397,22864669,28081952,33554432,39260268,45181770,51304267,57615354,64104381,70762085,77580324,
+    84551870,91670262,98929675,106324833,113850927,121503550,129278652,137172490,145181595,153302741,161532918,169869312,178309282,186850346,195490166,204226534,
+    213057363,221980672,230994585,240097314,249287160,258562502,267921791,277363549,286886358,296488863,306169762,315927805,325761791,335670566,345653016,355708071,
+    365834696,376031894,386298701,396634186,407037448,417507616,428043844,438645315,449311235,460040835,470833368,481688108,492604350,503581409,514618619,525715330,
+    536870912,548084749,559356243,570684809,582069879,593510896,605007320,616558620,628164281,639823797,651536677,663302438,675120609,686990728,698912347,710885022,
+    722908323,734981827,747105119,759277794,771499455,783769712,796088183,808454493,820868276,833329170,845836823,858390888,870991023,883636894,896328173,909064537,
+    921845669,934671258,947540998,960454587,973411731,986412137,999455521,1012541600,1025670099,1038840743,1052053267,1065307405,1078602898,1091939491,1105316931,1118734971,
+    1132193366,1145691876,1159230264,1172808296,1186425743,1200082376,1213777973,1227512314,1241285180,1255096358,1268945636,1282832806,1296757661,1310720000,1324719622,1338756329,
+    1352829926
+};
+
+/* x^(4/3) in Q21, scaled down by 2^*sh to fit */
+static int32_t L3_pow_43(int x, int *sh)
+{
+    int32_t frac, poly;
+    int sign;
+
+    *sh = 8;
+    if (x < 129)
+    {
+        *sh = 0;
+        return g_pow43[16 + x];
+    }
+
+    if (x < 1024)
+    {
+        *sh = 4;
+        x <<= 3;
+    }
+
+    sign = 2*x & 64;
+    frac = (((x & 63) - sign) << 24) / ((x & ~63) + sign) << 6; /* Q30, |frac| < 1/32 */
+    poly = 1431655765 + (mp3d_mulh(frac, MP3D_K(2.f/9)) << 1);  /* 4/3 + frac*2/9 */
+    poly = (1 << 30) + (mp3d_mulh(frac, poly) << 2);
+    return mp3d_mulh(g_pow43[16 + ((x + sign) >> 6)], poly) << 2;
 }
 
-static const float g_pow43[129 + 16] = {
+/* Q21 value times 2^(scf/4) as Q24: mul is the Q30 fraction, rsh the remaining shift */
+static int32_t L3_dequant(int32_t v, int32_t mul, int rsh)
+{
+    int64_t x = (int64_t)v*mul >> MINIMP3_MIN(MINIMP3_MAX(rsh, 0), 63);
+    return (int32_t)MINIMP3_MIN(MINIMP3_MAX(x, -2147483647 - 1), 2147483647);
+}
+#else /* MINIMP3_FIXED_POINT */
+static const float g_pow43[129 + 16] MINIMP3_HOT_DATA = {
     0,-1,-2.519842f,-4.326749f,-6.349604f,-8.549880f,-10.902724f,-13.390518f,-16.000000f,-18.720754f,-21.544347f,-24.463781f,-27.473142f,-30.567351f,-33.741992f,-36.993181f,
     0,1,2.519842f,4.326749f,6.349604f,8.549880f,10.902724f,13.390518f,16.000000f,18.720754f,21.544347f,24.463781f,27.473142f,30.567351f,33.741992f,36.993181f,40.317474f,43.711787f,47.173345f,50.699631f,54.288352f,57.937408f,61.644865f,65.408941f,69.227979f,73.100443f,77.024898f,81.000000f,85.024491f,89.097188f,93.216975f,97.382800f,101.593667f,105.848633f,110.146801f,114.487321f,118.869381f,123.292209f,127.755065f,132.257246f,136.798076f,141.376907f,145.993119f,150.646117f,155.335327f,160.060199f,164.820202f,169.614826f,174.443577f,179.305980f,184.201575f,189.129918f,194.090580f,199.083145f,204.107210f,209.162385f,214.248292f,219.364564f,224.510845f,229.686789f,234.892058f,240.126328f,245.389280f,250.680604f,256.000000f,261.347174f,266.721841f,272.123723f,277.552547f,283.008049f,288.489971f,293.998060f,299.532071f,305.091761f,310.676898f,316.287249f,321.922592f,327.582707f,333.267377f,338.976394f,344.709550f,350.466646f,356.247482f,362.051866f,367.879608f,373.730522f,379.604427f,385.501143f,391.420496f,397.362314f,403.326427f,409.312672f,415.320884f,421.350905f,427.402579f,433.475750f,439.570269f,445.685987f,451.822757f,457.980436f,464.158883f,470.357960f,476.577530f,482.817459f,489.077615f,495.357868f,501.658090f,507.978156f,514.317941f,520.677324f,527.056184f,533.454404f,539.871867f,546.308458f,552.764065f,559.238575f,565.731879f,572.243870f,578.774440f,585.323483f,591.890898f,598.476581f,605.080431f,611.702349f,618.342238f,625.000000f,631.675540f,638.368763f,645.079578f
 };
@@ -738,8 +972,9 @@ static float L3_pow_43(int x)
     frac = (float)((x & 63) - sign) / ((x & ~63) + sign);
     return g_pow43[16 + ((x + sign) >> 6)]*(1.f + frac*((4.f/3) + frac*(2.f/9)))*mult;
 }
+#endif /* MINIMP3_FIXED_POINT */
 
-static void L3_huffman(float *dst, bs_t *bs, const L3_gr_info_t *gr_info, const float *scf, int layer3gr_limit)
+static void L3_huffman(mp3d_real *dst, bs_t *bs, const L3_gr_info_t *gr_info, const mp3d_scf *scf, int layer3gr_limit)
 {
     static const int16_t tabs[] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
         785,785,785,785,784,784,784,784,513,513,513,513,513,513,513,513,256,256,256,256,256,256,256,256,256,256,256,256,256,256,256,256,
@@ -767,7 +1002,17 @@ static void L3_huffman(float *dst, bs_t *bs, const L3_gr_info_t *gr_info, const
 #define CHECK_BITS    while (bs_sh >= 0) { bs_cache |= (uint32_t)*bs_next_ptr++ << bs_sh; bs_sh -= 8; }
 #define BSPOS         ((bs_next_ptr - bs->buf)*8 - 24 + bs_sh)
 
+#ifdef MINIMP3_FIXED_POINT
+    /* one = 2^(scf/4) in Q24, one_mul/one_rsh apply it to Q21 magnitudes */
+    int32_t one = 0, one_mul = 0;
+    int one_rsh = 0;
+#define LOAD_SCALEFACTOR(e) { int e_ = (e); one_mul = g_expfrac_fix[e_ & 3]; one_rsh = 21 + 30 - MP3D_FRAC_BITS - (e_ >> 2); one = L3_dequant(1 << 21, one_mul, one_rsh); }
+#define DEQ_SMALL(i)        L3_dequant(g_pow43[i], one_mul, one_rsh)
+#else /* MINIMP3_FIXED_POINT */
     float one = 0.0f;
+#define LOAD_SCALEFACTOR(e) one = (e);
+#define DEQ_SMALL(i)        (g_pow43[i]*one)
+#endif /* MINIMP3_FIXED_POINT */
     int ireg = 0, big_val_cnt = gr_info->big_values;
     const uint8_t *sfb = gr_info->sfbtab;
     const uint8_t *bs_next_ptr = bs->buf + bs->pos/8;
@@ -787,7 +1032,7 @@ static void L3_huffman(float *dst, bs_t *bs, const L3_gr_info_t *gr_info, const
             {
                 np = *sfb++ / 2;
                 pairs_to_decode = MINIMP3_MIN(big_val_cnt, np);
-                one = *scf++;
+                LOAD_SCALEFACTOR(*scf++);
                 do
                 {
                     int j, w = 5;
@@ -808,10 +1053,18 @@ static void L3_huffman(float *dst, bs_t *bs, const L3_gr_info_t *gr_info, const
                             lsb += PEEK_BITS(linbits);
                             FLUSH_BITS(linbits);
                             CHECK_BITS;
+#ifdef MINIMP3_FIXED_POINT
+                            {
+                                int sh;
+                                int32_t v = L3_pow_43(lsb, &sh);
+                                *dst = L3_dequant((int32_t)bs_cache < 0 ? -v : v, one_mul, one_rsh - sh);
+                            }
+#else /* MINIMP3_FIXED_POINT */
                             *dst = one*L3_pow_43(lsb)*((int32_t)bs_cache < 0 ? -1: 1);
+#endif /* MINIMP3_FIXED_POINT */
                         } else
                         {
-                            *dst = g_pow43[16 + lsb - 16*(bs_cache >> 31)]*one;
+                            *dst = DEQ_SMALL(16 + lsb - 16*(bs_cache >> 31));
                         }
                         FLUSH_BITS(lsb ? 1 : 0);
                     }
@@ -824,7 +1077,7 @@ static void L3_huffman(float *dst, bs_t *bs, const L3_gr_info_t *gr_info, const
             {
                 np = *sfb++ / 2;
                 pairs_to_decode = MINIMP3_MIN(big_val_cnt, np);
-                one = *scf++;
+                LOAD_SCALEFACTOR(*scf++);
                 do
                 {
                     int j, w = 5;
@@ -840,7 +1093,7 @@ static void L3_huffman(float *dst, bs_t *bs, const L3_gr_info_t *gr_info, const
                     for (j = 0; j < 2; j++, dst++, leaf >>= 4)
                     {
                         int lsb = leaf & 0x0F;
-                        *dst = g_pow43[16 + lsb - 16*(bs_cache >> 31)]*one;
+                        *dst = DEQ_SMALL(16 + lsb - 16*(bs_cache >> 31));
                         FLUSH_BITS(lsb ? 1 : 0);
                     }
                     CHECK_BITS;
@@ -862,7 +1115,7 @@ static void L3_huffman(float *dst, bs_t *bs, const L3_gr_info_t *gr_info, const
         {
             break;
         }
-#define RELOAD_SCALEFACTOR  if (!--np) { np = *sfb++/2; if (!np) break; one = *scf++; }
+#define RELOAD_SCALEFACTOR  if (!--np) { np = *sfb++/2; if (!np) break; LOAD_SCALEFACTOR(*scf++); }
 #define DEQ_COUNT1(s) if (leaf & (128 >> s)) { dst[s] = ((int32_t)bs_cache < 0) ? -one : one; FLUSH_BITS(1) }
         RELOAD_SCALEFACTOR;
         DEQ_COUNT1(0);
@@ -876,10 +1129,10 @@ static void L3_huffman(float *dst, bs_t *bs, const L3_gr_info_t *gr_info, const
     bs->pos = layer3gr_limit;
 }
 
-static void L3_midside_stereo(float *left, int n)
+static void L3_midside_stereo(mp3d_real *left, int n)
 {
     int i = 0;
-    float *right = left + 576;
+    mp3d_real *right = left + 576;
 #if HAVE_SIMD
     if (have_simd())
     {
@@ -901,24 +1154,24 @@ static void L3_midside_stereo(float *left, int n)
 #endif /* HAVE_SIMD */
     for (; i < n; i++)
     {
-        float a = left[i];
-        float b = right[i];
+        mp3d_real a = left[i];
+        mp3d_real b = right[i];
         left[i] = a + b;
         right[i] = a - b;
     }
 }
 
-static void L3_intensity_stereo_band(float *left, int n, float kl, float kr)
+static void L3_intensity_stereo_band(mp3d_real *left, int n, mp3d_coef kl, mp3d_coef kr)
 {
     int i;
     for (i = 0; i < n; i++)
     {
-        left[i + 576] = left[i]*kr;
-        left[i] = left[i]*kl;
+        left[i + 576] = MP3D_MUL4(left[i], kr);
+        left[i] = MP3D_MUL4(left[i], kl);
     }
 }
 
-static void L3_stereo_top_band(const float *right, const uint8_t *sfb, int nbands, int max_band[3])
+static void L3_stereo_top_band(const mp3d_real *right, const uint8_t *sfb, int nbands, int max_band[3])
 {
     int i, k;
 
@@ -938,9 +1191,12 @@ static void L3_stereo_top_band(const float *right, const uint8_t *sfb, int nband
     }
 }
 
-static void L3_stereo_process(float *left, const uint8_t *ist_pos, const uint8_t *sfb, const uint8_t *hdr, int max_band[3], int mpeg2_sh)
+static void L3_stereo_process(mp3d_real *left, const uint8_t *ist_pos, const uint8_t *sfb, const uint8_t *hdr, int max_band[3], int mpeg2_sh)
 {
-    static const float g_pan[7*2] = { 0,1,0.21132487f,0.78867513f,0.36602540f,0.63397460f,0.5f,0.5f,0.63397460f,0.36602540f,0.78867513f,0.21132487f,1,0 };
+    static const mp3d_coef g_pan[7*2] = {
+        MP3D_K4(0),MP3D_K4(1),MP3D_K4(0.21132487f),MP3D_K4(0.78867513f),MP3D_K4(0.36602540f),MP3D_K4(0.63397460f),MP3D_K4(0.5f),
+        MP3D_K4(0.5f),MP3D_K4(0.63397460f),MP3D_K4(0.36602540f),MP3D_K4(0.78867513f),MP3D_K4(0.21132487f),MP3D_K4(1),MP3D_K4(0)
+    };
     unsigned i, max_pos = HDR_TEST_MPEG1(hdr) ? 7 : 64;
 
     for (i = 0; sfb[i]; i++)
@@ -948,22 +1204,22 @@ static void L3_stereo_process(float *left, const uint8_t *ist_pos, const uint8_t
         unsigned ipos = ist_pos[i];
         if ((int)i > max_band[i % 3] && ipos < max_pos)
         {
-            float kl, kr, s = HDR_TEST_MS_STEREO(hdr) ? 1.41421356f : 1;
+            mp3d_coef kl, kr, s = HDR_TEST_MS_STEREO(hdr) ? MP3D_K4(1.41421356f) : MP3D_K4(1);
             if (HDR_TEST_MPEG1(hdr))
             {
                 kl = g_pan[2*ipos];
                 kr = g_pan[2*ipos + 1];
             } else
             {
-                kl = 1;
-                kr = L3_ldexp_q2(1, (ipos + 1) >> 1 << mpeg2_sh);
+                kl = MP3D_K4(1);
+                kr = L3_ldexp_q2(MP3D_K4(1), (ipos + 1) >> 1 << mpeg2_sh);
                 if (ipos & 1)
                 {
                     kl = kr;
-                    kr = 1;
+                    kr = MP3D_K4(1);
                 }
             }
-            L3_intensity_stereo_band(left, sfb[i], kl*s, kr*s);
+            L3_intensity_stereo_band(left, sfb[i], MP3D_MUL4(kl, s), MP3D_MUL4(kr, s));
         } else if (HDR_TEST_MS_STEREO(hdr))
         {
             L3_midside_stereo(left, sfb[i]);
@@ -972,7 +1228,7 @@ static void L3_stereo_process(float *left, const uint8_t *ist_pos, const uint8_t
     }
 }
 
-static void L3_intensity_stereo(float *left, uint8_t *ist_pos, const L3_gr_info_t *gr, const uint8_t *hdr)
+static void L3_intensity_stereo(mp3d_real *left, uint8_t *ist_pos, const L3_gr_info_t *gr, const uint8_t *hdr)
 {
     int max_band[3], n_sfb = gr->n_long_sfb + gr->n_short_sfb;
     int i, max_blocks = gr->n_short_sfb ? 3 : 1;
@@ -992,10 +1248,10 @@ static void L3_intensity_stereo(float *left, uint8_t *ist_pos, const L3_gr_info_
     L3_stereo_process(left, ist_pos, gr->sfbtab, hdr, max_band, gr[1].scalefac_compress & 1);
 }
 
-static void L3_reorder(float *grbuf, float *scratch, const uint8_t *sfb)
+static void L3_reorder(mp3d_real *grbuf, mp3d_real *scratch, const uint8_t *sfb)
 {
     int i, len;
-    float *src = grbuf, *dst = scratch;
+    mp3d_real *src = grbuf, *dst = scratch;
 
     for (;0 != (len = *sfb); sfb += 3, src += 2*len)
     {
@@ -1006,14 +1262,14 @@ static void L3_reorder(float *grbuf, float *scratch, const uint8_t *sfb)
             *dst++ = src[2*len];
         }
     }
-    memcpy(grbuf, scratch, (dst - scratch)*sizeof(float));
+    memcpy(grbuf, scratch, (dst - scratch)*sizeof(mp3d_real));
 }
 
-static void L3_antialias(float *grbuf, int nbands)
+static void L3_antialias(mp3d_real *grbuf, int nbands)
 {
-    static const float g_aa[2][8] = {
-        {0.85749293f,0.88174200f,0.94962865f,0.98331459f,0.99551782f,0.99916056f,0.99989920f,0.99999316f},
-        {0.51449576f,0.47173197f,0.31337745f,0.18191320f,0.09457419f,0.04096558f,0.01419856f,0.00369997f}
+    static const mp3d_coef g_aa[2][8] MINIMP3_HOT_DATA = {
+        {MP3D_K(0.85749293f),MP3D_K(0.88174200f),MP3D_K(0.94962865f),MP3D_K(0.98331459f),MP3D_K(0.99551782f),MP3D_K(0.99916056f),MP3D_K(0.99989920f),MP3D_K(0.99999316f)},
+        {MP3D_K(0.51449576f),MP3D_K(0.47173197f),MP3D_K(0.31337745f),MP3D_K(0.18191320f),MP3D_K(0.09457419f),MP3D_K(0.04096558f),MP3D_K(0.01419856f),MP3D_K(0.00369997f)}
     };
 
     for (; nbands > 0; nbands--, grbuf += 18)
@@ -1035,28 +1291,28 @@ static void L3_antialias(float *grbuf, int nbands)
 #ifndef MINIMP3_ONLY_SIMD
         for(; i < 8; i++)
         {
-            float u = grbuf[18 + i];
-            float d = grbuf[17 - i];
-            grbuf[18 + i] = u*g_aa[0][i] - d*g_aa[1][i];
-            grbuf[17 - i] = u*g_aa[1][i] + d*g_aa[0][i];
+            mp3d_real u = grbuf[18 + i];
+            mp3d_real d = grbuf[17 - i];
+            grbuf[18 + i] = MP3D_MUL(u, g_aa[0][i]) - MP3D_MUL(d, g_aa[1][i]);
+            grbuf[17 - i] = MP3D_MUL(u, g_aa[1][i]) + MP3D_MUL(d, g_aa[0][i]);
         }
 #endif /* MINIMP3_ONLY_SIMD */
     }
 }
 
-static void L3_dct3_9(float *y)
+static void L3_dct3_9(mp3d_real *y)
 {
-    float s0, s1, s2, s3, s4, s5, s6, s7, s8, t0, t2, t4;
+    mp3d_real s0, s1, s2, s3, s4, s5, s6, s7, s8, t0, t2, t4;
 
     s0 = y[0]; s2 = y[2]; s4 = y[4]; s6 = y[6]; s8 = y[8];
-    t0 = s0 + s6*0.5f;
+    t0 = s0 + MP3D_MUL(s6, MP3D_K(0.5f));
     s0 -= s6;
-    t4 = (s4 + s2)*0.93969262f;
-    t2 = (s8 + s2)*0.76604444f;
-    s6 = (s4 - s8)*0.17364818f;
+    t4 = MP3D_MUL(s4 + s2, MP3D_K(0.93969262f));
+    t2 = MP3D_MUL(s8 + s2, MP3D_K(0.76604444f));
+    s6 = MP3D_MUL(s4 - s8, MP3D_K(0.17364818f));
     s4 += s8 - s2;
 
-    s2 = s0 - s4*0.5f;
+    s2 = s0 - MP3D_MUL(s4, MP3D_K(0.5f));
     y[4] = s4 + s0;
     s8 = t0 - t2 + s6;
     s0 = t0 - t4 + t2;
@@ -1064,11 +1320,11 @@ static void L3_dct3_9(float *y)
 
     s1 = y[1]; s3 = y[3]; s5 = y[5]; s7 = y[7];
 
-    s3 *= 0.86602540f;
-    t0 = (s5 + s1)*0.98480775f;
-    t4 = (s5 - s7)*0.34202014f;
-    t2 = (s1 + s7)*0.64278761f;
-    s1 = (s1 - s5 - s7)*0.86602540f;
+    s3 = MP3D_MUL(s3, MP3D_K(0.86602540f));
+    t0 = MP3D_MUL(s5 + s1, MP3D_K(0.98480775f));
+    t4 = MP3D_MUL(s5 - s7, MP3D_K(0.34202014f));
+    t2 = MP3D_MUL(s1 + s7, MP3D_K(0.64278761f));
+    s1 = MP3D_MUL(s1 - s5 - s7, MP3D_K(0.86602540f));
 
     s5 = t0 - s3 - t2;
     s7 = t4 - s3 - t0;
@@ -1084,16 +1340,17 @@ static void L3_dct3_9(float *y)
     y[8] = s4 + s7;
 }
 
-static void L3_imdct36(float *grbuf, float *overlap, const float *window, int nbands)
+static void L3_imdct36(mp3d_real *grbuf, mp3d_real *overlap, const mp3d_coef *window, int nbands)
 {
     int i, j;
-    static const float g_twid9[18] = {
-        0.73727734f,0.79335334f,0.84339145f,0.88701083f,0.92387953f,0.95371695f,0.97629601f,0.99144486f,0.99904822f,0.67559021f,0.60876143f,0.53729961f,0.46174861f,0.38268343f,0.30070580f,0.21643961f,0.13052619f,0.04361938f
+    static const mp3d_coef g_twid9[18] MINIMP3_HOT_DATA = {
+        MP3D_K(0.73727734f),MP3D_K(0.79335334f),MP3D_K(0.84339145f),MP3D_K(0.88701083f),MP3D_K(0.92387953f),MP3D_K(0.95371695f),MP3D_K(0.97629601f),MP3D_K(0.99144486f),MP3D_K(0.99904822f),
+        MP3D_K(0.67559021f),MP3D_K(0.60876143f),MP3D_K(0.53729961f),MP3D_K(0.46174861f),MP3D_K(0.38268343f),MP3D_K(0.30070580f),MP3D_K(0.21643961f),MP3D_K(0.13052619f),MP3D_K(0.04361938f)
     };
 
     for (j = 0; j < nbands; j++, grbuf += 18, overlap += 9)
     {
-        float co[9], si[9];
+        mp3d_real co[9], si[9];
         co[0] = -grbuf[0];
         si[0] = grbuf[17];
         for (i = 0; i < 4; i++)
@@ -1132,28 +1389,28 @@ static void L3_imdct36(float *grbuf, float *overlap, const float *window, int nb
 #endif /* HAVE_SIMD */
         for (; i < 9; i++)
         {
-            float ovl  = overlap[i];
-            float sum  = co[i]*g_twid9[9 + i] + si[i]*g_twid9[0 + i];
-            overlap[i] = co[i]*g_twid9[0 + i] - si[i]*g_twid9[9 + i];
-            grbuf[i]      = ovl*window[0 + i] - sum*window[9 + i];
-            grbuf[17 - i] = ovl*window[9 + i] + sum*window[0 + i];
+            mp3d_real ovl  = overlap[i];
+            mp3d_real sum  = MP3D_MUL(co[i], g_twid9[9 + i]) + MP3D_MUL(si[i], g_twid9[0 + i]);
+            overlap[i] = MP3D_MUL(co[i], g_twid9[0 + i]) - MP3D_MUL(si[i], g_twid9[9 + i]);
+            grbuf[i]      = MP3D_MUL(ovl, window[0 + i]) - MP3D_MUL(sum, window[9 + i]);
+            grbuf[17 - i] = MP3D_MUL(ovl, window[9 + i]) + MP3D_MUL(sum, window[0 + i]);
         }
     }
 }
 
-static void L3_idct3(float x0, float x1, float x2, float *dst)
+static void L3_idct3(mp3d_real x0, mp3d_real x1, mp3d_real x2, mp3d_real *dst)
 {
-    float m1 = x1*0.86602540f;
-    float a1 = x0 - x2*0.5f;
+    mp3d_real m1 = MP3D_MUL(x1, MP3D_K(0.86602540f));
+    mp3d_real a1 = x0 - MP3D_MUL(x2, MP3D_K(0.5f));
     dst[1] = x0 + x2;
     dst[0] = a1 + m1;
     dst[2] = a1 - m1;
 }
 
-static void L3_imdct12(float *x, float *dst, float *overlap)
+static void L3_imdct12(mp3d_real *x, mp3d_real *dst, mp3d_real *overlap)
 {
-    static const float g_twid3[6] = { 0.79335334f,0.92387953f,0.99144486f, 0.60876143f,0.38268343f,0.13052619f };
-    float co[3], si[3];
+    static const mp3d_coef g_twid3[6] MINIMP3_HOT_DATA = { MP3D_K(0.79335334f),MP3D_K(0.92387953f),MP3D_K(0.99144486f), MP3D_K(0.60876143f),MP3D_K(0.38268343f),MP3D_K(0.13052619f) };
+    mp3d_real co[3], si[3];
     int i;
 
     L3_idct3(-x[0], x[6] + x[3], x[12] + x[9], co);
@@ -1162,28 +1419,28 @@ static void L3_imdct12(float *x, float *dst, float *overlap)
 
     for (i = 0; i < 3; i++)
     {
-        float ovl  = overlap[i];
-        float sum  = co[i]*g_twid3[3 + i] + si[i]*g_twid3[0 + i];
-        overlap[i] = co[i]*g_twid3[0 + i] - si[i]*g_twid3[3 + i];
-        dst[i]     = ovl*g_twid3[2 - i] - sum*g_twid3[5 - i];
-        dst[5 - i] = ovl*g_twid3[5 - i] + sum*g_twid3[2 - i];
+        mp3d_real ovl  = overlap[i];
+        mp3d_real sum  = MP3D_MUL(co[i], g_twid3[3 + i]) + MP3D_MUL(si[i], g_twid3[0 + i]);
+        overlap[i] = MP3D_MUL(co[i], g_twid3[0 + i]) - MP3D_MUL(si[i], g_twid3[3 + i]);
+        dst[i]     = MP3D_MUL(ovl, g_twid3[2 - i]) - MP3D_MUL(sum, g_twid3[5 - i]);
+        dst[5 - i] = MP3D_MUL(ovl, g_twid3[5 - i]) + MP3D_MUL(sum, g_twid3[2 - i]);
     }
 }
 
-static void L3_imdct_short(float *grbuf, float *overlap, int nbands)
+static void L3_imdct_short(mp3d_real *grbuf, mp3d_real *overlap, int nbands)
 {
     for (;nbands > 0; nbands--, overlap += 9, grbuf += 18)
     {
-        float tmp[18];
+        mp3d_real tmp[18];
         memcpy(tmp, grbuf, sizeof(tmp));
-        memcpy(grbuf, overlap, 6*sizeof(float));
+        memcpy(grbuf, overlap, 6*sizeof(mp3d_real));
         L3_imdct12(tmp, grbuf + 6, overlap + 6);
         L3_imdct12(tmp + 1, grbuf + 12, overlap + 6);
         L3_imdct12(tmp + 2, overlap, overlap + 6);
     }
 }
 
-static void L3_change_sign(float *grbuf)
+static void L3_change_sign(mp3d_real *grbuf)
 {
     int b, i;
     for (b = 0, grbuf += 18; b < 32; b += 2, grbuf += 36)
@@ -1191,11 +1448,13 @@ static void L3_change_sign(float *grbuf)
             grbuf[i] = -grbuf[i];
 }
 
-static void L3_imdct_gr(float *grbuf, float *overlap, unsigned block_type, unsigned n_long_bands)
+static void L3_imdct_gr(mp3d_real *grbuf, mp3d_real *overlap, unsigned block_type, unsigned n_long_bands)
 {
-    static const float g_mdct_window[2][18] = {
-        { 0.99904822f,0.99144486f,0.97629601f,0.95371695f,0.92387953f,0.88701083f,0.84339145f,0.79335334f,0.73727734f,0.04361938f,0.13052619f,0.21643961f,0.30070580f,0.38268343f,0.46174861f,0.53729961f,0.60876143f,0.67559021f },
-        { 1,1,1,1,1,1,0.99144486f,0.92387953f,0.79335334f,0,0,0,0,0,0,0.13052619f,0.38268343f,0.60876143f }
+    static const mp3d_coef g_mdct_window[2][18] MINIMP3_HOT_DATA = {
+        { MP3D_K(0.99904822f),MP3D_K(0.99144486f),MP3D_K(0.97629601f),MP3D_K(0.95371695f),MP3D_K(0.92387953f),MP3D_K(0.88701083f),MP3D_K(0.84339145f),MP3D_K(0.79335334f),MP3D_K(0.73727734f),
+          MP3D_K(0.04361938f),MP3D_K(0.13052619f),MP3D_K(0.21643961f),MP3D_K(0.30070580f),MP3D_K(0.38268343f),MP3D_K(0.46174861f),MP3D_K(0.53729961f),MP3D_K(0.60876143f),MP3D_K(0.67559021f) },
+        { MP3D_K(1),MP3D_K(1),MP3D_K(1),MP3D_K(1),MP3D_K(1),MP3D_K(1),MP3D_K(0.99144486f),MP3D_K(0.92387953f),MP3D_K(0.79335334f),
+          MP3D_K(0),MP3D_K(0),MP3D_K(0),MP3D_K(0),MP3D_K(0),MP3D_K(0),MP3D_K(0.13052619f),MP3D_K(0.38268343f),MP3D_K(0.60876143f) }
     };
     if (n_long_bands)
     {
@@ -1271,10 +1530,13 @@ static void L3_decode(mp3dec_t *h, mp3dec_scratch_t *s, L3_gr_info_t *gr_info, i
     }
 }
 
-static void mp3d_DCT_II(float *grbuf, int n)
+static void mp3d_DCT_II(mp3d_real *grbuf, int n)
 {
-    static const float g_sec[24] = {
-        10.19000816f,0.50060302f,0.50241929f,3.40760851f,0.50547093f,0.52249861f,2.05778098f,0.51544732f,0.56694406f,1.48416460f,0.53104258f,0.64682180f,1.16943991f,0.55310392f,0.78815460f,0.97256821f,0.58293498f,1.06067765f,0.83934963f,0.62250412f,1.72244716f,0.74453628f,0.67480832f,5.10114861f
+    static const mp3d_coef g_sec[24] MINIMP3_HOT_DATA = {
+        MP3D_K4(10.19000816f),MP3D_K4(0.50060302f),MP3D_K4(0.50241929f),MP3D_K4(3.40760851f),MP3D_K4(0.50547093f),MP3D_K4(0.52249861f),
+        MP3D_K4(2.05778098f),MP3D_K4(0.51544732f),MP3D_K4(0.56694406f),MP3D_K4(1.48416460f),MP3D_K4(0.53104258f),MP3D_K4(0.64682180f),
+        MP3D_K4(1.16943991f),MP3D_K4(0.55310392f),MP3D_K4(0.78815460f),MP3D_K4(0.97256821f),MP3D_K4(0.58293498f),MP3D_K4(1.06067765f),
+        MP3D_K4(0.83934963f),MP3D_K4(0.62250412f),MP3D_K4(1.72244716f),MP3D_K4(0.74453628f),MP3D_K4(0.67480832f),MP3D_K4(5.10114861f)
     };
     int i, k = 0;
 #if HAVE_SIMD
@@ -1329,6 +1591,8 @@ static void mp3d_DCT_II(float *grbuf, int n)
         {
 #if HAVE_SSE
 #define VSAVE2(i, v) _mm_storel_pi((__m64 *)(void*)&y[i*18], v)
+#elif HAVE_GENERIC_SIMD
+#define VSAVE2(i, v) { f4 vs2 = (v); y[i*18] = vs2[0]; y[i*18 + 1] = vs2[1]; }
 #else /* HAVE_SSE */
 #define VSAVE2(i, v) vst1_f32((float32_t *)&y[i*18],  vget_low_f32(v))
 #endif /* HAVE_SSE */
@@ -1367,26 +1631,26 @@ static void mp3d_DCT_II(float *grbuf, int n)
 #else /* MINIMP3_ONLY_SIMD */
     for (; k < n; k++)
     {
-        float t[4][8], *x, *y = grbuf + k;
+        mp3d_real t[4][8], *x, *y = grbuf + k;
 
         for (x = t[0], i = 0; i < 8; i++, x++)
         {
-            float x0 = y[i*18];
-            float x1 = y[(15 - i)*18];
-            float x2 = y[(16 + i)*18];
-            float x3 = y[(31 - i)*18];
-            float t0 = x0 + x3;
-            float t1 = x1 + x2;
-            float t2 = (x1 - x2)*g_sec[3*i + 0];
-            float t3 = (x0 - x3)*g_sec[3*i + 1];
+            mp3d_real x0 = MP3D_DCT_IN(y[i*18]);
+            mp3d_real x1 = MP3D_DCT_IN(y[(15 - i)*18]);
+            mp3d_real x2 = MP3D_DCT_IN(y[(16 + i)*18]);
+            mp3d_real x3 = MP3D_DCT_IN(y[(31 - i)*18]);
+            mp3d_real t0 = x0 + x3;
+            mp3d_real t1 = x1 + x2;
+            mp3d_real t2 = MP3D_MUL4(x1 - x2, g_sec[3*i + 0]);
+            mp3d_real t3 = MP3D_MUL4(x0 - x3, g_sec[3*i + 1]);
             x[0] = t0 + t1;
-            x[8] = (t0 - t1)*g_sec[3*i + 2];
+            x[8] = MP3D_MUL4(t0 - t1, g_sec[3*i + 2]);
             x[16] = t3 + t2;
-            x[24] = (t3 - t2)*g_sec[3*i + 2];
+            x[24] = MP3D_MUL4(t3 - t2, g_sec[3*i + 2]);
         }
         for (x = t[0], i = 0; i < 4; i++, x += 8)
         {
-            float x0 = x[0], x1 = x[1], x2 = x[2], x3 = x[3], x4 = x[4], x5 = x[5], x6 = x[6], x7 = x[7], xt;
+            mp3d_real x0 = x[0], x1 = x[1], x2 = x[2], x3 = x[3], x4 = x[4], x5 = x[5], x6 = x[6], x7 = x[7], xt;
             xt = x0 - x7; x0 += x7;
             x7 = x1 - x6; x1 += x6;
             x6 = x2 - x5; x2 += x5;
@@ -1394,50 +1658,58 @@ static void mp3d_DCT_II(float *grbuf, int n)
             x4 = x0 - x3; x0 += x3;
             x3 = x1 - x2; x1 += x2;
             x[0] = x0 + x1;
-            x[4] = (x0 - x1)*0.70710677f;
+            x[4] = MP3D_MUL(x0 - x1, MP3D_K(0.70710677f));
             x5 =  x5 + x6;
-            x6 = (x6 + x7)*0.70710677f;
+            x6 = MP3D_MUL(x6 + x7, MP3D_K(0.70710677f));
             x7 =  x7 + xt;
-            x3 = (x3 + x4)*0.70710677f;
-            x5 -= x7*0.198912367f;  /* rotate by PI/8 */
-            x7 += x5*0.382683432f;
-            x5 -= x7*0.198912367f;
+            x3 = MP3D_MUL(x3 + x4, MP3D_K(0.70710677f));
+            x5 -= MP3D_MUL(x7, MP3D_K(0.198912367f));  /* rotate by PI/8 */
+            x7 += MP3D_MUL(x5, MP3D_K(0.382683432f));
+            x5 -= MP3D_MUL(x7, MP3D_K(0.198912367f));
             x0 = xt - x6; xt += x6;
-            x[1] = (xt + x7)*0.50979561f;
-            x[2] = (x4 + x3)*0.54119611f;
-            x[3] = (x0 - x5)*0.60134488f;
-            x[5] = (x0 + x5)*0.89997619f;
-            x[6] = (x4 - x3)*1.30656302f;
-            x[7] = (xt - x7)*2.56291556f;
+            x[1] = MP3D_MUL(xt + x7, MP3D_K(0.50979561f));
+            x[2] = MP3D_MUL(x4 + x3, MP3D_K(0.54119611f));
+            x[3] = MP3D_MUL(x0 - x5, MP3D_K(0.60134488f));
+            x[5] = MP3D_MUL(x0 + x5, MP3D_K(0.89997619f));
+            x[6] = MP3D_MUL4(x4 - x3, MP3D_K4(1.30656302f));
+            x[7] = MP3D_MUL4(xt - x7, MP3D_K4(2.56291556f));
 
         }
         for (i = 0; i < 7; i++, y += 4*18)
         {
-            y[0*18] = t[0][i];
-            y[1*18] = t[2][i] + t[3][i] + t[3][i + 1];
-            y[2*18] = t[1][i] + t[1][i + 1];
-            y[3*18] = t[2][i + 1] + t[3][i] + t[3][i + 1];
+            y[0*18] = MP3D_DCT_OUT(t[0][i]);
+            y[1*18] = MP3D_DCT_OUT(t[2][i] + t[3][i] + t[3][i + 1]);
+            y[2*18] = MP3D_DCT_OUT(t[1][i] + t[1][i + 1]);
+            y[3*18] = MP3D_DCT_OUT(t[2][i + 1] + t[3][i] + t[3][i + 1]);
         }
-        y[0*18] = t[0][7];
-        y[1*18] = t[2][7] + t[3][7];
-        y[2*18] = t[1][7];
-        y[3*18] = t[3][7];
+        y[0*18] = MP3D_DCT_OUT(t[0][7]);
+        y[1*18] = MP3D_DCT_OUT(t[2][7] + t[3][7]);
+        y[2*18] = MP3D_DCT_OUT(t[1][7]);
+        y[3*18] = MP3D_DCT_OUT(t[3][7]);
     }
 #endif /* MINIMP3_ONLY_SIMD */
 }
 
-#ifndef MINIMP3_FLOAT_OUTPUT
+#ifdef MINIMP3_FIXED_POINT
+static int16_t mp3d_scale_pcm(mp3d_real sample)
+{
+    /* Accumulator is 64x PCM */
+    int32_t s = (sample + (1 << 5)) >> 6;
+    if (s >  32767) { MINIMP3_ON_CLIP(); return (int16_t) 32767; }
+    if (s < -32768) { MINIMP3_ON_CLIP(); return (int16_t)-32768; }
+    return (int16_t)s;
+}
+#elif !defined(MINIMP3_FLOAT_OUTPUT)
 static int16_t mp3d_scale_pcm(float sample)
 {
-    /* Scale down by 50% to prevent clipping during loud passages */
-    sample = sample * 0.5f;
 #if HAVE_ARMV6
     int32_t s32 = (int32_t)(sample + .5f);
     s32 -= (s32 < 0);
     int16_t s = (int16_t)minimp3_clip_int16_arm(s32);
+    if (s != s32) MINIMP3_ON_CLIP();
 #else
-    if (sample >=  32766.5) return (int16_t) 32767;
-    if (sample <= -32767.5) return (int16_t)-32768;
+    if (sample >=  32766.5) { MINIMP3_ON_CLIP(); return (int16_t) 32767; }
+    if (sample <= -32767.5) { MINIMP3_ON_CLIP(); return (int16_t)-32768; }
     int16_t s = (int16_t)(sample + .5f);
     s -= (s < 0);   /* away from zero, to be compliant */
 #endif
@@ -1450,38 +1722,39 @@ static float mp3d_scale_pcm(float sample)
 }
 #endif /* MINIMP3_FLOAT_OUTPUT */
 
-static void mp3d_synth_pair(mp3d_sample_t *pcm, int nch, const float *z)
+static void mp3d_synth_pair(mp3d_sample_t *pcm, int nch, const mp3d_real *z, mp3d_gain g0, mp3d_gain g16)
 {
-    float a;
-    a  = (z[14*64] - z[    0]) * 29;
-    a += (z[ 1*64] + z[13*64]) * 213;
-    a += (z[12*64] - z[ 2*64]) * 459;
-    a += (z[ 3*64] + z[11*64]) * 2037;
-    a += (z[10*64] - z[ 4*64]) * 5153;
-    a += (z[ 5*64] + z[ 9*64]) * 6574;
-    a += (z[ 8*64] - z[ 6*64]) * 37489;
-    a +=  z[ 7*64]             * 75038;
-    pcm[0] = mp3d_scale_pcm(a);
+    mp3d_real a;
+    a  = MP3D_MULW(z[14*64] - z[    0], 29);
+    a += MP3D_MULW(z[ 1*64] + z[13*64], 213);
+    a += MP3D_MULW(z[12*64] - z[ 2*64], 459);
+    a += MP3D_MULW(z[ 3*64] + z[11*64], 2037);
+    a += MP3D_MULW(z[10*64] - z[ 4*64], 5153);
+    a += MP3D_MULW(z[ 5*64] + z[ 9*64], 6574);
+    a += MP3D_MULW(z[ 8*64] - z[ 6*64], 37489);
+    a += MP3D_MULW(z[ 7*64]           , 75038);
+    pcm[0] = mp3d_scale_pcm(MP3D_GAIN(a, g0));
 
     z += 2;
-    a  = z[14*64] * 104;
-    a += z[12*64] * 1567;
-    a += z[10*64] * 9727;
-    a += z[ 8*64] * 64019;
-    a += z[ 6*64] * -9975;
-    a += z[ 4*64] * -45;
-    a += z[ 2*64] * 146;
-    a += z[ 0*64] * -5;
-    pcm[16*nch] = mp3d_scale_pcm(a);
+    a  = MP3D_MULW(z[14*64], 104);
+    a += MP3D_MULW(z[12*64], 1567);
+    a += MP3D_MULW(z[10*64], 9727);
+    a += MP3D_MULW(z[ 8*64], 64019);
+    a += MP3D_MULW(z[ 6*64], -9975);
+    a += MP3D_MULW(z[ 4*64], -45);
+    a += MP3D_MULW(z[ 2*64], 146);
+    a += MP3D_MULW(z[ 0*64], -5);
+    pcm[16*nch] = mp3d_scale_pcm(MP3D_GAIN(a, g16));
 }
 
-static void mp3d_synth(float *xl, mp3d_sample_t *dstl, int nch, float *lins)
+/* Synthesizes 64 sample frames; ramp gives the output gain at the first one */
+static void mp3d_synth(mp3d_real *xl, mp3d_sample_t *dstl, int nch, mp3d_real *lins, mp3d_ramp_t ramp)
 {
     int i;
-    float *xr = xl + 576*(nch - 1);
+    mp3d_real *xr = xl + 576*(nch - 1);
     mp3d_sample_t *dstr = dstl + (nch - 1);
 
-    static const float g_win[] = {
+    static const mp3d_coef g_win[] MINIMP3_HOT_DATA = {
         -1,26,-31,208,218,401,-519,2063,2000,4788,-5517,7134,5959,35640,-39336,74992,
         -1,24,-35,202,222,347,-581,2080,1952,4425,-5879,7640,5288,33791,-41176,74856,
         -1,21,-38,196,225,294,-645,2087,1893,4063,-6237,8092,4561,31947,-43006,74630,
@@ -1498,8 +1771,8 @@ static void mp3d_synth(float *xl, mp3d_sample_t *dstl, int nch, float *lins)
         -4,7,-91,117,177,-106,-1428,1698,402,545,-9416,9916,-7154,12980,-61289,66494,
         -5,6,-97,111,163,-127,-1498,1634,185,288,-9585,9838,-8540,11455,-62684,65290
     };
-    float *zlin = lins + 15*64;
-    const float *w = g_win;
+    mp3d_real *zlin = lins + 15*64;
+    const mp3d_coef *w = g_win;
 
     zlin[4*15]     = xl[18*16];
     zlin[4*15 + 1] = xr[18*16];
@@ -1511,13 +1784,22 @@ static void mp3d_synth(float *xl, mp3d_sample_t *dstl, int nch, float *lins)
     zlin[4*31 + 2] = xl[1];
     zlin[4*31 + 3] = xr[1];
 
-    mp3d_synth_pair(dstr, nch, lins + 4*15 + 1);
-    mp3d_synth_pair(dstr + 32*nch, nch, lins + 4*15 + 64 + 1);
-    mp3d_synth_pair(dstl, nch, lins + 4*15);
-    mp3d_synth_pair(dstl + 32*nch, nch, lins + 4*15 + 64);
+    mp3d_gain g0 = ramp.g, g16 = ramp.g + ramp.step*16;
+    mp3d_gain g32 = ramp.g + ramp.step*32, g48 = ramp.g + ramp.step*48;
+    mp3d_synth_pair(dstr, nch, lins + 4*15 + 1, g0, g16);
+    mp3d_synth_pair(dstr + 32*nch, nch, lins + 4*15 + 64 + 1, g32, g48);
+    mp3d_synth_pair(dstl, nch, lins + 4*15, g0, g16);
+    mp3d_synth_pair(dstl + 32*nch, nch, lins + 4*15 + 64, g32, g48);
 
 #if HAVE_SIMD
-    if (have_simd()) for (i = 14; i >= 0; i--)
+    /* Gains of the lanes of a (frames 15 - i, 47 - i) and b (17 + i, 49 + i) */
+    float ga_init[4], gb_init[4];
+    ga_init[0] = ga_init[1] = ramp.g + ramp.step*(15 - 14);
+    ga_init[2] = ga_init[3] = ramp.g + ramp.step*(47 - 14);
+    gb_init[0] = gb_init[1] = ramp.g + ramp.step*(17 + 14);
+    gb_init[2] = gb_init[3] = ramp.g + ramp.step*(49 + 14);
+    f4 ga = VLD(ga_init), gb = VLD(gb_init), gstep = VSET(ramp.step);
+    if (have_simd()) for (i = 14; i >= 0; i--, ga = VADD(ga, gstep), gb = VSUB(gb, gstep))
     {
 #define VLOAD(k) f4 w0 = VSET(*w++); f4 w1 = VSET(*w++); f4 vz = VLD(&zlin[4*i - 64*k]); f4 vy = VLD(&zlin[4*i - 64*(15 - k)]);
 #define V0(k) { VLOAD(k) b =         VADD(VMUL(vz, w1), VMUL(vy, w0)) ; a =         VSUB(VMUL(vz, w0), VMUL(vy, w1));  }
@@ -1535,9 +1817,20 @@ static void mp3d_synth(float *xl, mp3d_sample_t *dstl, int nch, float *lins)
 
         V0(0) V2(1) V1(2) V2(3) V1(4) V2(5) V1(6) V2(7)
 
+        a = VMUL(a, ga);
+        b = VMUL(b, gb);
         {
 #ifndef MINIMP3_FLOAT_OUTPUT
-#if HAVE_SSE
+#if HAVE_GENERIC_SIMD
+            dstr[(15 - i)*nch] = mp3d_scale_pcm(a[1]);
+            dstr[(17 + i)*nch] = mp3d_scale_pcm(b[1]);
+            dstl[(15 - i)*nch] = mp3d_scale_pcm(a[0]);
+            dstl[(17 + i)*nch] = mp3d_scale_pcm(b[0]);
+            dstr[(47 - i)*nch] = mp3d_scale_pcm(a[3]);
+            dstr[(49 + i)*nch] = mp3d_scale_pcm(b[3]);
+            dstl[(47 - i)*nch] = mp3d_scale_pcm(a[2]);
+            dstl[(49 + i)*nch] = mp3d_scale_pcm(b[2]);
+#elif HAVE_SSE
             static const f4 g_max = { 32767.0f, 32767.0f, 32767.0f, 32767.0f };
             static const f4 g_min = { -32768.0f, -32768.0f, -32768.0f, -32768.0f };
             __m128i pcm8 = _mm_packs_epi32(_mm_cvtps_epi32(_mm_max_ps(_mm_min_ps(a, g_max), g_min)),
@@ -1571,7 +1864,16 @@ static void mp3d_synth(float *xl, mp3d_sample_t *dstl, int nch, float *lins)
             static const f4 g_scale = { 1.0f/32768.0f, 1.0f/32768.0f, 1.0f/32768.0f, 1.0f/32768.0f };
             a = VMUL(a, g_scale);
             b = VMUL(b, g_scale);
-#if HAVE_SSE
+#if HAVE_GENERIC_SIMD
+            dstr[(15 - i)*nch] = a[1];
+            dstr[(17 + i)*nch] = b[1];
+            dstl[(15 - i)*nch] = a[0];
+            dstl[(17 + i)*nch] = b[0];
+            dstr[(47 - i)*nch] = a[3];
+            dstr[(49 + i)*nch] = b[3];
+            dstl[(47 - i)*nch] = a[2];
+            dstl[(49 + i)*nch] = b[2];
+#elif HAVE_SSE
             _mm_store_ss(dstr + (15 - i)*nch, _mm_shuffle_ps(a, a, _MM_SHUFFLE(1, 1, 1, 1)));
             _mm_store_ss(dstr + (17 + i)*nch, _mm_shuffle_ps(b, b, _MM_SHUFFLE(1, 1, 1, 1)));
             _mm_store_ss(dstl + (15 - i)*nch, _mm_shuffle_ps(a, a, _MM_SHUFFLE(0, 0, 0, 0)));
@@ -1599,11 +1901,11 @@ static void mp3d_synth(float *xl, mp3d_sample_t *dstl, int nch, float *lins)
 #else /* MINIMP3_ONLY_SIMD */
     for (i = 14; i >= 0; i--)
     {
-#define LOAD(k) float w0 = *w++; float w1 = *w++; float *vz = &zlin[4*i - k*64]; float *vy = &zlin[4*i - (15 - k)*64];
-#define S0(k) { int j; LOAD(k); for (j = 0; j < 4; j++) b[j]  = vz[j]*w1 + vy[j]*w0, a[j]  = vz[j]*w0 - vy[j]*w1; }
-#define S1(k) { int j; LOAD(k); for (j = 0; j < 4; j++) b[j] += vz[j]*w1 + vy[j]*w0, a[j] += vz[j]*w0 - vy[j]*w1; }
-#define S2(k) { int j; LOAD(k); for (j = 0; j < 4; j++) b[j] += vz[j]*w1 + vy[j]*w0, a[j] += vy[j]*w1 - vz[j]*w0; }
-        float a[4], b[4];
+#define LOAD(k) mp3d_coef w0 = *w++; mp3d_coef w1 = *w++; mp3d_real *vz = &zlin[4*i - k*64]; mp3d_real *vy = &zlin[4*i - (15 - k)*64];
+#define S0(k) { int j; LOAD(k); for (j = 0; j < 4; j++) b[j]  = MP3D_MULW(vz[j], w1) + MP3D_MULW(vy[j], w0), a[j]  = MP3D_MULW(vz[j], w0) - MP3D_MULW(vy[j], w1); }
+#define S1(k) { int j; LOAD(k); for (j = 0; j < 4; j++) b[j] += MP3D_MULW(vz[j], w1) + MP3D_MULW(vy[j], w0), a[j] += MP3D_MULW(vz[j], w0) - MP3D_MULW(vy[j], w1); }
+#define S2(k) { int j; LOAD(k); for (j = 0; j < 4; j++) b[j] += MP3D_MULW(vz[j], w1) + MP3D_MULW(vy[j], w0), a[j] += MP3D_MULW(vy[j], w1) - MP3D_MULW(vz[j], w0); }
+        mp3d_real a[4], b[4];
 
         zlin[4*i]     = xl[18*(31 - i)];
         zlin[4*i + 1] = xr[18*(31 - i)];
@@ -1616,19 +1918,21 @@ static void mp3d_synth(float *xl, mp3d_sample_t *dstl, int nch, float *lins)
 
         S0(0) S2(1) S1(2) S2(3) S1(4) S2(5) S1(6) S2(7)
 
-        dstr[(15 - i)*nch] = mp3d_scale_pcm(a[1]);
-        dstr[(17 + i)*nch] = mp3d_scale_pcm(b[1]);
-        dstl[(15 - i)*nch] = mp3d_scale_pcm(a[0]);
-        dstl[(17 + i)*nch] = mp3d_scale_pcm(b[0]);
-        dstr[(47 - i)*nch] = mp3d_scale_pcm(a[3]);
-        dstr[(49 + i)*nch] = mp3d_scale_pcm(b[3]);
-        dstl[(47 - i)*nch] = mp3d_scale_pcm(a[2]);
-        dstl[(49 + i)*nch] = mp3d_scale_pcm(b[2]);
+        mp3d_gain g15 = ramp.g + ramp.step*(15 - i), g17 = ramp.g + ramp.step*(17 + i);
+        mp3d_gain g47 = g15 + ramp.step*32, g49 = g17 + ramp.step*32;
+        dstr[(15 - i)*nch] = mp3d_scale_pcm(MP3D_GAIN(a[1], g15));
+        dstr[(17 + i)*nch] = mp3d_scale_pcm(MP3D_GAIN(b[1], g17));
+        dstl[(15 - i)*nch] = mp3d_scale_pcm(MP3D_GAIN(a[0], g15));
+        dstl[(17 + i)*nch] = mp3d_scale_pcm(MP3D_GAIN(b[0], g17));
+        dstr[(47 - i)*nch] = mp3d_scale_pcm(MP3D_GAIN(a[3], g47));
+        dstr[(49 + i)*nch] = mp3d_scale_pcm(MP3D_GAIN(b[3], g49));
+        dstl[(47 - i)*nch] = mp3d_scale_pcm(MP3D_GAIN(a[2], g47));
+        dstl[(49 + i)*nch] = mp3d_scale_pcm(MP3D_GAIN(b[2], g49));
     }
 #endif /* MINIMP3_ONLY_SIMD */
 }
 
-static void mp3d_synth_granule(float *qmf_state, float *grbuf, int nbands, int nch, mp3d_sample_t *pcm, float *lins)
+static void mp3d_synth_granule(mp3d_real *qmf_state, mp3d_real *grbuf, int nbands, int nch, mp3d_sample_t *pcm, mp3d_real *lins, mp3d_ramp_t ramp)
 {
     int i;
     for (i = 0; i < nch; i++)
@@ -1636,11 +1940,12 @@ static void mp3d_synth_granule(float *qmf_state, float *grbuf, int nbands, int n
         mp3d_DCT_II(grbuf + 576*i, nbands);
     }
 
-    memcpy(lins, qmf_state, sizeof(float)*15*64);
+    memcpy(lins, qmf_state, sizeof(mp3d_real)*15*64);
 
     for (i = 0; i < nbands; i += 2)
     {
-        mp3d_synth(grbuf + i, pcm + 32*nch*i, nch, lins + i*64);
+        mp3d_ramp_t block = { ramp.g + ramp.step*(32*i), ramp.step };
+        mp3d_synth(grbuf + i, pcm + 32*nch*i, nch, lins + i*64, block);
     }
 #ifndef MINIMP3_NONSTANDARD_BUT_LOGICAL
     if (nch == 1)
@@ -1652,7 +1957,7 @@ static void mp3d_synth_granule(float *qmf_state, float *grbuf, int nbands, int n
     } else
 #endif /* MINIMP3_NONSTANDARD_BUT_LOGICAL */
     {
-        memcpy(qmf_state, lins + nbands*64, sizeof(float)*15*64);
+        memcpy(qmf_state, lins + nbands*64, sizeof(mp3d_real)*15*64);
     }
 }
 
@@ -1712,12 +2017,36 @@ void mp3dec_init(mp3dec_t *dec)
     dec->header[0] = 0;
 }
 
+size_t mp3dec_scratch_size(void)
+{
+    return sizeof(mp3dec_scratch_t);
+}
+
 int mp3dec_decode_frame(mp3dec_t *dec, const uint8_t *mp3, int mp3_bytes, mp3d_sample_t *pcm, mp3dec_frame_info_t *info)
+{
+    mp3dec_scratch_t scratch;
+    return mp3dec_decode_frame_scratch(dec, mp3, mp3_bytes, pcm, info, &scratch, NULL);
+}
+
+static mp3d_ramp_t mp3d_gain_ramp(const mp3dec_gain_t *gain, int frame_samples)
+{
+    mp3d_ramp_t ramp;
+    float start = gain ? gain->start : 1.f, end = gain ? gain->end : 1.f;
+#ifdef MINIMP3_FIXED_POINT
+    ramp.g = (mp3d_gain)(start*(float)(1 << MP3D_GAIN_BITS));
+    ramp.step = (mp3d_gain)((end - start)*(float)(1 << MP3D_GAIN_BITS)/frame_samples);
+#else /* MINIMP3_FIXED_POINT */
+    ramp.g = start;
+    ramp.step = (end - start)/frame_samples;
+#endif /* MINIMP3_FIXED_POINT */
+    return ramp;
+}
+
+int mp3dec_decode_frame_scratch(mp3dec_t *dec, const uint8_t *mp3, int mp3_bytes, mp3d_sample_t *pcm, mp3dec_frame_info_t *info, mp3dec_scratch_t *s, const mp3dec_gain_t *gain)
 {
     int i = 0, igr, frame_size = 0, success = 1;
     const uint8_t *hdr;
     bs_t bs_frame[1];
-    mp3dec_scratch_t scratch;
 
     if (mp3_bytes > 4 && dec->header[0] == 0xff && hdr_compare(dec->header, mp3))
     {
@@ -1752,6 +2081,7 @@ int mp3dec_decode_frame(mp3dec_t *dec, const uint8_t *mp3, int mp3_bytes, mp3d_s
         return hdr_frame_samples(hdr);
     }
 
+    mp3d_ramp_t ramp = mp3d_gain_ramp(gain, hdr_frame_samples(hdr));
     bs_init(bs_frame, hdr + HDR_SIZE, frame_size - HDR_SIZE);
     if (HDR_IS_CRC(hdr))
     {
@@ -1760,23 +2090,25 @@ int mp3dec_decode_frame(mp3dec_t *dec, const uint8_t *mp3, int mp3_bytes, mp3d_s
 
     if (info->layer == 3)
     {
-        int main_data_begin = L3_read_side_info(bs_frame, scratch.gr_info, hdr);
+        int main_data_begin = L3_read_side_info(bs_frame, s->gr_info, hdr);
         if (main_data_begin < 0 || bs_frame->pos > bs_frame->limit)
         {
             mp3dec_init(dec);
             return 0;
         }
-        success = L3_restore_reservoir(dec, bs_frame, &scratch, main_data_begin);
+        success = L3_restore_reservoir(dec, bs_frame, s, main_data_begin);
         if (success)
         {
             for (igr = 0; igr < (HDR_TEST_MPEG1(hdr) ? 2 : 1); igr++, pcm += 576*info->channels)
             {
-                memset(scratch.grbuf[0], 0, 576*2*sizeof(float));
-                L3_decode(dec, &scratch, scratch.gr_info + igr*info->channels, info->channels);
-                mp3d_synth_granule(dec->qmf_state, scratch.grbuf[0], 18, info->channels, pcm, scratch.syn[0]);
+                memset(s->grbuf[0], 0, 576*2*sizeof(mp3d_real));
+                L3_decode(dec, s, s->gr_info + igr*info->channels, info->channels);
+                MINIMP3_ON_SUBBANDS(s->grbuf[0], info->channels);
+                mp3d_ramp_t granule = { ramp.g + ramp.step*(576*igr), ramp.step };
+                mp3d_synth_granule(dec->qmf_state, s->grbuf[0], 18, info->channels, pcm, s->syn[0], granule);
             }
         }
-        L3_save_reservoir(dec, &scratch);
+        L3_save_reservoir(dec, s);
     } else
     {
 #ifdef MINIMP3_ONLY_MP3
@@ -1785,16 +2117,17 @@ int mp3dec_decode_frame(mp3dec_t *dec, const uint8_t *mp3, int mp3_bytes, mp3d_s
         L12_scale_info sci[1];
         L12_read_scale_info(hdr, bs_frame, sci);
 
-        memset(scratch.grbuf[0], 0, 576*2*sizeof(float));
+        memset(s->grbuf[0], 0, 576*2*sizeof(mp3d_real));
         for (i = 0, igr = 0; igr < 3; igr++)
         {
-            if (12 == (i += L12_dequantize_granule(scratch.grbuf[0] + i, bs_frame, sci, info->layer | 1)))
+            if (12 == (i += L12_dequantize_granule(s->grbuf[0] + i, bs_frame, sci, info->layer | 1)))
             {
                 i = 0;
-                L12_apply_scf_384(sci, sci->scf + igr, scratch.grbuf[0]);
-                mp3d_synth_granule(dec->qmf_state, scratch.grbuf[0], 12, info->channels, pcm, scratch.syn[0]);
-                memset(scratch.grbuf[0], 0, 576*2*sizeof(float));
+                L12_apply_scf_384(sci, sci->scf + igr, s->grbuf[0]);
+                mp3d_synth_granule(dec->qmf_state, s->grbuf[0], 12, info->channels, pcm, s->syn[0], ramp);
+                memset(s->grbuf[0], 0, 576*2*sizeof(mp3d_real));
                 pcm += 384*info->channels;
+                ramp.g += ramp.step*384;
             }
             if (bs_frame->pos > bs_frame->limit)
             {
@@ -1811,7 +2144,7 @@ int mp3dec_decode_frame(mp3dec_t *dec, const uint8_t *mp3, int mp3_bytes, mp3d_s
 void mp3dec_f32_to_s16(const float *in, int16_t *out, int num_samples)
 {
     int i = 0;
-#if HAVE_SIMD
+#if HAVE_SIMD && !HAVE_GENERIC_SIMD
     int aligned_count = num_samples & ~7;
     for(; i < aligned_count; i += 8)
     {
@@ -1847,7 +2180,7 @@ void mp3dec_f32_to_s16(const float *in, int16_t *out, int num_samples)
         vst1_lane_s16(out+i+7, pcmb, 3);
 #endif /* HAVE_SSE */
     }
-#endif /* HAVE_SIMD */
+#endif /* HAVE_SIMD && !HAVE_GENERIC_SIMD */
     for(; i < num_samples; i++)
     {
         float sample = in[i] * 32768.0f;
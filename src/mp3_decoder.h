@@ -0,0 +1,26 @@
+// SPDX-License-Identifier: MIT
+// Music Player Plugin - MP3 Decoder Configuration
+// minimp3 build options, shared by every file that includes minimp3.h so they
+// agree on the decoder state layout. audio.c defines MINIMP3_IMPLEMENTATION.
+//
+// The ESP32-P4 has no SSE/NEON and PIE has no float lanes, so use minimp3's
+// 4-wide vector-extension backend there (MUSICPLAYER_SCALAR_MP3 selects plain scalar)
+// MUSICPLAYER_GENERIC_SIMD selects that backend on other targets too, so host
+// builds can check it against scalar
+// MUSICPLAYER_FIXED_POINT selects the integer-only decoder for low-power playback
+// The dequantization, IMDCT and synthesis tables go to internal SRAM (mem.h)
+
+#pragma once
+
+#include "mem.h"
+
+#define MINIMP3_ONLY_MP3
+#if defined(MUSICPLAYER_FIXED_POINT)
+#define MINIMP3_FIXED_POINT
+#elif defined(MUSICPLAYER_SCALAR_MP3)
+#define MINIMP3_NO_SIMD
+#elif defined(MUSICPLAYER_GENERIC_SIMD) || defined(__riscv)
+#define MINIMP3_GENERIC_SIMD
+#endif
+#define MINIMP3_HOT_DATA MEM_HOT_DATA
+#include "minimp3.h"
@@ -0,0 +1,199 @@
+// SPDX-License-Identifier: MIT
+// Music Player Plugin - MP3 Stream Info
+
+#include "mp3_info.h"
+#include <string.h>
+
+// Layer III bitrates in kbps, [MPEG-1, MPEG-2/2.5][index]
+static const uint16_t g_bitrates[2][15] = {
+    { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 },
+    { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 },
+};
+
+static const uint32_t g_sample_rates[3] = { 44100, 48000, 32000 };
+
+typedef struct {
+    bool mpeg1;
+    bool mono;
+    bool crc;
+    uint32_t sample_rate;
+    uint32_t bitrate_kbps;
+    size_t frame_bytes;
+} frame_header_t;
+
+static uint32_t read_be32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint32_t read_be(const uint8_t* p, int bytes) {
+    uint32_t v = 0;
+    for (int i = 0; i < bytes; i++) v = (v << 8) | p[i];
+    return v;
+}
+
+// Decode a Layer III frame header; free-format frames are not accepted
+static bool parse_header(const uint8_t* h, frame_header_t* out) {
+    if (h[0] != 0xFF || (h[1] & 0xE0) != 0xE0) return false;
+
+    int version = (h[1] >> 3) & 3;   // 0 = MPEG-2.5, 2 = MPEG-2, 3 = MPEG-1
+    int layer = (h[1] >> 1) & 3;     // 1 = Layer III
+    int bitrate_index = h[2] >> 4;
+    int rate_index = (h[2] >> 2) & 3;
+    if (version == 1 || layer != 1 || bitrate_index == 0 || bitrate_index == 15 || rate_index == 3) {
+        return false;
+    }
+
+    out->mpeg1 = (version == 3);
+    out->mono = ((h[3] >> 6) == 3);
+    out->crc = !(h[1] & 1);
+    out->sample_rate = g_sample_rates[rate_index] >> (version == 3 ? 0 : (version == 2 ? 1 : 2));
+
+    out->bitrate_kbps = g_bitrates[out->mpeg1 ? 0 : 1][bitrate_index];
+    out->frame_bytes = (out->mpeg1 ? 144 : 72) * out->bitrate_kbps * 1000u / out->sample_rate + ((h[2] >> 1) & 1);
+    return true;
+}
+
+size_t mp3_info_frame_bytes(const uint8_t* h, uint32_t* sample_rate) {
+    frame_header_t hdr;
+    if (!parse_header(h, &hdr)) return 0;
+    if (sample_rate) *sample_rate = hdr.sample_rate;
+    return hdr.frame_bytes;
+}
+
+size_t mp3_info_id3v2_size(const uint8_t* buf, size_t len) {
+    if (len < 10 || memcmp(buf, "ID3", 3) != 0) return 0;
+    // Sizes are syncsafe: 7 bits per byte
+    if ((buf[6] | buf[7] | buf[8] | buf[9]) & 0x80) return 0;
+    size_t size = ((size_t)buf[6] << 21) | ((size_t)buf[7] << 14) | ((size_t)buf[8] << 7) | buf[9];
+    size += 10;
+    if (buf[5] & 0x10) size += 10;  // Footer present
+    return size;
+}
+
+// Xing/Info tag, optionally followed by the LAME extension
+static void parse_xing(const uint8_t* tag, const uint8_t* end, mp3_info_t* info) {
+    uint32_t flags = read_be32(tag + 4);
+    const uint8_t* p = tag + 8;
+
+    if (flags & 1) {
+        if (p + 4 > end) return;
+        info->total_frames = read_be32(p);
+        p += 4;
+    }
+    if (flags & 2) {
+        if (p + 4 > end) return;
+        info->total_bytes = read_be32(p);
+        p += 4;
+    }
+    if (flags & 4) {
+        if (p + MP3_TOC_ENTRIES > end) return;
+        memcpy(info->toc, p, MP3_TOC_ENTRIES);
+        info->has_toc = info->total_frames > 0 && info->total_bytes > 0;
+        p += MP3_TOC_ENTRIES;
+    }
+    if (flags & 8) p += 4;    // VBR quality
+
+    // LAME extension: 9 byte encoder version, peak (9.23 fixed point) at
+    // offset 11, radio (track) gain at 15, delay/padding at 21
+    if (p + 24 <= end && p[0] != 0) {
+        // Gain field: 3 bit name (1 = radio), 3 bit originator (0 = not set),
+        // sign and 9 bits of 0.1 dB
+        uint32_t gain = read_be(p + 15, 2);
+        if ((gain >> 13) == 1 && ((gain >> 10) & 7) != 0) {
+            int tenths = (int)(gain & 0x1FF);
+            info->replaygain.gain_db = (float)((gain & 0x200) ? -tenths : tenths) / 10.0f;
+            info->replaygain.peak = (float)read_be32(p + 11) / (float)(1 << 23);
+            info->replaygain.valid = true;
+        }
+
+        uint32_t delay = ((uint32_t)p[21] << 4) | (p[22] >> 4);
+        uint32_t padding = ((uint32_t)(p[22] & 0x0F) << 8) | p[23];
+        info->trim_start = delay + MP3_DECODER_DELAY;
+        info->trim_end = padding > MP3_DECODER_DELAY ? padding - MP3_DECODER_DELAY : 0;
+    }
+}
+
+// VBRI tag: convert its per-block byte table into a Xing-style percent TOC
+static void parse_vbri(const uint8_t* tag, const uint8_t* end, mp3_info_t* info) {
+    info->total_bytes = read_be32(tag + 10);
+    info->total_frames = read_be32(tag + 14);
+
+    uint32_t entries = read_be(tag + 18, 2);
+    uint32_t scale = read_be(tag + 20, 2);
+    uint32_t entry_bytes = read_be(tag + 22, 2);
+    uint32_t frames_per_entry = read_be(tag + 24, 2);
+    const uint8_t* table = tag + 26;
+    if (entries == 0 || entry_bytes < 1 || entry_bytes > 4 || frames_per_entry == 0 ||
+        info->total_frames == 0 || info->total_bytes == 0 ||
+        table + (size_t)entries * entry_bytes > end) {
+        return;
+    }
+
+    // Walk the table once; block k starts at frame k * frames_per_entry
+    uint32_t block = 0;
+    uint64_t block_pos = 0;
+    uint64_t block_len = (uint64_t)read_be(table, entry_bytes) * scale;
+    for (int i = 0; i < MP3_TOC_ENTRIES; i++) {
+        uint64_t frame = (uint64_t)info->total_frames * i / MP3_TOC_ENTRIES;
+        while (block + 1 < entries && frame >= (uint64_t)(block + 1) * frames_per_entry) {
+            block_pos += block_len;
+            block++;
+            block_len = (uint64_t)read_be(table + (size_t)block * entry_bytes, entry_bytes) * scale;
+        }
+        uint64_t in_block = frame - (uint64_t)block * frames_per_entry;
+        if (in_block > frames_per_entry) in_block = frames_per_entry;
+        uint64_t pos = block_pos + block_len * in_block / frames_per_entry;
+        uint64_t scaled = pos * 256 / info->total_bytes;
+        info->toc[i] = (uint8_t)(scaled > 255 ? 255 : scaled);
+    }
+    info->has_toc = true;
+}
+
+int mp3_info_parse(const uint8_t* buf, size_t len, mp3_info_t* info) {
+    memset(info, 0, sizeof(*info));
+
+    frame_header_t hdr;
+    size_t pos;
+    for (pos = 0; pos + 4 <= len; pos++) {
+        if (!parse_header(buf + pos, &hdr)) continue;
+        // Require the next header to match when it is in the buffer
+        size_t next = pos + hdr.frame_bytes;
+        frame_header_t next_hdr;
+        if (next + 4 <= len && (!parse_header(buf + next, &next_hdr) ||
+                                next_hdr.sample_rate != hdr.sample_rate)) {
+            continue;
+        }
+        break;
+    }
+    if (pos + 4 > len) return -1;
+
+    const uint8_t* frame = buf + pos;
+    const uint8_t* end = frame + hdr.frame_bytes;
+    if (end > buf + len) end = buf + len;
+
+    info->sample_rate = hdr.sample_rate;
+    info->channels = hdr.mono ? 1 : 2;
+    info->samples_per_frame = hdr.mpeg1 ? 1152 : 576;
+    info->bitrate_kbps = hdr.bitrate_kbps;
+    info->frame_offset = pos;
+
+    // VBR tags sit right after the side info of the first frame
+    size_t side_info = hdr.mpeg1 ? (hdr.mono ? 17 : 32) : (hdr.mono ? 9 : 17);
+    const uint8_t* tag = frame + 4 + (hdr.crc ? 2 : 0) + side_info;
+    const uint8_t* vbri = frame + 4 + 32;
+
+    if (tag + 8 <= end && (memcmp(tag, "Xing", 4) == 0 || memcmp(tag, "Info", 4) == 0)) {
+        info->tag_frame_bytes = hdr.frame_bytes;
+        parse_xing(tag, end, info);
+    } else if (vbri + 26 <= end && memcmp(vbri, "VBRI", 4) == 0) {
+        info->tag_frame_bytes = hdr.frame_bytes;
+        parse_vbri(vbri, end, info);
+    }
+
+    if (info->total_frames) {
+        uint64_t samples = (uint64_t)info->total_frames * info->samples_per_frame;
+        uint64_t trim = (uint64_t)info->trim_start + info->trim_end;
+        info->total_samples = samples > trim ? samples - trim : 0;
+    }
+    return 0;
+}
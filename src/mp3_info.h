@@ -0,0 +1,51 @@
+// SPDX-License-Identifier: MIT
+// Music Player Plugin - MP3 Stream Info
+// Parses the first frame header of a stream and its Xing/Info/VBRI tag,
+// including the LAME encoder delay/padding used for gapless playback and the
+// ReplayGain track gain of the LAME tag.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Decoder delay of a Layer III decoder, in samples (528 + 1 as in LAME)
+#define MP3_DECODER_DELAY  529
+
+// Entries in a Xing-style seek table (one per percent of the duration)
+#define MP3_TOC_ENTRIES    100
+
+typedef struct {
+    bool valid;
+    float gain_db;      // Track gain to the ReplayGain reference level
+    float peak;         // Track peak, 1.0 is full scale; 0 if unknown
+} mp3_replaygain_t;
+
+typedef struct {
+    uint32_t sample_rate;
+    int channels;
+    uint32_t samples_per_frame;  // 1152 (MPEG-1) or 576 (MPEG-2/2.5)
+    uint32_t bitrate_kbps;       // Bitrate of the first frame
+    size_t frame_offset;         // Offset of the first frame header in the buffer
+    size_t tag_frame_bytes;      // Size of the Xing/Info/VBRI frame, 0 if none
+    uint32_t total_frames;       // Audio frames from the VBR tag, 0 if unknown
+    uint32_t total_bytes;        // Stream bytes from the VBR tag, 0 if unknown
+    uint32_t trim_start;         // Samples per channel to drop at the start
+    uint32_t trim_end;           // Samples per channel to drop at the end
+    uint64_t total_samples;      // Samples per channel after trimming, 0 if unknown
+    bool has_toc;                // toc is valid (needs total_frames and total_bytes)
+    uint8_t toc[MP3_TOC_ENTRIES];  // Byte position of each percent, in 1/256 of total_bytes
+    mp3_replaygain_t replaygain;   // From the LAME tag
+} mp3_info_t;
+
+// Size of an ID3v2 tag starting at buf (header, footer included), 0 if none
+size_t mp3_info_id3v2_size(const uint8_t* buf, size_t len);
+
+// Size in bytes of the Layer III frame whose header is at h, 0 if h is not one
+// sample_rate may be NULL
+size_t mp3_info_frame_bytes(const uint8_t* h, uint32_t* sample_rate);
+
+// Find the first Layer III frame in buf and parse it (and any VBR tag in it)
+// Returns 0 on success, -1 if no frame header was found
+int mp3_info_parse(const uint8_t* buf, size_t len, mp3_info_t* info);
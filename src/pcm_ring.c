@@ -0,0 +1,186 @@
+// SPDX-License-Identifier: MIT
+// Music Player Plugin - PCM Ring Buffer
+// Decoder thread writes whole frames into slots; output thread drains them to I2S
+
+#include "pcm_ring.h"
+#include "thread_util.h"
+#include <pthread.h>
+#include <errno.h>
+#include <string.h>
+
+// Slot storage in internal SRAM for DMA (16-byte aligned)
+static int16_t g_slot_storage[PCM_RING_FRAMES][PCM_RING_SLOT_SAMPLES] __attribute__((aligned(16)));
+static pcm_slot_t g_slots[PCM_RING_FRAMES];
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_cond_space = PTHREAD_COND_INITIALIZER;  // Signalled when a slot is freed
+static pthread_cond_t g_cond_data = PTHREAD_COND_INITIALIZER;   // Signalled when a slot is filled
+static pthread_cond_t g_cond_drained = PTHREAD_COND_INITIALIZER;  // Signalled when the fill reaches g_drain_slots
+
+// Monotonic slot counters; index = counter % PCM_RING_FRAMES
+static uint32_t g_write_count = 0;
+static uint32_t g_read_count = 0;
+
+// Consumer is between begin_read and end_read
+static bool g_reading = false;
+// Bumped by flush so a release of a dropped slot does not advance the read counter
+static uint32_t g_generation = 0;
+static uint32_t g_read_generation = 0;
+
+// Fill level a producer in pcm_ring_wait_fill() waits for (-1: none waits),
+// and a count bumped by pcm_ring_wake() to end that wait early
+static int g_drain_slots = -1;
+static uint32_t g_wake_count = 0;
+
+void pcm_ring_init(void) {
+    pthread_mutex_lock(&g_lock);
+    for (int i = 0; i < PCM_RING_FRAMES; i++) {
+        g_slots[i].samples = g_slot_storage[i];
+        g_slots[i].bytes = 0;
+        g_slots[i].frames = 0;
+        g_slots[i].rate = 0;
+        g_slots[i].track = 0;
+        g_slots[i].has_bands = false;
+    }
+    g_write_count = 0;
+    g_read_count = 0;
+    g_reading = false;
+    g_generation++;
+    pthread_mutex_unlock(&g_lock);
+}
+
+void pcm_ring_cleanup(void) {
+    pthread_mutex_lock(&g_lock);
+    g_write_count = 0;
+    g_read_count = 0;
+    g_reading = false;
+    g_generation++;
+    g_wake_count++;
+    pthread_cond_broadcast(&g_cond_space);
+    pthread_cond_broadcast(&g_cond_data);
+    pthread_cond_broadcast(&g_cond_drained);
+    pthread_mutex_unlock(&g_lock);
+}
+
+int16_t* pcm_ring_begin_write(uint32_t timeout_ms) {
+    int16_t* slot = NULL;
+
+    pthread_mutex_lock(&g_lock);
+    if (g_write_count - g_read_count >= PCM_RING_FRAMES) {
+        cond_wait_ms(&g_cond_space, &g_lock, timeout_ms);
+    }
+    if (g_write_count - g_read_count < PCM_RING_FRAMES) {
+        slot = g_slot_storage[g_write_count % PCM_RING_FRAMES];
+    }
+    pthread_mutex_unlock(&g_lock);
+
+    return slot;
+}
+
+void pcm_ring_end_write(uint32_t first, uint32_t frames, int channels, uint32_t rate, uint32_t track,
+                        const uint16_t* bands) {
+    pthread_mutex_lock(&g_lock);
+    unsigned index = g_write_count % PCM_RING_FRAMES;
+    pcm_slot_t* slot = &g_slots[index];
+    slot->samples = g_slot_storage[index] + first * channels;
+    slot->frames = frames;
+    slot->bytes = frames * channels * sizeof(int16_t);
+    slot->rate = rate;
+    slot->track = track;
+    slot->has_bands = bands != NULL;
+    if (bands) memcpy(slot->bands, bands, sizeof(slot->bands));
+    g_write_count++;
+    pthread_cond_signal(&g_cond_data);
+    pthread_mutex_unlock(&g_lock);
+}
+
+// Wake a producer waiting for the fill to drop, once it has (lock held)
+static void signal_drained(void) {
+    if (g_drain_slots >= 0 && g_write_count - g_read_count <= (uint32_t)g_drain_slots) {
+        pthread_cond_signal(&g_cond_drained);
+    }
+}
+
+const pcm_slot_t* pcm_ring_begin_read(uint32_t timeout_ms) {
+    const pcm_slot_t* slot = NULL;
+
+    pthread_mutex_lock(&g_lock);
+    if (g_write_count == g_read_count) {
+        cond_wait_ms(&g_cond_data, &g_lock, timeout_ms);
+    }
+    if (g_write_count != g_read_count) {
+        slot = &g_slots[g_read_count % PCM_RING_FRAMES];
+        g_reading = true;
+        g_read_generation = g_generation;
+    }
+    pthread_mutex_unlock(&g_lock);
+
+    return slot;
+}
+
+void pcm_ring_end_read(void) {
+    pthread_mutex_lock(&g_lock);
+    if (g_reading && g_read_generation == g_generation) {
+        g_read_count++;
+    }
+    g_reading = false;
+    pthread_cond_broadcast(&g_cond_space);
+    signal_drained();
+    pthread_mutex_unlock(&g_lock);
+}
+
+void pcm_ring_flush(void) {
+    pthread_mutex_lock(&g_lock);
+    g_read_count = g_write_count;
+    g_generation++;
+    // asp_audio_write has a 500ms timeout, so the in-flight slot is bounded
+    while (g_reading) {
+        if (cond_wait_ms(&g_cond_space, &g_lock, 600) == ETIMEDOUT) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_lock);
+}
+
+bool pcm_ring_wait_fill(unsigned slots, uint32_t timeout_ms) {
+    pthread_mutex_lock(&g_lock);
+    // Only the drain to slots (or a wake) signals this, not every freed slot,
+    // so the producer sleeps through the whole drain
+    struct timespec deadline = deadline_ms(timeout_ms);
+    uint32_t wakes = g_wake_count;
+    g_drain_slots = (int)slots;
+    while (g_write_count - g_read_count > slots && g_wake_count == wakes) {
+        if (pthread_cond_timedwait(&g_cond_drained, &g_lock, &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    g_drain_slots = -1;
+    bool drained = (g_write_count - g_read_count <= slots);
+    pthread_mutex_unlock(&g_lock);
+    return drained;
+}
+
+bool pcm_ring_wait_empty(uint32_t timeout_ms) {
+    pthread_mutex_lock(&g_lock);
+    if (g_write_count != g_read_count || g_reading) {
+        cond_wait_ms(&g_cond_space, &g_lock, timeout_ms);
+    }
+    bool empty = (g_write_count == g_read_count) && !g_reading;
+    pthread_mutex_unlock(&g_lock);
+    return empty;
+}
+
+void pcm_ring_wake(void) {
+    pthread_mutex_lock(&g_lock);
+    g_wake_count++;
+    pthread_cond_broadcast(&g_cond_space);
+    pthread_cond_broadcast(&g_cond_drained);
+    pthread_mutex_unlock(&g_lock);
+}
+
+unsigned pcm_ring_fill(void) {
+    pthread_mutex_lock(&g_lock);
+    unsigned fill = g_write_count - g_read_count;
+    pthread_mutex_unlock(&g_lock);
+    return fill;
+}
@@ -0,0 +1,79 @@
+// SPDX-License-Identifier: MIT
+// Music Player Plugin - PCM Ring Buffer
+// Single-producer (decoder thread) / single-consumer (output thread) ring of
+// decoded MP3 frames, so a slow frame or SD stall does not starve I2S.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Number of frame slots in the ring (4-16). 8 slots is ~200ms of audio at 44.1kHz.
+#ifndef PCM_RING_FRAMES
+#define PCM_RING_FRAMES 8
+#endif
+
+#if PCM_RING_FRAMES < 2 || PCM_RING_FRAMES > 16
+#error "PCM_RING_FRAMES must be between 2 and 16"
+#endif
+
+// Capacity of one slot in samples (one stereo MP3 frame)
+#define PCM_RING_SLOT_SAMPLES (1152 * 2)
+
+// Coarse spectrum bands a slot can carry (see tap.h)
+#define PCM_RING_BANDS 8
+
+// One decoded frame waiting for output
+typedef struct {
+    int16_t* samples;    // Interleaved PCM
+    size_t bytes;        // Bytes of valid PCM in samples
+    uint32_t frames;     // Sample frames (samples per channel)
+    uint32_t rate;       // Sample rate of this frame
+    uint32_t track;      // Track serial, changes at song boundaries
+    bool has_bands;      // The decoder reported the frame's spectrum
+    uint16_t bands[PCM_RING_BANDS];  // Share of the frame's energy per band (Q16)
+} pcm_slot_t;
+
+// Initialize the ring (storage is static in internal SRAM)
+void pcm_ring_init(void);
+
+// Reset the ring and wake any waiters
+void pcm_ring_cleanup(void);
+
+// Get the next free slot to decode into
+// Blocks up to timeout_ms for space; returns NULL on timeout
+int16_t* pcm_ring_begin_write(uint32_t timeout_ms);
+
+// Publish the slot returned by pcm_ring_begin_write()
+// Output starts at sample frame first of the slot (after dropped samples);
+// bands is the frame's PCM_RING_BANDS energy shares, NULL if not known
+void pcm_ring_end_write(uint32_t first, uint32_t frames, int channels, uint32_t rate, uint32_t track,
+                        const uint16_t* bands);
+
+// Get the oldest filled slot for output
+// Blocks up to timeout_ms for data; returns NULL on timeout
+const pcm_slot_t* pcm_ring_begin_read(uint32_t timeout_ms);
+
+// Release the slot returned by pcm_ring_begin_read()
+void pcm_ring_end_read(void);
+
+// Drop all queued frames and wait for an in-flight write to I2S to finish
+// Only call from the producer side
+void pcm_ring_flush(void);
+
+// Wait until no more than slots frames are queued, sleeping through the
+// frames freed on the way there (pcm_ring_wake() ends the wait early)
+// Returns true if the fill level got there within timeout_ms
+bool pcm_ring_wait_fill(unsigned slots, uint32_t timeout_ms);
+
+// Wait until all queued frames have been written out
+// Returns true if the ring drained within timeout_ms
+bool pcm_ring_wait_empty(uint32_t timeout_ms);
+
+// Wake a producer blocked in pcm_ring_begin_write(), pcm_ring_wait_fill() or pcm_ring_wait_empty()
+// so it re-checks its control state before the timeout
+void pcm_ring_wake(void);
+
+// Number of filled slots
+unsigned pcm_ring_fill(void);
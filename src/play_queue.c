@@ -0,0 +1,329 @@
+// SPDX-License-Identifier: MIT
+// Music Player Plugin - Play Queue
+// Songs are visited through an order: the playlist itself, or g_order when
+// shuffling. g_cursor is the position of the current song in that order, or of
+// the song before it while a song from the up-next queue plays.
+
+#include "play_queue.h"
+#include "playlist.h"
+#include "stats.h"
+#include "../include/music_player.h"
+#include "tanmatsu_plugin.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+// Initial size of the shuffle order (doubles when the library grows past it)
+#define INITIAL_ORDER       64
+
+// Previous goes back a song only this early in the current one
+#define PREV_RESTART_MS     10000
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static bool g_shuffle = false;
+static play_queue_repeat_t g_repeat = PLAY_QUEUE_REPEAT_ALL;
+
+// Shuffle order: playlist indices, g_order[g_cursor] is the current song
+static int* g_order = NULL;
+static int g_order_count = 0;
+static int g_order_capacity = 0;
+static int g_cursor = 0;
+static int g_wrap_first = -1;       // First song of the next shuffle round, -1 until peeked
+
+// Up-next queue (ring)
+static int g_up_next[PLAY_QUEUE_UP_NEXT_MAX];
+static int g_up_next_head = 0;
+static int g_up_next_count = 0;
+static bool g_from_up_next = false;  // The current song came from the up-next queue
+
+// Songs played before the current one, newest last (ring, oldest overwritten)
+static int g_history[PLAY_QUEUE_HISTORY_MAX];
+static int g_history_end = 0;
+static int g_history_count = 0;
+
+static uint32_t g_rng = 1;
+static char g_next_path[256];
+
+// Pseudo-random number below n (xorshift32)
+static int random_below(int n) {
+    g_rng ^= g_rng << 13;
+    g_rng ^= g_rng >> 17;
+    g_rng ^= g_rng << 5;
+    return (int)(g_rng % (uint32_t)n);
+}
+
+static int song_count(void) {
+    return music_player_get_state()->playlist.count;
+}
+
+// Playlist index of the song at position pos of the order (lock held)
+static int order_song(int pos) {
+    return g_shuffle ? g_order[pos] : pos;
+}
+
+// Shuffle songs the library scan added since the order was made into the
+// part of it that is still to come (lock held)
+// Returns 0 on success, -1 if out of memory
+static int sync_order(void) {
+    int count = song_count();
+    if (!g_shuffle || count <= g_order_count) return 0;
+
+    if (count > g_order_capacity) {
+        int capacity = g_order_capacity ? g_order_capacity : INITIAL_ORDER;
+        while (capacity < count) capacity *= 2;
+        int* grown = (int*)realloc(g_order, capacity * sizeof(int));
+        if (!grown) return -1;
+        g_order = grown;
+        g_order_capacity = capacity;
+    }
+
+    for (int n = g_order_count; n < count; n++) {
+        // Inside-out Fisher-Yates over positions after the cursor
+        int first = (g_cursor + 1 < n) ? g_cursor + 1 : n;
+        int pos = first + random_below(n - first + 1);
+        g_order[n] = g_order[pos];
+        g_order[pos] = n;
+    }
+    g_order_count = count;
+    return 0;
+}
+
+// Shuffle all songs into a new order starting with first (lock held)
+static void shuffle_order(int first) {
+    for (int i = 0; i < g_order_count; i++) {
+        g_order[i] = i;
+    }
+    if (first >= 0 && first < g_order_count) {
+        g_order[0] = first;
+        g_order[first] = 0;
+    }
+    for (int i = g_order_count - 1; i > 1; i--) {
+        int j = 1 + random_below(i);
+        int swap = g_order[i];
+        g_order[i] = g_order[j];
+        g_order[j] = swap;
+    }
+    g_cursor = 0;
+    g_wrap_first = -1;
+}
+
+// Rebuild the order for the current shuffle setting around the current song (lock held)
+// Returns 0 on success, -1 if out of memory
+static int build_order(void) {
+    int current = music_player_get_state()->playlist.current_index;
+
+    g_wrap_first = -1;
+    if (!g_shuffle) {
+        g_cursor = current;
+        return 0;
+    }
+
+    g_order_count = 0;
+    g_cursor = 0;
+    if (sync_order() != 0) return -1;
+    shuffle_order(current);
+    return 0;
+}
+
+// The song following the current one, -1 if none (lock held)
+static int peek_next(bool manual) {
+    music_player_state_t* state = music_player_get_state();
+    int count = song_count();
+    if (count == 0) return -1;
+
+    if (g_repeat == PLAY_QUEUE_REPEAT_ONE && !manual) return state->playlist.current_index;
+    if (g_up_next_count > 0) return g_up_next[g_up_next_head];
+    if (g_cursor + 1 < count) return order_song(g_cursor + 1);
+    if (g_repeat == PLAY_QUEUE_REPEAT_OFF) return -1;
+    if (!g_shuffle) return 0;
+
+    // Choose the next round's first song now, so what is peeked is what plays
+    if (g_wrap_first < 0) {
+        g_wrap_first = random_below(count);
+        if (count > 1 && g_wrap_first == state->playlist.current_index) {
+            g_wrap_first = (g_wrap_first + 1 + random_below(count - 1)) % count;
+        }
+    }
+    return g_wrap_first;
+}
+
+static void push_history(int index) {
+    g_history[g_history_end] = index;
+    g_history_end = (g_history_end + 1) % PLAY_QUEUE_HISTORY_MAX;
+    if (g_history_count < PLAY_QUEUE_HISTORY_MAX) g_history_count++;
+}
+
+static int pop_history(void) {
+    if (g_history_count == 0) return -1;
+    g_history_end = (g_history_end + PLAY_QUEUE_HISTORY_MAX - 1) % PLAY_QUEUE_HISTORY_MAX;
+    g_history_count--;
+    return g_history[g_history_end];
+}
+
+// Put index in front of the up-next queue, so the next song returns to it
+static void push_up_next_front(int index) {
+    if (g_up_next_count == PLAY_QUEUE_UP_NEXT_MAX) return;
+    g_up_next_head = (g_up_next_head + PLAY_QUEUE_UP_NEXT_MAX - 1) % PLAY_QUEUE_UP_NEXT_MAX;
+    g_up_next[g_up_next_head] = index;
+    g_up_next_count++;
+}
+
+int play_queue_init(bool shuffle, play_queue_repeat_t repeat) {
+    g_rng = (uint32_t)stats_now_us() | 1;
+
+    pthread_mutex_lock(&g_lock);
+    g_shuffle = shuffle;
+    g_repeat = (repeat < PLAY_QUEUE_REPEAT_COUNT) ? repeat : PLAY_QUEUE_REPEAT_ALL;
+    g_up_next_head = 0;
+    g_up_next_count = 0;
+    g_from_up_next = false;
+    g_history_count = 0;
+    int result = build_order();
+    if (result != 0) g_shuffle = false;
+    pthread_mutex_unlock(&g_lock);
+
+    if (result != 0) {
+        asp_log_warn("musicplayer", "Not enough memory to shuffle");
+    }
+    return result;
+}
+
+void play_queue_cleanup(void) {
+    pthread_mutex_lock(&g_lock);
+    free(g_order);
+    g_order = NULL;
+    g_order_count = 0;
+    g_order_capacity = 0;
+    g_shuffle = false;
+    pthread_mutex_unlock(&g_lock);
+}
+
+int play_queue_set_shuffle(bool shuffle) {
+    pthread_mutex_lock(&g_lock);
+    int result = 0;
+    if (shuffle != g_shuffle) {
+        // Leave the order in the current song's place before switching
+        int cursor_song = order_song(g_cursor);
+        g_shuffle = shuffle;
+        if (!shuffle) {
+            g_cursor = cursor_song;
+            g_wrap_first = -1;
+        } else {
+            // The shuffled order starts at the current song, even one from up next
+            g_from_up_next = false;
+            result = build_order();
+            if (result != 0) {
+                g_shuffle = false;
+                g_cursor = cursor_song;
+            }
+        }
+    }
+    pthread_mutex_unlock(&g_lock);
+
+    if (result != 0) {
+        asp_log_warn("musicplayer", "Not enough memory to shuffle");
+    }
+    return result;
+}
+
+bool play_queue_get_shuffle(void) {
+    return g_shuffle;
+}
+
+void play_queue_set_repeat(play_queue_repeat_t repeat) {
+    if (repeat < PLAY_QUEUE_REPEAT_COUNT) g_repeat = repeat;
+}
+
+play_queue_repeat_t play_queue_get_repeat(void) {
+    return g_repeat;
+}
+
+int play_queue_add_up_next(int index) {
+    pthread_mutex_lock(&g_lock);
+    int result = -1;
+    if (index >= 0 && index < song_count() && g_up_next_count < PLAY_QUEUE_UP_NEXT_MAX) {
+        g_up_next[(g_up_next_head + g_up_next_count) % PLAY_QUEUE_UP_NEXT_MAX] = index;
+        g_up_next_count++;
+        result = 0;
+    }
+    pthread_mutex_unlock(&g_lock);
+    return result;
+}
+
+bool play_queue_next(bool manual) {
+    pthread_mutex_lock(&g_lock);
+    bool ok = sync_order() == 0;
+    int next = ok ? peek_next(manual) : -1;
+    if (next >= 0 && !(g_repeat == PLAY_QUEUE_REPEAT_ONE && !manual)) {
+        if (g_up_next_count > 0) {
+            g_up_next_head = (g_up_next_head + 1) % PLAY_QUEUE_UP_NEXT_MAX;
+            g_up_next_count--;
+            g_from_up_next = true;
+        } else {
+            if (g_cursor + 1 < song_count()) {
+                g_cursor++;
+            } else if (g_shuffle) {
+                shuffle_order(next);
+            } else {
+                g_cursor = 0;
+            }
+            g_from_up_next = false;
+        }
+        int current = music_player_get_state()->playlist.current_index;
+        if (next != current) push_history(current);
+        playlist_set_current_index(next);
+    }
+    pthread_mutex_unlock(&g_lock);
+    return next >= 0;
+}
+
+void play_queue_prev_or_restart(uint32_t position_ms) {
+    // Otherwise the caller will just restart the current song
+    if (position_ms >= PREV_RESTART_MS) return;
+
+    pthread_mutex_lock(&g_lock);
+    int count = song_count();
+    int current = music_player_get_state()->playlist.current_index;
+    int prev = pop_history();
+    if (prev >= 0 && !g_from_up_next && g_cursor > 0 && order_song(g_cursor - 1) == prev) {
+        // One step back in the order
+        g_cursor--;
+        g_from_up_next = false;
+    } else if (prev >= 0) {
+        // Back to the song the order is at, or to one from up next or the last
+        // shuffle round: the song left plays next again
+        push_up_next_front(current);
+        g_from_up_next = !(g_from_up_next && order_song(g_cursor) == prev);
+    } else if (g_from_up_next) {
+        // No history (a restart): back to the song the order was at
+        prev = order_song(g_cursor);
+        g_from_up_next = false;
+    } else if (g_cursor > 0) {
+        g_cursor--;
+        prev = order_song(g_cursor);
+    } else if (!g_shuffle && count > 0 && g_repeat != PLAY_QUEUE_REPEAT_OFF) {
+        // The playlist loops
+        g_cursor = count - 1;
+        prev = g_cursor;
+    }
+    if (prev >= 0) {
+        playlist_set_current_index(prev);
+    }
+    pthread_mutex_unlock(&g_lock);
+}
+
+int play_queue_peek_next(void) {
+    pthread_mutex_lock(&g_lock);
+    int next = (sync_order() == 0) ? peek_next(false) : -1;
+    pthread_mutex_unlock(&g_lock);
+    return next;
+}
+
+const char* play_queue_get_next_path(void) {
+    const char* filename = playlist_get_filename(play_queue_peek_next());
+    if (!filename) return NULL;
+
+    snprintf(g_next_path, sizeof(g_next_path), "%s/%s", MUSIC_DIR, filename);
+    return g_next_path;
+}
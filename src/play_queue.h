@@ -0,0 +1,64 @@
+// SPDX-License-Identifier: MIT
+// Music Player Plugin - Play Queue
+// Decides which playlist song plays next: an "up next" queue first, then the
+// playlist in order or in a shuffled order, with repeat modes. The shuffled
+// order is a Fisher-Yates permutation made ahead of time (songs the library
+// scan adds later are shuffled into the part not played yet), so next, previous
+// and peeking at the following song are all O(1), and the song after the
+// current one is known in advance for gapless playback.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Songs that can wait in the "up next" queue
+#define PLAY_QUEUE_UP_NEXT_MAX  16
+
+// Songs previous can step back through (the oldest are forgotten)
+#define PLAY_QUEUE_HISTORY_MAX  32
+
+typedef enum {
+    PLAY_QUEUE_REPEAT_ALL,  // Start over after the last song (reshuffled when shuffling)
+    PLAY_QUEUE_REPEAT_OFF,  // Stop after the last song
+    PLAY_QUEUE_REPEAT_ONE,  // Play the current song again when it ends
+    PLAY_QUEUE_REPEAT_COUNT,
+} play_queue_repeat_t;
+
+// Set up the queue for the playlist, starting at its current song
+// Returns 0 on success, -1 if the shuffle order cannot be allocated
+int play_queue_init(bool shuffle, play_queue_repeat_t repeat);
+
+// Free the queue
+void play_queue_cleanup(void);
+
+// Turn shuffling on or off; the current song stays, the order after it changes
+// Returns 0 on success, -1 if the shuffle order cannot be allocated
+int play_queue_set_shuffle(bool shuffle);
+bool play_queue_get_shuffle(void);
+
+void play_queue_set_repeat(play_queue_repeat_t repeat);
+play_queue_repeat_t play_queue_get_repeat(void);
+
+// Queue playlist song index to play after the current one (before the order
+// continues)
+// Returns 0 on success, -1 if the index is invalid or the queue is full
+int play_queue_add_up_next(int index);
+
+// Make the following song current; manual is true for the user's next key,
+// which leaves a repeated song (but still stops at the end without repeat)
+// Returns false if there is nothing more to play
+bool play_queue_next(bool manual);
+
+// Go to the song played before the current one (from the history, so also
+// across shuffle rounds and to songs that came from up next), or leave it
+// current to be restarted by the caller when position_ms (playback position in
+// the song) is 10 seconds or more
+void play_queue_prev_or_restart(uint32_t position_ms);
+
+// Playlist index of the song play_queue_next(false) would make current, -1 if none
+int play_queue_peek_next(void);
+
+// Full path of play_queue_peek_next(), NULL if none
+// Returns pointer to static buffer - do not free
+const char* play_queue_get_next_path(void);
@@ -1,22 +1,327 @@
 // SPDX-License-Identifier: MIT
 // Music Player Plugin - Playlist Management
+// Song paths (relative to MUSIC_DIR) live in fixed-size name chunks that never
+// move; songs[] is a compact index into them. The library is built by a
+// background walker that appends songs in sorted depth-first order, so the
+// playlist can be used while it is still growing.
 
 #include "playlist.h"
+#include "decoder.h"
+#include "mem.h"
 #include "../include/music_player.h"
 #include "tanmatsu_plugin.h"
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <dirent.h>
 #include <sys/stat.h>
 #include <strings.h>
+#include <pthread.h>
+#include <sched.h>
+
+// Initial size of the song index (doubles when full)
+#define INITIAL_SONGS       64
+
+// Name storage: names never straddle a chunk, so pointers to them stay valid
+#define NAME_CHUNK_SIZE     (16 * 1024)
+#define MAX_NAME_CHUNKS     1024
+
+// Sanity limit for the song count read from the library index
+#define MAX_CACHE_SONGS     (1 << 20)
+
+// Subfolder levels below MUSIC_DIR that are scanned
+#define MAX_SCAN_DEPTH      8
+
+// Same priority as the duration scanner: playback I/O goes first
+#define WALK_STACK_SIZE     (8 * 1024)
+#define WALK_PRIORITY       2
+
+// Library index file: header, the song index, then the name chunks
+#define CACHE_PATH      MUSIC_DIR "/.musicplayer.idx"
+#define CACHE_TMP_PATH  MUSIC_DIR "/.musicplayer.tmp"
+#define CACHE_MAGIC     0x5849504Du  // "MPIX"
+#define CACHE_VERSION   4
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+    uint32_t count;
+    uint32_t names_size;
+    int64_t dir_mtime;   // Modification time of MUSIC_DIR when the index was written
+} cache_header_t;
+
+// Called for each audio file found by walk_dir, with its path relative to MUSIC_DIR
+// Returns false to stop the walk
+typedef bool (*walk_fn_t)(const char* rel_path, void* arg);
 
 static char current_path_buffer[256];
 
-static bool is_mp3_file(const char* filename) {
-    size_t len = strlen(filename);
-    if (len < 4) return false;
-    const char* ext = filename + len - 4;
-    return (strcasecmp(ext, ".mp3") == 0);
+// Guards g_songs, the name chunks and playlist count/current_index updates
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_cond = PTHREAD_COND_INITIALIZER;  // Signalled on each new song and when done
+
+static song_info_t* g_songs = NULL;
+static int g_songs_capacity = 0;
+static char* g_name_chunks[MAX_NAME_CHUNKS];
+static uint32_t g_names_size = 0;   // Offset of the next free name byte
+
+static int64_t g_dir_mtime = 0;
+static bool g_cache_loaded = false;
+
+static pthread_t g_walk_thread;
+static bool g_walk_running = false;
+static bool g_walk_done = false;
+static volatile bool g_walk_should_stop = false;
+
+static const char* name_at(uint32_t offset) {
+    return g_name_chunks[offset / NAME_CHUNK_SIZE] + offset % NAME_CHUNK_SIZE;
+}
+
+static void free_storage(void) {
+    music_player_state_t* state = music_player_get_state();
+
+    free(g_songs);
+    g_songs = NULL;
+    g_songs_capacity = 0;
+    for (int i = 0; i < MAX_NAME_CHUNKS; i++) {
+        free(g_name_chunks[i]);
+        g_name_chunks[i] = NULL;
+    }
+    g_names_size = 0;
+    state->playlist.count = 0;
+    state->playlist.current_index = 0;
+}
+
+// Make room for songs entries and names_size bytes of names (lock held)
+// Returns 0 on success, -1 if out of memory
+static int reserve_storage(int songs, uint32_t names_size) {
+    if (songs > g_songs_capacity) {
+        int capacity = g_songs_capacity ? g_songs_capacity : INITIAL_SONGS;
+        while (capacity < songs) capacity *= 2;
+        // Bulk data in PSRAM, like the names: read per song change, not per frame
+        song_info_t* grown = (song_info_t*)mem_alloc(capacity * sizeof(song_info_t), MEM_PSRAM);
+        if (!grown) return -1;
+        if (g_songs) memcpy(grown, g_songs, g_songs_capacity * sizeof(song_info_t));
+        free(g_songs);
+        g_songs = grown;
+        g_songs_capacity = capacity;
+    }
+
+    uint32_t chunks = (names_size + NAME_CHUNK_SIZE - 1) / NAME_CHUNK_SIZE;
+    if (chunks > MAX_NAME_CHUNKS) return -1;
+    for (uint32_t i = 0; i < chunks; i++) {
+        if (!g_name_chunks[i]) {
+            // Zeroed so the gaps at chunk ends are written out deterministically
+            g_name_chunks[i] = (char*)mem_alloc(NAME_CHUNK_SIZE, MEM_PSRAM);
+            if (!g_name_chunks[i]) return -1;
+            memset(g_name_chunks[i], 0, NAME_CHUNK_SIZE);
+        }
+    }
+
+    return 0;
+}
+
+// Append a song to the playlist (lock held)
+// Returns 0 on success, -1 if out of memory
+static int add_song(const char* rel_path) {
+    music_player_state_t* state = music_player_get_state();
+
+    uint32_t len = (uint32_t)strlen(rel_path) + 1;
+    uint32_t offset = g_names_size;
+    if (offset % NAME_CHUNK_SIZE + len > NAME_CHUNK_SIZE) {
+        offset = (offset / NAME_CHUNK_SIZE + 1) * NAME_CHUNK_SIZE;
+    }
+    if (reserve_storage(state->playlist.count + 1, offset + len) != 0) {
+        return -1;
+    }
+
+    memcpy((char*)name_at(offset), rel_path, len);
+    g_songs[state->playlist.count].name_offset = offset;
+    g_songs[state->playlist.count].duration_ms = 0;
+    g_names_size = offset + len;
+    state->playlist.count++;
+    music_player_state_changed();
+    return 0;
+}
+
+static int compare_entries(const void* a, const void* b) {
+    // Skip the type prefix
+    return strcasecmp(*(const char* const*)a + 1, *(const char* const*)b + 1);
+}
+
+// Call fn for each file a decoder plays (MP3, FLAC, WAV) under MUSIC_DIR/rel,
+// in case-insensitive order with files and folders interleaved. rel
+// (MAX_FILENAME_LENGTH bytes) is "" for the top level and is used as scratch
+// for the paths below it.
+// Returns false if fn or *stop (checked between entries) ended the walk
+static bool walk_dir(char* rel, int depth, walk_fn_t fn, void* arg, const volatile bool* stop) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s%s%s", MUSIC_DIR, rel[0] ? "/" : "", rel);
+
+    DIR* dir = opendir(path);
+    if (!dir) {
+        asp_log_warn("musicplayer", "Cannot open folder %s", path);
+        return true;
+    }
+
+    // Collect the folder's entries first so they can be visited in order;
+    // each is prefixed with 'd' (folder) or 'f' (file)
+    char** entries = NULL;
+    int count = 0;
+    int capacity = 0;
+    size_t rel_len = strlen(rel);
+
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL && !*stop) {
+        // Skip hidden entries (".", "..", the library index, macOS "._" files)
+        if (entry->d_name[0] == '.') continue;
+
+        char type;
+        if (entry->d_type == DT_DIR && depth < MAX_SCAN_DEPTH) {
+            type = 'd';
+        } else if (entry->d_type == DT_REG && decoder_plays_file(entry->d_name)) {
+            type = 'f';
+        } else {
+            continue;
+        }
+
+        size_t len = strlen(entry->d_name);
+        if (rel_len + 1 + len >= MAX_FILENAME_LENGTH) {
+            asp_log_warn("musicplayer", "Skipping too long path: %.32s...", entry->d_name);
+            continue;
+        }
+
+        if (count == capacity) {
+            int grown_capacity = capacity ? capacity * 2 : 16;
+            char** grown = (char**)realloc(entries, grown_capacity * sizeof(char*));
+            if (!grown) break;
+            entries = grown;
+            capacity = grown_capacity;
+        }
+        char* copy = (char*)malloc(len + 2);
+        if (!copy) break;
+        copy[0] = type;
+        memcpy(copy + 1, entry->d_name, len + 1);
+        entries[count++] = copy;
+    }
+
+    closedir(dir);
+
+    qsort(entries, count, sizeof(char*), compare_entries);
+
+    bool keep_going = true;
+    for (int i = 0; i < count; i++) {
+        if (keep_going && !*stop) {
+            snprintf(rel + rel_len, MAX_FILENAME_LENGTH - rel_len, "%s%s",
+                     rel_len ? "/" : "", entries[i] + 1);
+            if (entries[i][0] == 'd') {
+                keep_going = walk_dir(rel, depth + 1, fn, arg, stop);
+            } else {
+                keep_going = fn(rel, arg);
+            }
+            rel[rel_len] = '\0';
+        }
+        free(entries[i]);
+    }
+    free(entries);
+
+    return keep_going && !*stop;
+}
+
+static bool walk_add_song(const char* rel_path, void* arg) {
+    (void)arg;
+
+    pthread_mutex_lock(&g_lock);
+    int err = add_song(rel_path);
+    if (err == 0) pthread_cond_broadcast(&g_cond);
+    pthread_mutex_unlock(&g_lock);
+
+    if (err != 0) {
+        asp_log_warn("musicplayer", "Out of memory, playlist stops at %d songs",
+                     music_player_get_state()->playlist.count);
+        return false;
+    }
+    return true;
+}
+
+static bool walk_count_song(const char* rel_path, void* arg) {
+    (void)rel_path;
+    (*(int*)arg)++;
+    return true;
+}
+
+static void* walk_thread_func(void* arg) {
+    (void)arg;
+    char rel[MAX_FILENAME_LENGTH] = "";
+    uint32_t start = asp_plugin_get_tick_ms();
+
+    walk_dir(rel, 0, walk_add_song, NULL, &g_walk_should_stop);
+
+    pthread_mutex_lock(&g_lock);
+    g_walk_done = true;
+    pthread_cond_broadcast(&g_cond);
+    pthread_mutex_unlock(&g_lock);
+
+    if (!g_walk_should_stop) {
+        asp_log_info("musicplayer", "Library scan finished: %d songs in %u ms",
+                     music_player_get_state()->playlist.count,
+                     (unsigned)(asp_plugin_get_tick_ms() - start));
+    }
+    return NULL;
+}
+
+// Fill the playlist from the index file if it matches the directory
+// Returns 0 on success, -1 if there is no usable index
+static int load_cache(void) {
+    music_player_state_t* state = music_player_get_state();
+
+    FILE* file = fopen(CACHE_PATH, "rb");
+    if (!file) return -1;
+
+    cache_header_t header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        header.magic != CACHE_MAGIC || header.version != CACHE_VERSION ||
+        header.dir_mtime != g_dir_mtime ||
+        header.count == 0 || header.count > MAX_CACHE_SONGS ||
+        header.names_size < header.count) {
+        fclose(file);
+        return -1;
+    }
+
+    if (reserve_storage((int)header.count, header.names_size) != 0) {
+        asp_log_warn("musicplayer", "No memory for library index (%u songs)", (unsigned)header.count);
+        fclose(file);
+        free_storage();
+        return -1;
+    }
+
+    bool ok = fread(g_songs, sizeof(song_info_t), header.count, file) == header.count;
+    for (uint32_t done = 0; ok && done < header.names_size; done += NAME_CHUNK_SIZE) {
+        uint32_t len = header.names_size - done;
+        if (len > NAME_CHUNK_SIZE) len = NAME_CHUNK_SIZE;
+        ok = fread(g_name_chunks[done / NAME_CHUNK_SIZE], 1, len, file) == len;
+    }
+    fclose(file);
+
+    // Every entry has to point at a name terminated inside its chunk
+    for (uint32_t i = 0; ok && i < header.count; i++) {
+        uint32_t offset = g_songs[i].name_offset;
+        uint32_t chunk_end = (offset / NAME_CHUNK_SIZE + 1) * NAME_CHUNK_SIZE;
+        if (chunk_end > header.names_size) chunk_end = header.names_size;
+        ok = offset < header.names_size && memchr(name_at(offset), '\0', chunk_end - offset) != NULL;
+    }
+
+    if (!ok) {
+        asp_log_warn("musicplayer", "Library index is damaged, rescanning");
+        free_storage();
+        return -1;
+    }
+
+    g_names_size = header.names_size;
+    state->playlist.count = (int)header.count;
+    state->playlist.current_index = 0;
+    return 0;
 }
 
 int playlist_init(void) {
@@ -28,89 +333,213 @@ int playlist_init(void) {
         asp_log_warn("musicplayer", "Music directory not found: %s", MUSIC_DIR);
         return -1;
     }
-
-    // Scan for MP3 files
-    DIR* dir = opendir(MUSIC_DIR);
-    if (!dir) {
-        asp_log_error("musicplayer", "Failed to open music directory");
-        return -1;
-    }
+    g_dir_mtime = (int64_t)st.st_mtime;
 
     state->playlist.count = 0;
     state->playlist.current_index = 0;
 
-    struct dirent* entry;
-    while ((entry = readdir(dir)) != NULL && state->playlist.count < MAX_PLAYLIST_ENTRIES) {
-        // Check if it's a regular file with .mp3 extension
-        if (entry->d_type == DT_REG && is_mp3_file(entry->d_name)) {
-            strncpy(state->playlist.songs[state->playlist.count].filename,
-                    entry->d_name, MAX_FILENAME_LENGTH - 1);
-            state->playlist.songs[state->playlist.count].filename[MAX_FILENAME_LENGTH - 1] = '\0';
-            state->playlist.songs[state->playlist.count].duration_ms = 0;
-            state->playlist.count++;
-        }
+    // Use the library index from the last run if the directory is unchanged
+    g_cache_loaded = (load_cache() == 0);
+    if (g_cache_loaded) {
+        g_walk_done = true;
+        asp_log_info("musicplayer", "Loaded %d songs from library index", state->playlist.count);
+        return 0;
     }
 
-    closedir(dir);
+    // Scan for audio files in the background
+    g_walk_done = false;
+    g_walk_should_stop = false;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, WALK_STACK_SIZE);
+    struct sched_param param = { .sched_priority = WALK_PRIORITY };
+    pthread_attr_setschedparam(&attr, &param);
+    int err = pthread_create(&g_walk_thread, &attr, walk_thread_func, NULL);
+    pthread_attr_destroy(&attr);
+
+    if (err != 0) {
+        asp_log_error("musicplayer", "Failed to create library scan thread: %d", err);
+        return -1;
+    }
+    g_walk_running = true;
+
+    // Playback can start with the first song found
+    pthread_mutex_lock(&g_lock);
+    while (state->playlist.count == 0 && !g_walk_done) {
+        pthread_cond_wait(&g_cond, &g_lock);
+    }
+    pthread_mutex_unlock(&g_lock);
 
     if (state->playlist.count == 0) {
-        asp_log_warn("musicplayer", "No MP3 files found in %s", MUSIC_DIR);
+        asp_log_warn("musicplayer", "No audio files found in %s", MUSIC_DIR);
+        playlist_cleanup();
         return -1;
     }
 
-    // Sort playlist alphabetically (simple bubble sort for small lists)
-    for (int i = 0; i < state->playlist.count - 1; i++) {
-        for (int j = 0; j < state->playlist.count - i - 1; j++) {
-            if (strcasecmp(state->playlist.songs[j].filename,
-                          state->playlist.songs[j + 1].filename) > 0) {
-                song_info_t temp = state->playlist.songs[j];
-                state->playlist.songs[j] = state->playlist.songs[j + 1];
-                state->playlist.songs[j + 1] = temp;
-            }
-        }
+    asp_log_info("musicplayer", "Playlist ready, library scan continues in background");
+    return 0;
+}
+
+bool playlist_scan_done(void) {
+    pthread_mutex_lock(&g_lock);
+    bool done = g_walk_done;
+    pthread_mutex_unlock(&g_lock);
+    return done;
+}
+
+bool playlist_cache_stale(const volatile bool* stop) {
+    music_player_state_t* state = music_player_get_state();
+    if (!g_cache_loaded) return false;
+
+    // FAT does not always update the directory mtime, so also check the file count
+    char rel[MAX_FILENAME_LENGTH] = "";
+    int count = 0;
+    if (!walk_dir(rel, 0, walk_count_song, &count, stop) || count == state->playlist.count) {
+        return false;
+    }
+
+    asp_log_info("musicplayer", "Library changed (%d files, index has %d), dropping index",
+                 count, state->playlist.count);
+    remove(CACHE_PATH);
+    g_cache_loaded = false;
+    return true;
+}
+
+int playlist_save_cache(void) {
+    music_player_state_t* state = music_player_get_state();
+
+    // The playlist only stops changing once the walk is complete
+    if (!playlist_scan_done() || state->playlist.count == 0) return -1;
+
+    FILE* file = fopen(CACHE_TMP_PATH, "wb");
+    if (!file) {
+        asp_log_warn("musicplayer", "Cannot write library index");
+        return -1;
+    }
+
+    cache_header_t header = {
+        .magic = CACHE_MAGIC,
+        .version = CACHE_VERSION,
+        .count = (uint32_t)state->playlist.count,
+        .names_size = g_names_size,
+        .dir_mtime = g_dir_mtime,
+    };
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(g_songs, sizeof(song_info_t), header.count, file) == header.count;
+    for (uint32_t done = 0; ok && done < g_names_size; done += NAME_CHUNK_SIZE) {
+        uint32_t len = g_names_size - done;
+        if (len > NAME_CHUNK_SIZE) len = NAME_CHUNK_SIZE;
+        ok = fwrite(g_name_chunks[done / NAME_CHUNK_SIZE], 1, len, file) == len;
+    }
+
+    if (fclose(file) != 0) ok = false;
+
+    // Replace the old index only once the new one is complete (FAT rename does not overwrite)
+    if (ok) {
+        remove(CACHE_PATH);
+        ok = rename(CACHE_TMP_PATH, CACHE_PATH) == 0;
+    }
+    if (!ok) {
+        asp_log_warn("musicplayer", "Failed to write library index");
+        remove(CACHE_TMP_PATH);
+        return -1;
     }
 
-    asp_log_info("musicplayer", "Loaded %d songs into playlist", state->playlist.count);
+    g_cache_loaded = true;
+    asp_log_info("musicplayer", "Saved library index (%d songs)", state->playlist.count);
     return 0;
 }
 
 void playlist_cleanup(void) {
+    if (g_walk_running) {
+        g_walk_should_stop = true;
+        pthread_join(g_walk_thread, NULL);
+        g_walk_running = false;
+    }
+
+    pthread_mutex_lock(&g_lock);
+    free_storage();
+    pthread_mutex_unlock(&g_lock);
+}
+
+void playlist_set_current_index(int index) {
     music_player_state_t* state = music_player_get_state();
-    state->playlist.count = 0;
-    state->playlist.current_index = 0;
+
+    pthread_mutex_lock(&g_lock);
+    if (index >= 0 && index < state->playlist.count) {
+        state->playlist.current_index = index;
+        music_player_state_changed();
+    }
+    pthread_mutex_unlock(&g_lock);
 }
 
-void playlist_next(void) {
+const char* playlist_get_filename(int index) {
     music_player_state_t* state = music_player_get_state();
-    if (state->playlist.count == 0) return;
+    const char* name = NULL;
 
-    state->playlist.current_index++;
-    if (state->playlist.current_index >= state->playlist.count) {
-        state->playlist.current_index = 0;
+    pthread_mutex_lock(&g_lock);
+    if (index >= 0 && index < state->playlist.count) {
+        name = name_at(g_songs[index].name_offset);
     }
+    pthread_mutex_unlock(&g_lock);
+
+    return name;
 }
 
-void playlist_prev_or_restart(void) {
+uint32_t playlist_get_duration_ms(int index) {
     music_player_state_t* state = music_player_get_state();
-    if (state->playlist.count == 0) return;
+    uint32_t duration_ms = 0;
 
-    uint32_t now = asp_plugin_get_tick_ms();
-    uint32_t elapsed = now - state->song_start_time;
+    pthread_mutex_lock(&g_lock);
+    if (index >= 0 && index < state->playlist.count) {
+        duration_ms = g_songs[index].duration_ms;
+    }
+    pthread_mutex_unlock(&g_lock);
 
-    // If within 10 seconds of start, go to previous song
-    if (elapsed < 10000) {
-        state->playlist.current_index--;
-        if (state->playlist.current_index < 0) {
-            state->playlist.current_index = state->playlist.count - 1;
-        }
+    return duration_ms;
+}
+
+void playlist_set_duration_ms(int index, uint32_t duration_ms) {
+    music_player_state_t* state = music_player_get_state();
+
+    pthread_mutex_lock(&g_lock);
+    if (index >= 0 && index < state->playlist.count) {
+        g_songs[index].duration_ms = duration_ms;
     }
-    // Otherwise the caller will just restart the current song
+    pthread_mutex_unlock(&g_lock);
+}
+
+uint32_t playlist_path_hash(const char* path) {
+    size_t dir_len = strlen(MUSIC_DIR);
+    if (strncmp(path, MUSIC_DIR, dir_len) == 0 && path[dir_len] == '/') {
+        path += dir_len + 1;
+    }
+
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (const char* p = path; *p; p++) {
+        hash = (hash ^ (uint8_t)*p) * 16777619u;
+    }
+    return hash;
+}
+
+int playlist_find_hash(uint32_t hash) {
+    music_player_state_t* state = music_player_get_state();
+    int found = -1;
+
+    pthread_mutex_lock(&g_lock);
+    for (int i = 0; i < state->playlist.count && found < 0; i++) {
+        if (playlist_path_hash(name_at(g_songs[i].name_offset)) == hash) found = i;
+    }
+    pthread_mutex_unlock(&g_lock);
+
+    return found;
 }
 
 const char* playlist_get_current_filename(void) {
     music_player_state_t* state = music_player_get_state();
-    if (state->playlist.count == 0) return NULL;
-    return state->playlist.songs[state->playlist.current_index].filename;
+    return playlist_get_filename(state->playlist.current_index);
 }
 
 const char* playlist_get_current_path(void) {
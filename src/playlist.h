@@ -4,21 +4,48 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 
-// Initialize playlist by scanning /sd/music for MP3 files
+// Initialize playlist from the library index, or start scanning /sd/music and
+// its subfolders for audio files if the index is missing or the directory changed
+// since it was written. The scan continues in the background after the first
+// song is found; songs are appended in sorted order so indices stay valid.
 // Returns 0 on success, -1 if no music directory or no files found
 int playlist_init(void);
 
-// Cleanup playlist resources
+// True once the library scan has finished (or the index was loaded)
+bool playlist_scan_done(void);
+
+// Check a loaded library index against the directory contents (walks the folders)
+// The walk gives up as soon as *stop is set (the caller's thread is stopping)
+// Returns true if files were added or removed; the index is then deleted
+bool playlist_cache_stale(const volatile bool* stop);
+
+// Write the playlist, including durations, to the library index
+// Returns 0 on success, -1 on failure or while the library scan is running
+int playlist_save_cache(void);
+
+// Stop the library scan and free playlist resources
 void playlist_cleanup(void);
 
-// Advance to next song (loops at end)
-void playlist_next(void);
+// Make song index current (ignored if out of range); the play queue decides
+// which song that is
+void playlist_set_current_index(int index);
+
+// Get the path of song index relative to /sd/music, NULL if out of range
+// The string stays valid until playlist_cleanup()
+const char* playlist_get_filename(int index);
+
+// Get or set the duration of song index (0 if unknown)
+uint32_t playlist_get_duration_ms(int index);
+void playlist_set_duration_ms(int index, uint32_t duration_ms);
+
+// Hash of a song's path (full, or relative to MUSIC_DIR), which identifies
+// it across restarts even when songs are added or removed
+uint32_t playlist_path_hash(const char* path);
 
-// Go to previous song or restart current
-// If within 10 seconds of start, goes to previous song
-// Otherwise restarts current song
-void playlist_prev_or_restart(void);
+// Index of the song whose path has hash, -1 if there is none (yet)
+int playlist_find_hash(uint32_t hash);
 
 // Get current song filename (just the filename, not full path)
 const char* playlist_get_current_filename(void);
@@ -0,0 +1,398 @@
+// SPDX-License-Identifier: MIT
+// Music Player Plugin - SD Card Read-Ahead
+// Chunks are filled by a low-priority I/O thread at chunk-aligned file offsets.
+// The decoder reads through a cursor; the first READAHEAD_GUARD_SIZE bytes of
+// the ring are mirrored after its end so frames crossing the wrap need no copy.
+// A queued next file is opened at EOF and streamed in behind the current one.
+// Ring offsets of the decoder's file are its file offsets plus g_file_base.
+
+#include "readahead.h"
+#include "thread_util.h"
+#include "stats.h"
+#include "mem.h"
+#include "tanmatsu_plugin.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+#define RING_SIZE           (READAHEAD_CHUNK_SIZE * READAHEAD_CHUNKS)
+
+// Cache-line alignment for DMA from the SD card into PSRAM
+#define RING_ALIGN          MEM_CACHE_LINE
+
+// I/O thread only calls fread; one below the ESP-IDF pthread default priority (5)
+#define IO_STACK_SIZE       (4 * 1024)
+#define IO_THREAD_PRIORITY  4
+
+// Longest sleep of the I/O thread between refills (consume, open, seek and
+// stop wake it sooner)
+#define IO_IDLE_WAIT_MS     1000
+
+// Ring alignment of a chained file's first byte and of seek restarts (keeps reads sector aligned)
+#define SECTOR_ALIGN        512
+
+_Static_assert(READAHEAD_CHUNKS >= 2, "read-ahead needs at least two chunks");
+_Static_assert(READAHEAD_REFILL_CHUNKS >= 1 && READAHEAD_REFILL_CHUNKS < READAHEAD_CHUNKS,
+               "refill must start with a free chunk and keep one buffered");
+_Static_assert(READAHEAD_CHUNK_SIZE % 512 == 0, "read-ahead chunks must be sector aligned");
+_Static_assert(READAHEAD_GUARD_SIZE <= READAHEAD_CHUNK_SIZE, "guard must fit in the first chunk");
+
+// Chunk ring plus guard area (PSRAM)
+static uint8_t* g_ring = NULL;
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_cond_data = PTHREAD_COND_INITIALIZER;   // Signalled when bytes arrive
+static pthread_cond_t g_cond_space = PTHREAD_COND_INITIALIZER;  // Signalled on consume/open/stop
+static pthread_cond_t g_cond_idle = PTHREAD_COND_INITIALIZER;   // Signalled when an fread completes
+
+// Current file; only swapped while the I/O thread is not inside fread
+static FILE* g_file = NULL;
+
+// Ring offsets: data in [g_read_off, g_write_off) is buffered
+static uint64_t g_read_off = 0;
+static uint64_t g_write_off = 0;
+
+// Decoder's file: its path (reopened by a seek after chaining) and ring offset of byte 0
+static char g_cur_path[READAHEAD_PATH_MAX];
+static uint64_t g_file_base = 0;
+
+static bool g_eof = false;
+static bool g_io_busy = false;
+static bool g_refilling = false;        // Reading until the ring is full (I/O thread)
+
+// File to open when the current one is exhausted
+static char g_next_path[READAHEAD_PATH_MAX];
+static bool g_next_queued = false;
+
+// While chained: the decoder's file ends at g_prev_end_off, the next file
+// starts at g_boundary_off (bytes in between are alignment padding)
+static bool g_chained = false;
+static uint64_t g_prev_end_off = 0;
+static uint64_t g_boundary_off = 0;
+
+static pthread_t g_io_thread;
+static bool g_io_running = false;
+static bool g_io_should_stop = false;
+
+// Bytes the I/O thread may read next without touching unconsumed data
+// Reads stop at chunk boundaries so SD transactions stay chunk aligned
+// A refill starts once READAHEAD_REFILL_CHUNKS are free and runs until the ring is full
+static size_t next_read_size(void) {
+    size_t to_boundary = READAHEAD_CHUNK_SIZE - (size_t)(g_write_off % READAHEAD_CHUNK_SIZE);
+    uint64_t used = g_write_off - g_read_off;
+    if (used + to_boundary > RING_SIZE) {
+        g_refilling = false;
+        return 0;
+    }
+    if (!g_refilling && RING_SIZE - used < (uint64_t)READAHEAD_REFILL_CHUNKS * READAHEAD_CHUNK_SIZE) {
+        return 0;
+    }
+    g_refilling = true;
+    return to_boundary;
+}
+
+// Open the queued file behind the exhausted one (lock held, I/O thread only)
+static void chain_next_file(void) {
+    char path[READAHEAD_PATH_MAX];
+    memcpy(path, g_next_path, sizeof(path));
+    g_next_queued = false;
+
+    FILE* old = g_file;
+    g_file = NULL;
+    g_io_busy = true;
+    pthread_mutex_unlock(&g_lock);
+
+    if (old) {
+        fclose(old);
+    }
+    FILE* file = fopen(path, "rb");
+
+    pthread_mutex_lock(&g_lock);
+    g_io_busy = false;
+    if (file) {
+        g_file = file;
+        g_chained = true;
+        g_prev_end_off = g_write_off;
+        g_boundary_off = (g_write_off + SECTOR_ALIGN - 1) & ~(uint64_t)(SECTOR_ALIGN - 1);
+        g_write_off = g_boundary_off;
+        g_eof = false;
+    } else {
+        asp_log_error("musicplayer", "Failed to open next file: %s", path);
+    }
+    pthread_cond_broadcast(&g_cond_data);
+    pthread_cond_broadcast(&g_cond_idle);
+}
+
+static void* io_thread_func(void* arg) {
+    (void)arg;
+    asp_log_info("musicplayer", "Read-ahead thread started");
+
+    pthread_mutex_lock(&g_lock);
+    while (!g_io_should_stop) {
+        if (g_eof && g_next_queued && !g_chained) {
+            chain_next_file();
+            continue;
+        }
+
+        size_t want = (g_file && !g_eof) ? next_read_size() : 0;
+        if (want == 0) {
+            cond_wait_ms(&g_cond_space, &g_lock, IO_IDLE_WAIT_MS);
+            continue;
+        }
+
+        FILE* file = g_file;
+        size_t index = (size_t)(g_write_off % RING_SIZE);
+        g_io_busy = true;
+        pthread_mutex_unlock(&g_lock);
+
+        uint64_t read_start = stats_now_us();
+        size_t got = fread(g_ring + index, 1, want, file);
+        stats_time(STATS_READ, read_start);
+
+        // Mirror the start of the ring into the guard area
+        if (got > 0 && index < READAHEAD_GUARD_SIZE) {
+            size_t mirror = READAHEAD_GUARD_SIZE - index;
+            if (mirror > got) mirror = got;
+            memcpy(g_ring + RING_SIZE + index, g_ring + index, mirror);
+        }
+
+        // open/close wait for g_io_busy to clear, so the file is still current
+        pthread_mutex_lock(&g_lock);
+        g_io_busy = false;
+        g_write_off += got;
+        if (got < want) {
+            g_eof = true;
+        }
+        pthread_cond_broadcast(&g_cond_data);
+        pthread_cond_broadcast(&g_cond_idle);
+    }
+    pthread_mutex_unlock(&g_lock);
+
+    asp_log_info("musicplayer", "Read-ahead thread exiting");
+    return NULL;
+}
+
+// Wait until the I/O thread is outside fread (lock held)
+static void wait_io_idle(void) {
+    while (g_io_busy) {
+        pthread_cond_wait(&g_cond_idle, &g_lock);
+    }
+}
+
+// End of the decoder's current file in the ring (lock held)
+static uint64_t current_end_off(void) {
+    return g_chained ? g_prev_end_off : g_write_off;
+}
+
+int readahead_init(void) {
+    g_ring = (uint8_t*)mem_alloc_aligned(RING_ALIGN, RING_SIZE + READAHEAD_GUARD_SIZE, MEM_PSRAM);
+    if (!g_ring) {
+        asp_log_error("musicplayer", "Failed to allocate read-ahead ring (%d bytes)",
+                     RING_SIZE + READAHEAD_GUARD_SIZE);
+        return -1;
+    }
+
+    g_file = NULL;
+    g_cur_path[0] = '\0';
+    g_file_base = 0;
+    g_read_off = 0;
+    g_write_off = 0;
+    g_eof = false;
+    g_io_busy = false;
+    g_next_queued = false;
+    g_chained = false;
+    g_io_should_stop = false;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, IO_STACK_SIZE);
+    struct sched_param param = { .sched_priority = IO_THREAD_PRIORITY };
+    pthread_attr_setschedparam(&attr, &param);
+    int err = pthread_create(&g_io_thread, &attr, io_thread_func, NULL);
+    pthread_attr_destroy(&attr);
+
+    if (err != 0) {
+        asp_log_error("musicplayer", "Failed to create read-ahead thread: %d", err);
+        free(g_ring);
+        g_ring = NULL;
+        return -1;
+    }
+
+    g_io_running = true;
+    return 0;
+}
+
+void readahead_cleanup(void) {
+    if (g_io_running) {
+        pthread_mutex_lock(&g_lock);
+        g_io_should_stop = true;
+        pthread_cond_broadcast(&g_cond_space);
+        pthread_mutex_unlock(&g_lock);
+        pthread_join(g_io_thread, NULL);
+        g_io_running = false;
+    }
+
+    readahead_close();
+
+    if (g_ring) {
+        free(g_ring);
+        g_ring = NULL;
+    }
+}
+
+int readahead_open(const char* path) {
+    // Open outside the lock so the I/O thread can keep going meanwhile
+    FILE* file = fopen(path, "rb");
+
+    pthread_mutex_lock(&g_lock);
+    wait_io_idle();
+    if (g_file) {
+        fclose(g_file);
+    }
+    g_file = file;
+    strncpy(g_cur_path, path, sizeof(g_cur_path) - 1);
+    g_cur_path[sizeof(g_cur_path) - 1] = '\0';
+    g_file_base = 0;
+    g_read_off = 0;
+    g_write_off = 0;
+    g_eof = (file == NULL);
+    g_next_queued = false;
+    g_chained = false;
+    pthread_cond_broadcast(&g_cond_space);
+    pthread_cond_broadcast(&g_cond_data);
+    pthread_mutex_unlock(&g_lock);
+
+    return file ? 0 : -1;
+}
+
+void readahead_close(void) {
+    pthread_mutex_lock(&g_lock);
+    wait_io_idle();
+    if (g_file) {
+        fclose(g_file);
+        g_file = NULL;
+    }
+    g_cur_path[0] = '\0';
+    g_file_base = 0;
+    g_read_off = 0;
+    g_write_off = 0;
+    g_eof = true;
+    g_next_queued = false;
+    g_chained = false;
+    pthread_cond_broadcast(&g_cond_data);
+    pthread_mutex_unlock(&g_lock);
+}
+
+void readahead_queue_next(const char* path) {
+    pthread_mutex_lock(&g_lock);
+    // Also lets a chain in progress finish, so it can be undone below
+    wait_io_idle();
+    if (g_chained) {
+        // Drop the already chained file and whatever was read from it
+        if (g_file) {
+            fclose(g_file);
+            g_file = NULL;
+        }
+        g_write_off = g_prev_end_off;
+        g_chained = false;
+        g_eof = true;
+    }
+    g_next_queued = false;
+    if (path) {
+        strncpy(g_next_path, path, sizeof(g_next_path) - 1);
+        g_next_path[sizeof(g_next_path) - 1] = '\0';
+        g_next_queued = true;
+    }
+    pthread_cond_broadcast(&g_cond_space);
+    pthread_mutex_unlock(&g_lock);
+}
+
+bool readahead_next_file(uint32_t timeout_ms) {
+    pthread_mutex_lock(&g_lock);
+    // The I/O thread may still be opening the queued file
+    if (!g_chained && g_next_queued && g_eof) {
+        cond_wait_ms(&g_cond_data, &g_lock, timeout_ms);
+    }
+    bool chained = g_chained;
+    if (chained) {
+        g_read_off = g_boundary_off;
+        g_file_base = g_boundary_off;
+        memcpy(g_cur_path, g_next_path, sizeof(g_cur_path));
+        g_chained = false;
+        pthread_cond_signal(&g_cond_space);
+    }
+    pthread_mutex_unlock(&g_lock);
+    return chained;
+}
+
+const uint8_t* readahead_peek(size_t min_bytes, size_t* out_len, uint32_t timeout_ms) {
+    pthread_mutex_lock(&g_lock);
+    if (current_end_off() - g_read_off < min_bytes && !g_eof && !g_chained) {
+        cond_wait_ms(&g_cond_data, &g_lock, timeout_ms);
+    }
+
+    size_t index = (size_t)(g_read_off % RING_SIZE);
+    uint64_t available = current_end_off() - g_read_off;
+    size_t contiguous = RING_SIZE + READAHEAD_GUARD_SIZE - index;
+    *out_len = (available < contiguous) ? (size_t)available : contiguous;
+    pthread_mutex_unlock(&g_lock);
+
+    return g_ring + index;
+}
+
+void readahead_consume(size_t bytes) {
+    pthread_mutex_lock(&g_lock);
+    uint64_t available = current_end_off() - g_read_off;
+    g_read_off += (bytes < available) ? bytes : available;
+    pthread_cond_signal(&g_cond_space);
+    pthread_mutex_unlock(&g_lock);
+}
+
+uint64_t readahead_tell(void) {
+    pthread_mutex_lock(&g_lock);
+    uint64_t pos = g_read_off - g_file_base;
+    pthread_mutex_unlock(&g_lock);
+    return pos;
+}
+
+uint64_t readahead_seek(uint64_t offset) {
+    uint64_t aligned = offset & ~(uint64_t)(SECTOR_ALIGN - 1);
+
+    pthread_mutex_lock(&g_lock);
+    wait_io_idle();
+    if (g_chained) {
+        // The current file was closed when the next one was chained; swap back
+        // (seeks are rare, so the I/O thread may wait for this fopen)
+        if (g_file) {
+            fclose(g_file);
+        }
+        g_file = fopen(g_cur_path, "rb");
+        g_chained = false;
+        g_next_queued = true;
+    } else if (!g_file && g_cur_path[0]) {
+        // Closed at EOF by a chain that failed or was undone
+        g_file = fopen(g_cur_path, "rb");
+    }
+
+    bool ok = g_file && fseek(g_file, (long)aligned, SEEK_SET) == 0;
+    if (!ok) {
+        asp_log_error("musicplayer", "Seek to %llu failed", (unsigned long long)aligned);
+    }
+    g_read_off = g_file_base + aligned;
+    g_write_off = g_read_off;
+    g_eof = !ok;
+    pthread_cond_broadcast(&g_cond_space);
+    pthread_cond_broadcast(&g_cond_data);
+    pthread_mutex_unlock(&g_lock);
+
+    return aligned;
+}
+
+bool readahead_eof(void) {
+    pthread_mutex_lock(&g_lock);
+    bool eof = g_eof || g_chained;
+    pthread_mutex_unlock(&g_lock);
+    return eof;
+}
@@ -0,0 +1,73 @@
+// SPDX-License-Identifier: MIT
+// Music Player Plugin - SD Card Read-Ahead
+// A low-priority I/O thread keeps a ring of large PSRAM chunks filled from the
+// current file, so the decoder never blocks in fread. A queued next file is
+// read in right behind the current one for gapless track changes.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Size of one SD read; multiple of the 512 byte sector size
+#define READAHEAD_CHUNK_SIZE  (32 * 1024)
+
+// Number of chunks in the ring (at least 2)
+#define READAHEAD_CHUNKS      4
+
+// Free chunks that start a refill; the I/O thread then reads until the ring is
+// full, so SD reads come in bursts with the card idle in between
+#define READAHEAD_REFILL_CHUNKS  (READAHEAD_CHUNKS / 2)
+
+// Bytes mirrored past the end of the ring so a frame crossing the wrap
+// point stays contiguous; must be larger than the biggest MP3 frame, and
+// holds any FLAC frame of the streamable subset (4608 stereo 24-bit samples
+// stored verbatim)
+#define READAHEAD_GUARD_SIZE  (32 * 1024)
+
+// Longest path accepted by readahead_queue_next()
+#define READAHEAD_PATH_MAX    256
+
+// Allocate the chunk ring and start the I/O thread
+// Returns 0 on success, -1 on failure
+int readahead_init(void);
+
+// Stop the I/O thread and free the chunk ring
+void readahead_cleanup(void);
+
+// Close the current file (if any) and start reading path from the beginning
+// Returns 0 on success, -1 if the file could not be opened
+int readahead_open(const char* path);
+
+// Close the current file and drop buffered data
+void readahead_close(void);
+
+// Set the file to read once the current one is exhausted (NULL to clear)
+// Replaces any previously queued or already chained file
+void readahead_queue_next(const char* path);
+
+// Move the read cursor to the chained next file once the current one is used up
+// Waits up to timeout_ms if the I/O thread is still opening it
+// Returns true if the cursor now points at the start of the next file
+bool readahead_next_file(uint32_t timeout_ms);
+
+// Get a contiguous view of buffered data at the read cursor
+// Waits up to timeout_ms for at least min_bytes unless the file is exhausted
+// *out_len receives the number of contiguous bytes (may be less than min_bytes)
+const uint8_t* readahead_peek(size_t min_bytes, size_t* out_len, uint32_t timeout_ms);
+
+// Advance the read cursor past bytes returned by readahead_peek()
+void readahead_consume(size_t bytes);
+
+// File offset of the read cursor in the decoder's current file
+uint64_t readahead_tell(void);
+
+// Drop buffered data and restart reading the current file near offset
+// Reading restarts at offset rounded down to a sector; returns that offset,
+// so the caller has to skip (offset - returned value) bytes
+// A chained next file is dropped and chained again at the end of the file
+uint64_t readahead_seek(uint64_t offset);
+
+// True once the whole current file has been read into the ring
+bool readahead_eof(void);
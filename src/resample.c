@@ -0,0 +1,161 @@
+// SPDX-License-Identifier: MIT
+// Music Player Plugin - Output Resampler
+
+#include "resample.h"
+#include "mem.h"
+#include "tanmatsu_plugin.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TAPS            16
+#define PHASE_BITS      7
+#define PHASES          (1 << PHASE_BITS)
+#define COEF_BITS       14
+#define MAX_CHANNELS    2
+
+// Passband edge as a fraction of the lower Nyquist frequency
+#define CUTOFF          0.90f
+
+// Output position steps in Q32 input samples
+#define POS_ONE         (1ULL << 32)
+
+// Offsets between phases are interpolated in Q15
+#define INTERP_BITS     15
+
+static int16_t* g_coefs = NULL;         // [PHASES + 1][TAPS], the last one a sample late
+static int16_t* g_out = NULL;           // RESAMPLE_OUT_FRAMES * MAX_CHANNELS
+
+// Last TAPS input samples per channel, stored twice so the window at g_pos is
+// always contiguous
+static int16_t g_history[MAX_CHANNELS][2 * TAPS];
+static int g_pos = 0;                   // Oldest sample of the window
+static int g_channels = 2;
+
+static uint32_t g_in_rate = 0;
+static uint32_t g_out_rate = 0;
+static uint64_t g_step = POS_ONE;       // Input samples per output sample
+static uint64_t g_frac = POS_ONE;       // Next output past the window's middle
+
+static int16_t saturate(int32_t v) {
+    if (v > INT16_MAX) return INT16_MAX;
+    if (v < INT16_MIN) return INT16_MIN;
+    return (int16_t)v;
+}
+
+// Windowed sinc low-pass for each fractional delay, each phase summing to unity
+static void build_filter(void) {
+    float cutoff = CUTOFF * ((g_out_rate < g_in_rate) ? (float)g_out_rate / (float)g_in_rate : 1.0f);
+    for (int p = 0; p <= PHASES; p++) {
+        float taps[TAPS];
+        float sum = 0.0f;
+        for (int k = 0; k < TAPS; k++) {
+            // Output lies between taps TAPS/2 - 1 and TAPS/2
+            float x = (float)(k - (TAPS / 2 - 1)) - (float)p / PHASES;
+            float y = (float)M_PI * cutoff * x;
+            float sinc = (x == 0.0f) ? 1.0f : sinf(y) / y;
+            float w = 2.0f * (float)M_PI * x / TAPS;
+            float blackman = (fabsf(x) < TAPS / 2) ? 0.42f + 0.5f * cosf(w) + 0.08f * cosf(2.0f * w) : 0.0f;
+            taps[k] = sinc * blackman;
+            sum += taps[k];
+        }
+
+        // Rounding error goes to the largest tap so DC passes exactly
+        int16_t* c = g_coefs + p * TAPS;
+        int total = 0;
+        for (int k = 0; k < TAPS; k++) {
+            c[k] = (int16_t)lrintf(taps[k] / sum * (1 << COEF_BITS));
+            total += c[k];
+        }
+        c[(p < PHASES / 2) ? TAPS / 2 - 1 : TAPS / 2] += (int16_t)((1 << COEF_BITS) - total);
+    }
+}
+
+int resample_init(void) {
+    g_coefs = (int16_t*)mem_alloc((PHASES + 1) * TAPS * sizeof(int16_t), MEM_INTERNAL);
+    g_out = (int16_t*)mem_alloc(RESAMPLE_OUT_FRAMES * MAX_CHANNELS * sizeof(int16_t), MEM_INTERNAL);
+    if (!g_coefs || !g_out) {
+        asp_log_error("musicplayer", "Failed to allocate resampler");
+        resample_cleanup();
+        return -1;
+    }
+    g_in_rate = 0;
+    g_out_rate = 0;
+    resample_reset();
+    return 0;
+}
+
+void resample_cleanup(void) {
+    free(g_coefs);
+    g_coefs = NULL;
+    free(g_out);
+    g_out = NULL;
+}
+
+void resample_start(uint32_t in_rate, uint32_t out_rate, int channels) {
+    if (in_rate != g_in_rate || out_rate != g_out_rate) {
+        g_in_rate = in_rate;
+        g_out_rate = out_rate;
+        g_step = ((uint64_t)in_rate << 32) / out_rate;
+        build_filter();
+        asp_log_info("musicplayer", "Resampling %u Hz to %u Hz", (unsigned)in_rate, (unsigned)out_rate);
+    }
+    g_channels = (channels < MAX_CHANNELS) ? channels : MAX_CHANNELS;
+    resample_reset();
+}
+
+void resample_reset(void) {
+    memset(g_history, 0, sizeof(g_history));
+    g_pos = 0;
+    g_frac = POS_ONE;
+}
+
+uint32_t resample_run(const int16_t* in, uint32_t frames, uint32_t* used, const int16_t** out) {
+    int channels = g_channels;
+    int16_t* dst = g_out;
+    uint32_t produced = 0;
+    uint32_t taken = 0;
+
+    for (;;) {
+        // Every output due before the next input sample
+        while (g_frac < POS_ONE) {
+            if (produced == RESAMPLE_OUT_FRAMES) goto done;
+
+            // Filter for this offset, between the two nearest phases
+            const int16_t* c0 = g_coefs + (uint32_t)(g_frac >> (32 - PHASE_BITS)) * TAPS;
+            const int16_t* c1 = c0 + TAPS;
+            int32_t t = (int32_t)((g_frac >> (32 - PHASE_BITS - INTERP_BITS)) & ((1 << INTERP_BITS) - 1));
+            int16_t c[TAPS];
+            for (int k = 0; k < TAPS; k++) {
+                c[k] = (int16_t)(c0[k] + (((c1[k] - c0[k]) * t) >> INTERP_BITS));
+            }
+
+            for (int ch = 0; ch < channels; ch++) {
+                const int16_t* h = g_history[ch] + g_pos;
+                int32_t acc = 1 << (COEF_BITS - 1);
+                for (int k = 0; k < TAPS; k++) {
+                    acc += (int32_t)h[k] * c[k];
+                }
+                *dst++ = saturate(acc >> COEF_BITS);
+            }
+            produced++;
+            g_frac += g_step;
+        }
+        if (taken == frames) break;
+
+        // Shift one input sample frame into the window
+        for (int ch = 0; ch < channels; ch++) {
+            int16_t s = in[taken * channels + ch];
+            g_history[ch][g_pos] = s;
+            g_history[ch][g_pos + TAPS] = s;
+        }
+        g_pos = (g_pos + 1) % TAPS;
+        g_frac -= POS_ONE;
+        taken++;
+    }
+
+done:
+    *used = taken;
+    *out = g_out;
+    return produced;
+}
@@ -0,0 +1,37 @@
+// SPDX-License-Identifier: MIT
+// Music Player Plugin - Output Resampler
+// Polyphase windowed-sinc resampler between the PCM ring and I2S, so songs of
+// any sample rate play at one fixed I2S rate (MUSICPLAYER_OUTPUT_RATE) and the
+// I2S clock is never reconfigured between tracks. 16 taps in Q14 at 128
+// phases, interpolated between them: 16 multiply-adds per output sample and
+// channel (plus 16 for the filter), and a passband to 90% of the lower of the
+// two Nyquist frequencies.
+// Only the output thread uses it.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Output sample frames produced per resample_run() call at most
+#define RESAMPLE_OUT_FRAMES  1152
+
+// Allocate the filter table and output buffer (internal SRAM)
+// Returns 0 on success, -1 on failure
+int resample_init(void);
+
+// Free the resampler
+void resample_cleanup(void);
+
+// Convert from in_rate to out_rate with channels (1-2) channels from now on;
+// rebuilds the filter if the rates changed and clears the history
+void resample_start(uint32_t in_rate, uint32_t out_rate, int channels);
+
+// Forget past input (after a seek or a cut), keeping the filter
+void resample_reset(void);
+
+// Resample up to frames input sample frames from in into the output buffer
+// *used receives the input frames taken, *out the output (valid until the
+// next call); returns the output frames, at most RESAMPLE_OUT_FRAMES
+// Call again with the rest while *used < frames
+uint32_t resample_run(const int16_t* in, uint32_t frames, uint32_t* used, const int16_t** out);
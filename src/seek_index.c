@@ -0,0 +1,242 @@
+// SPDX-License-Identifier: MIT
+// Music Player Plugin - Seek Index
+// Point k holds the file offset of frame k * step. The scan reads the file
+// through its own FILE in small blocks and only parses 4-byte frame headers.
+
+#include "seek_index.h"
+#include "mp3_info.h"
+#include "readahead.h"
+#include "mem.h"
+#include "tanmatsu_plugin.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+// Below the read-ahead I/O thread (4): playback always wins the SD card
+#define SCAN_STACK_SIZE     (4 * 1024)
+#define SCAN_PRIORITY       3
+
+// Bytes read per fread, and the pause after each read
+#define SCAN_BLOCK          4096
+#define SCAN_PAUSE_MS       2
+
+// Give up after this many bytes without a frame header (trailing tags, corrupt data)
+#define SCAN_MAX_LOST       (64 * 1024)
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_cond = PTHREAD_COND_INITIALIZER;  // Signalled on start/clear/stop
+
+static uint32_t* g_points = NULL;
+static uint32_t g_count = 0;
+static uint32_t g_step = SEEK_INDEX_STEP;
+static uint32_t g_scanned = 0;   // Frames whose offsets are known
+static bool g_done = false;      // Scan reached the end of the file
+
+// Bumped by start/clear so a running scan notices it is stale
+static uint32_t g_generation = 0;
+static bool g_job_pending = false;
+static char g_path[READAHEAD_PATH_MAX];
+static uint64_t g_first = 0;
+
+static uint8_t g_buf[SCAN_BLOCK];
+
+static pthread_t g_thread;
+static bool g_running = false;
+static bool g_should_stop = false;
+
+// Record the offset of frame if it falls on the index grid (lock held)
+static void add_point(uint32_t frame, uint64_t offset) {
+    if (frame != g_count * g_step) return;
+    if (g_count == SEEK_INDEX_POINTS) {
+        // Full: keep every other point and double the spacing
+        for (uint32_t i = 0; i < SEEK_INDEX_POINTS / 2; i++) {
+            g_points[i] = g_points[i * 2];
+        }
+        g_count = SEEK_INDEX_POINTS / 2;
+        g_step *= 2;
+        if (frame != g_count * g_step) return;
+    }
+    g_points[g_count++] = (uint32_t)offset;
+}
+
+static void scan_file(FILE* file, uint64_t pos, uint32_t generation) {
+    uint64_t buf_off = 0;
+    size_t buf_len = 0;
+    uint32_t frame = 0;
+    uint32_t rate = 0;
+    uint32_t step = SEEK_INDEX_STEP;
+    size_t lost = 0;
+
+    while (true) {
+        if (pos < buf_off || pos + 4 > buf_off + buf_len) {
+            // Publish progress and stop if the file was replaced meanwhile
+            pthread_mutex_lock(&g_lock);
+            bool stale = g_should_stop || generation != g_generation;
+            if (!stale) g_scanned = frame;
+            pthread_mutex_unlock(&g_lock);
+            if (stale) return;
+
+            asp_plugin_delay_ms(SCAN_PAUSE_MS);
+            buf_off = pos & ~(uint64_t)511;
+            if (fseek(file, (long)buf_off, SEEK_SET) != 0) break;
+            buf_len = fread(g_buf, 1, SCAN_BLOCK, file);
+            if (pos + 4 > buf_off + buf_len) break;
+        }
+
+        uint32_t hz;
+        size_t size = mp3_info_frame_bytes(g_buf + (pos - buf_off), &hz);
+        if (size == 0 || (rate != 0 && hz != rate)) {
+            // Lost sync - search for the next header byte by byte
+            if (++lost > SCAN_MAX_LOST) break;
+            pos++;
+            continue;
+        }
+        rate = hz;
+        lost = 0;
+
+        if (frame % step == 0) {
+            pthread_mutex_lock(&g_lock);
+            if (generation == g_generation) {
+                add_point(frame, pos);
+                step = g_step;
+            }
+            pthread_mutex_unlock(&g_lock);
+        }
+        pos += size;
+        frame++;
+    }
+
+    pthread_mutex_lock(&g_lock);
+    if (generation == g_generation) {
+        g_scanned = frame;
+        g_done = true;
+        asp_log_info("musicplayer", "Seek index: %u frames, %u points every %u frames",
+                    (unsigned)frame, (unsigned)g_count, (unsigned)g_step);
+    }
+    pthread_mutex_unlock(&g_lock);
+}
+
+static void* scan_thread_func(void* arg) {
+    (void)arg;
+    char path[READAHEAD_PATH_MAX];
+
+    pthread_mutex_lock(&g_lock);
+    while (!g_should_stop) {
+        if (!g_job_pending) {
+            pthread_cond_wait(&g_cond, &g_lock);
+            continue;
+        }
+        g_job_pending = false;
+        uint32_t generation = g_generation;
+        uint64_t first = g_first;
+        memcpy(path, g_path, sizeof(path));
+        pthread_mutex_unlock(&g_lock);
+
+        FILE* file = fopen(path, "rb");
+        if (file) {
+            scan_file(file, first, generation);
+            fclose(file);
+        } else {
+            asp_log_warn("musicplayer", "Seek index: cannot open %s", path);
+        }
+
+        pthread_mutex_lock(&g_lock);
+    }
+    pthread_mutex_unlock(&g_lock);
+    return NULL;
+}
+
+int seek_index_init(void) {
+    g_points = (uint32_t*)mem_alloc(SEEK_INDEX_POINTS * sizeof(uint32_t), MEM_PSRAM);
+    if (!g_points) {
+        asp_log_error("musicplayer", "Failed to allocate seek index (%d bytes)",
+                     (int)(SEEK_INDEX_POINTS * sizeof(uint32_t)));
+        return -1;
+    }
+
+    g_count = 0;
+    g_step = SEEK_INDEX_STEP;
+    g_scanned = 0;
+    g_done = false;
+    g_job_pending = false;
+    g_should_stop = false;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, SCAN_STACK_SIZE);
+    struct sched_param param = { .sched_priority = SCAN_PRIORITY };
+    pthread_attr_setschedparam(&attr, &param);
+    int err = pthread_create(&g_thread, &attr, scan_thread_func, NULL);
+    pthread_attr_destroy(&attr);
+
+    if (err != 0) {
+        asp_log_error("musicplayer", "Failed to create seek index thread: %d", err);
+        free(g_points);
+        g_points = NULL;
+        return -1;
+    }
+
+    g_running = true;
+    return 0;
+}
+
+void seek_index_cleanup(void) {
+    if (g_running) {
+        pthread_mutex_lock(&g_lock);
+        g_should_stop = true;
+        g_generation++;
+        pthread_cond_broadcast(&g_cond);
+        pthread_mutex_unlock(&g_lock);
+        pthread_join(g_thread, NULL);
+        g_running = false;
+    }
+
+    if (g_points) {
+        free(g_points);
+        g_points = NULL;
+    }
+}
+
+void seek_index_start(const char* path, uint64_t first_frame) {
+    pthread_mutex_lock(&g_lock);
+    g_generation++;
+    g_count = 0;
+    g_step = SEEK_INDEX_STEP;
+    g_scanned = 0;
+    g_done = false;
+    strncpy(g_path, path, sizeof(g_path) - 1);
+    g_path[sizeof(g_path) - 1] = '\0';
+    g_first = first_frame;
+    g_job_pending = true;
+    pthread_cond_broadcast(&g_cond);
+    pthread_mutex_unlock(&g_lock);
+}
+
+void seek_index_clear(void) {
+    pthread_mutex_lock(&g_lock);
+    g_generation++;
+    g_count = 0;
+    g_step = SEEK_INDEX_STEP;
+    g_scanned = 0;
+    g_done = false;
+    g_job_pending = false;
+    pthread_mutex_unlock(&g_lock);
+}
+
+bool seek_index_lookup(uint32_t frame, uint32_t* out_frame, uint64_t* out_offset) {
+    bool found = false;
+
+    pthread_mutex_lock(&g_lock);
+    if (g_count > 0 && (frame < g_scanned || g_done)) {
+        uint32_t k = frame / g_step;
+        if (k >= g_count) k = g_count - 1;
+        *out_frame = k * g_step;
+        *out_offset = g_points[k];
+        found = true;
+    }
+    pthread_mutex_unlock(&g_lock);
+
+    return found;
+}
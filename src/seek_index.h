@@ -0,0 +1,33 @@
+// SPDX-License-Identifier: MIT
+// Music Player Plugin - Seek Index
+// Sparse frame-offset index of the current file, built by a low-priority thread
+// that walks the frame headers (no decoding). Seeks are exact once the scan has
+// passed the target; before that a VBR TOC or the bitrate gives an estimate.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Index capacity; when it fills up every other point is dropped and the spacing doubles
+#define SEEK_INDEX_POINTS   4096
+
+// Initial spacing in frames between index points
+#define SEEK_INDEX_STEP     8
+
+// Allocate the index and start the scan thread
+// Returns 0 on success, -1 on failure
+int seek_index_init(void);
+
+// Stop the scan thread and free the index
+void seek_index_cleanup(void);
+
+// Start indexing path; frame 0 is the frame at file offset first_frame
+void seek_index_start(const char* path, uint64_t first_frame);
+
+// Stop indexing and forget the current file
+void seek_index_clear(void);
+
+// Find the indexed frame closest to (at or before) frame
+// Returns false if the scan has not reached frame yet
+bool seek_index_lookup(uint32_t frame, uint32_t* out_frame, uint64_t* out_offset);
@@ -0,0 +1,116 @@
+// SPDX-License-Identifier: MIT
+// Music Player Plugin - Playback Statistics
+
+#include "stats.h"
+#include "tanmatsu_plugin.h"
+#include <string.h>
+#include <time.h>
+
+static const char* const g_timer_names[STATS_TIMER_COUNT] = {
+    "decode", "sd read", "i2s write", "resample",
+};
+
+static const char* const g_level_names[STATS_LEVEL_COUNT] = {
+    "pcm ring slots", "read-ahead bytes",
+};
+
+static const char* const g_counter_names[STATS_COUNTER_COUNT] = {
+    "underruns", "read-ahead stalls", "clipped samples", "priority boosts", "damaged frames",
+};
+
+static stats_snapshot_t g_stats;
+static uint64_t g_reset_us = 0;
+
+uint64_t stats_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+void stats_reset(void) {
+    memset(&g_stats, 0, sizeof(g_stats));
+    g_reset_us = stats_now_us();
+}
+
+void stats_time(stats_timer_t timer, uint64_t start_us) {
+    uint64_t elapsed = stats_now_us() - start_us;
+    uint32_t us = (elapsed > UINT32_MAX) ? UINT32_MAX : (uint32_t)elapsed;
+    stats_hist_t* hist = &g_stats.timers[timer];
+
+    unsigned bucket = 0;
+    while (bucket < STATS_BUCKETS - 1 && (us >> bucket) != 0) {
+        bucket++;
+    }
+
+    hist->count++;
+    hist->total_us += us;
+    if (us > hist->max_us) hist->max_us = us;
+    hist->buckets[bucket]++;
+}
+
+void stats_level(stats_level_t level, uint32_t value) {
+    stats_fill_t* fill = &g_stats.levels[level];
+    if (fill->samples == 0 || value < fill->min) fill->min = value;
+    fill->samples++;
+    fill->total += value;
+}
+
+void stats_count(stats_counter_t counter) {
+    g_stats.counters[counter]++;
+}
+
+void stats_snapshot(stats_snapshot_t* out) {
+    memcpy(out, &g_stats, sizeof(*out));
+    out->elapsed_us = stats_now_us() - g_reset_us;
+}
+
+uint32_t stats_percentile_us(const stats_hist_t* hist, unsigned percent) {
+    if (hist->count == 0) return 0;
+
+    uint64_t target = ((uint64_t)hist->count * percent + 99) / 100;
+    uint64_t seen = 0;
+    for (unsigned bucket = 0; bucket < STATS_BUCKETS - 1; bucket++) {
+        seen += hist->buckets[bucket];
+        if (seen >= target) return 1u << bucket;
+    }
+    return hist->max_us;
+}
+
+unsigned stats_load_percent(const stats_snapshot_t* snap, stats_timer_t timer) {
+    if (snap->elapsed_us == 0) return 0;
+    return (unsigned)(snap->timers[timer].total_us * 100 / snap->elapsed_us);
+}
+
+void stats_dump(void) {
+    stats_snapshot_t snap;
+    stats_snapshot(&snap);
+
+    asp_log_info("musicplayer", "Stats over %u ms:", (unsigned)(snap.elapsed_us / 1000));
+
+    for (int t = 0; t < STATS_TIMER_COUNT; t++) {
+        const stats_hist_t* hist = &snap.timers[t];
+        if (hist->count == 0) continue;
+
+        asp_log_info("musicplayer", "  %s: %u calls, avg %u us, p50 <%u us, p99 <%u us, max %u us, load %u%%",
+                     g_timer_names[t], (unsigned)hist->count,
+                     (unsigned)(hist->total_us / hist->count),
+                     (unsigned)stats_percentile_us(hist, 50), (unsigned)stats_percentile_us(hist, 99),
+                     (unsigned)hist->max_us, stats_load_percent(&snap, (stats_timer_t)t));
+        for (int b = 0; b < STATS_BUCKETS; b++) {
+            if (hist->buckets[b] == 0) continue;
+            asp_log_info("musicplayer", "    %s%u us: %u", (b < STATS_BUCKETS - 1) ? "<" : ">=",
+                         1u << ((b < STATS_BUCKETS - 1) ? b : b - 1), (unsigned)hist->buckets[b]);
+        }
+    }
+
+    for (int l = 0; l < STATS_LEVEL_COUNT; l++) {
+        const stats_fill_t* fill = &snap.levels[l];
+        if (fill->samples == 0) continue;
+        asp_log_info("musicplayer", "  %s: min %u, avg %u", g_level_names[l],
+                     (unsigned)fill->min, (unsigned)(fill->total / fill->samples));
+    }
+
+    for (int c = 0; c < STATS_COUNTER_COUNT; c++) {
+        asp_log_info("musicplayer", "  %s: %u", g_counter_names[c], (unsigned)snap.counters[c]);
+    }
+}
@@ -0,0 +1,83 @@
+// SPDX-License-Identifier: MIT
+// Music Player Plugin - Playback Statistics
+// Microsecond latency histograms for the decode, SD read and I2S write paths,
+// buffer fill levels and event counters. Each metric has a single writer
+// thread; readers take a snapshot, which may be slightly torn while playing.
+
+#pragma once
+
+#include <stdint.h>
+
+// Histogram buckets: bucket 0 counts durations below 1 us, bucket k those in
+// [2^(k-1), 2^k) us; the last bucket also takes everything longer
+#define STATS_BUCKETS   22
+
+typedef enum {
+    STATS_DECODE,       // One decode step of the track's decoder (decoder thread)
+    STATS_READ,         // fread of one read-ahead chunk (I/O thread)
+    STATS_WRITE,        // asp_audio_write blocking time (output thread)
+    STATS_RESAMPLE,     // resample_run, with MUSICPLAYER_OUTPUT_RATE (output thread)
+    STATS_TIMER_COUNT,
+} stats_timer_t;
+
+typedef enum {
+    STATS_LEVEL_PCM,        // Queued PCM ring slots, sampled per output frame
+    STATS_LEVEL_READAHEAD,  // Buffered stream bytes, sampled per decoded frame
+    STATS_LEVEL_COUNT,
+} stats_level_t;
+
+typedef enum {
+    STATS_UNDERRUN,     // Output thread found the PCM ring empty while playing
+    STATS_READ_STALL,   // Decoder waited for the read-ahead
+    STATS_CLIPPED,      // Saturated output samples (only with MUSICPLAYER_CLIP_METER)
+    STATS_PRIORITY_BOOST,  // Decoder raised because the PCM ring ran low
+    STATS_DAMAGED,      // Decode steps that skipped damaged stream data (decoder thread)
+    STATS_COUNTER_COUNT,
+} stats_counter_t;
+
+typedef struct {
+    uint32_t count;
+    uint32_t max_us;
+    uint64_t total_us;
+    uint32_t buckets[STATS_BUCKETS];
+} stats_hist_t;
+
+typedef struct {
+    uint32_t samples;
+    uint32_t min;
+    uint64_t total;
+} stats_fill_t;
+
+typedef struct {
+    stats_hist_t timers[STATS_TIMER_COUNT];
+    stats_fill_t levels[STATS_LEVEL_COUNT];
+    uint32_t counters[STATS_COUNTER_COUNT];
+    uint64_t elapsed_us;    // Time since the last reset
+} stats_snapshot_t;
+
+// Monotonic time in microseconds
+uint64_t stats_now_us(void);
+
+// Clear all metrics (done when a new song is started)
+void stats_reset(void);
+
+// Record the time since start_us (from stats_now_us) for timer
+void stats_time(stats_timer_t timer, uint64_t start_us);
+
+// Record a sample of a buffer fill level
+void stats_level(stats_level_t level, uint32_t value);
+
+// Count one event
+void stats_count(stats_counter_t counter);
+
+// Copy the current metrics
+void stats_snapshot(stats_snapshot_t* out);
+
+// Upper bound in us of the bucket holding the given percentile (0-100)
+uint32_t stats_percentile_us(const stats_hist_t* hist, unsigned percent);
+
+// Share of the elapsed time spent in timer, in percent
+unsigned stats_load_percent(const stats_snapshot_t* snap, stats_timer_t timer);
+
+// Log all metrics, including the non-empty histogram buckets
+void stats_dump(void);
@@ -0,0 +1,101 @@
+// SPDX-License-Identifier: MIT
+// Music Player Plugin - Level Tap
+
+#include "tap.h"
+#include "pcm_ring.h"
+#include "../include/music_player.h"
+#include "tanmatsu_plugin.h"
+#include <math.h>
+#include <string.h>
+
+_Static_assert(MUSIC_PLAYER_BANDS == PCM_RING_BANDS, "Level tap and PCM ring disagree on the bands");
+
+// Reads of the seqlock given up on when they keep overlapping a write
+#define READ_TRIES  4
+
+// Sequence lock: odd while the output thread writes g_levels
+static uint32_t g_sequence = 0;
+static music_player_levels_t g_levels;
+static uint32_t g_serial = 0;
+static bool g_silent = true;
+
+static void publish(const music_player_levels_t* levels) {
+    uint32_t sequence = g_sequence;
+    __atomic_store_n(&g_sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(&g_levels, levels, sizeof(g_levels));
+    __atomic_store_n(&g_sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+void tap_publish(const int16_t* samples, uint32_t frames, int channels, uint32_t rate, const uint16_t* bands) {
+#if MUSICPLAYER_LEVEL_TAP
+    if (frames == 0 || channels < 1 || channels > 2) return;
+
+    int32_t peak[2] = { 0, 0 };
+    uint64_t square[2] = { 0, 0 };
+    for (uint32_t i = 0; i < frames; i++) {
+        for (int ch = 0; ch < channels; ch++) {
+            int32_t s = *samples++;
+            int32_t a = (s < 0) ? -s : s;
+            if (a > peak[ch]) peak[ch] = a;
+            square[ch] += (uint64_t)(s * s);
+        }
+    }
+
+    music_player_levels_t levels;
+    memset(&levels, 0, sizeof(levels));
+    levels.serial = ++g_serial;
+    levels.tick_ms = asp_plugin_get_tick_ms();
+    levels.rate = rate;
+    levels.channels = (uint8_t)channels;
+    float mean_square = 0.0f;
+    for (int ch = 0; ch < 2; ch++) {
+        int src = (ch < channels) ? ch : 0;
+        float ms = (float)square[src] / (float)frames;
+        levels.peak[ch] = (uint16_t)((peak[src] > 32767) ? 32767 : peak[src]);
+        levels.rms[ch] = (uint16_t)sqrtf(ms);
+        mean_square += ms * 0.5f;
+    }
+
+    // The frame's energy split by the decoder's shares
+    if (bands) {
+        levels.has_bands = true;
+        for (int b = 0; b < MUSIC_PLAYER_BANDS; b++) {
+            levels.bands[b] = (uint16_t)sqrtf(mean_square * (float)bands[b] * (1.0f / 65536.0f));
+        }
+    }
+
+    publish(&levels);
+    g_silent = false;
+#else
+    (void)samples;
+    (void)frames;
+    (void)channels;
+    (void)rate;
+    (void)bands;
+#endif
+}
+
+void tap_clear(void) {
+#if MUSICPLAYER_LEVEL_TAP
+    if (g_silent) return;
+    music_player_levels_t levels;
+    memset(&levels, 0, sizeof(levels));
+    levels.serial = ++g_serial;
+    levels.tick_ms = asp_plugin_get_tick_ms();
+    publish(&levels);
+    g_silent = true;
+#endif
+}
+
+bool music_player_get_levels(music_player_levels_t* out) {
+    for (int i = 0; i < READ_TRIES; i++) {
+        uint32_t before = __atomic_load_n(&g_sequence, __ATOMIC_ACQUIRE);
+        if (before == 0) return false;
+        if (before & 1) continue;
+        memcpy(out, &g_levels, sizeof(*out));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&g_sequence, __ATOMIC_RELAXED) == before) return true;
+    }
+    return false;
+}
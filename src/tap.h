@@ -0,0 +1,25 @@
+// SPDX-License-Identifier: MIT
+// Music Player Plugin - Level Tap
+// Peak, RMS and a coarse spectrum of what is being played, for VU meters and
+// visualizers (music_player_get_levels). The output thread publishes each frame
+// as it goes to I2S; readers never block it. The spectrum needs no transform of
+// its own: the MP3 decoder sums the energy of minimp3's subband samples before
+// synthesis, and the shares travel with the frame through the PCM ring.
+
+#pragma once
+
+#include <stdint.h>
+
+// Build option: 0 leaves out the level tap (and the MP3 subband energy sums)
+#ifndef MUSICPLAYER_LEVEL_TAP
+#define MUSICPLAYER_LEVEL_TAP 1
+#endif
+
+// Measure and publish one frame of interleaved PCM
+// bands is its PCM_RING_BANDS energy shares (Q16), NULL if not known
+// Output thread only
+void tap_publish(const int16_t* samples, uint32_t frames, int channels, uint32_t rate, const uint16_t* bands);
+
+// Publish silence (paused, stopped or nothing heard); cheap when already silent
+// Output thread only
+void tap_clear(void);
@@ -0,0 +1,28 @@
+// SPDX-License-Identifier: MIT
+// Music Player Plugin - Thread Helpers
+
+#pragma once
+
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+
+// Absolute CLOCK_REALTIME time timeout_ms from now, for pthread_cond_timedwait
+static inline struct timespec deadline_ms(uint32_t timeout_ms) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += timeout_ms / 1000;
+    ts.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    return ts;
+}
+
+// Wait on a condition variable for at most timeout_ms
+// Returns 0 when signalled, ETIMEDOUT on timeout
+static inline int cond_wait_ms(pthread_cond_t* cond, pthread_mutex_t* mutex, uint32_t timeout_ms) {
+    struct timespec ts = deadline_ms(timeout_ms);
+    return pthread_cond_timedwait(cond, mutex, &ts);
+}
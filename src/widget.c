@@ -2,6 +2,7 @@
 // Music Player Plugin - Status Bar Widget
 
 #include "widget.h"
+#include "playlist.h"
 #include "../include/music_player.h"
 #include "tanmatsu_plugin.h"
 #include "pax_gfx.h"
@@ -10,6 +11,15 @@
 extern const pax_font_t chakrapetchmedium;
 
 static int g_widget_id = -1;
+static widget_time_t g_time = WIDGET_TIME_OFF;
+
+// Status text as last drawn; rebuilt only when the state version or the shown
+// second changes, since the launcher redraws the header far more often
+static char g_text[40];
+static int g_text_width = 0;
+static bool g_text_valid = false;
+static uint32_t g_text_version = 0;
+static uint32_t g_text_second = 0;
 
 // Format integer to string (snprintf not exported to plugins)
 static int int_to_str(char* buf, int val) {
@@ -45,72 +55,113 @@ static int int_to_str(char* buf, int val) {
     return len;
 }
 
-// Widget callback - draws status in header bar
-// Returns width used
-static int status_widget_callback(pax_buf_t* buffer, int x_right, int y, int height, void* user_data) {
-    (void)user_data;
-    music_player_state_t* state = music_player_get_state();
+// Append helpers; all leave room for the terminator and drop what does not fit
+static int append_str(int len, const char* str) {
+    while (*str && len < (int)sizeof(g_text) - 1) {
+        g_text[len++] = *str++;
+    }
+    return len;
+}
 
-    // Don't show if not active
-    if (state->state == PLAYBACK_STOPPED && state->playlist.count == 0) {
-        return 0;
+static int append_int(int len, int val) {
+    char num_buf[12];
+    int_to_str(num_buf, val);
+    return append_str(len, num_buf);
+}
+
+// m:ss
+static int append_time(int len, uint32_t seconds) {
+    len = append_int(len, (int)(seconds / 60));
+    len = append_str(len, (seconds % 60 < 10) ? ":0" : ":");
+    return append_int(len, (int)(seconds % 60));
+}
+
+// Time shown for the current song, in seconds
+// Sets remaining to true if it counts down
+static uint32_t shown_seconds(const music_player_state_t* state, bool* remaining) {
+    uint32_t position_ms = state->current_position_ms;
+    *remaining = false;
+    if (g_time == WIDGET_TIME_REMAINING) {
+        // Elapsed time until the duration scan has reached the song
+        uint32_t duration_ms = playlist_get_duration_ms(state->playlist.current_index);
+        if (duration_ms > 0) {
+            *remaining = true;
+            // Round up, so the count reaches 0:00 at the end
+            return (duration_ms > position_ms) ? (duration_ms - position_ms + 999) / 1000 : 0;
+        }
     }
+    return position_ms / 1000;
+}
 
-    // Build status text
-    char text[32];
-    int text_len = 0;
+static void build_text(const music_player_state_t* state) {
+    int len = 0;
 
     // Play/pause indicator
     if (state->state == PLAYBACK_PLAYING) {
-        text[text_len++] = '>';  // Play symbol
-        text[text_len++] = ' ';
+        len = append_str(len, "> ");  // Play symbol
     } else if (state->state == PLAYBACK_PAUSED) {
-        text[text_len++] = '|';
-        text[text_len++] = '|';
-        text[text_len++] = ' ';
+        len = append_str(len, "|| ");
     } else {
-        text[text_len++] = '-';
-        text[text_len++] = ' ';
+        len = append_str(len, "- ");
     }
 
     // Track number
-    char num_buf[8];
-    int num_len = int_to_str(num_buf, state->playlist.current_index + 1);
-    for (int i = 0; i < num_len; i++) {
-        text[text_len++] = num_buf[i];
+    len = append_int(len, state->playlist.current_index + 1);
+    len = append_str(len, "/");
+    len = append_int(len, state->playlist.count);
+
+    // Play time
+    if (g_time != WIDGET_TIME_OFF && state->state != PLAYBACK_STOPPED) {
+        bool remaining;
+        uint32_t seconds = shown_seconds(state, &remaining);
+        len = append_str(len, remaining ? " -" : " ");
+        len = append_time(len, seconds);
     }
 
-    text[text_len++] = '/';
+    // Add space and volume percentage
+    len = append_str(len, " ");
+    len = append_int(len, state->volume);
+    len = append_str(len, "%");
+    g_text[len] = '\0';
+
+    // Measured once per change instead of estimated per character
+    pax_vec2f size = pax_text_size(&chakrapetchmedium, 16, g_text);
+    g_text_width = (int)(size.x + 0.999f);
+}
 
-    num_len = int_to_str(num_buf, state->playlist.count);
-    for (int i = 0; i < num_len; i++) {
-        text[text_len++] = num_buf[i];
-    }
+// Widget callback - draws status in header bar
+// Returns width used
+static int status_widget_callback(pax_buf_t* buffer, int x_right, int y, int height, void* user_data) {
+    (void)user_data;
+    music_player_state_t* state = music_player_get_state();
 
-    // Add space and volume percentage
-    text[text_len++] = ' ';
-    num_len = int_to_str(num_buf, state->volume);
-    for (int i = 0; i < num_len; i++) {
-        text[text_len++] = num_buf[i];
+    // Don't show if not active
+    if (state->state == PLAYBACK_STOPPED && state->playlist.count == 0) {
+        return 0;
     }
-    text[text_len++] = '%';
 
-    text[text_len] = '\0';
+    // Read the version first: a change made while building is caught next time
+    uint32_t version = __atomic_load_n(&state->version, __ATOMIC_RELAXED);
+    uint32_t second = (g_time != WIDGET_TIME_OFF) ? state->current_position_ms / 1000 : 0;
+    if (!g_text_valid || version != g_text_version || second != g_text_second) {
+        g_text_version = version;
+        g_text_second = second;
+        g_text_valid = true;
+        build_text(state);
+    }
 
-    // Calculate width and draw
-    // Approximate character width for this font at size 16
-    int char_width = 8;
-    int text_width = text_len * char_width;
-    int text_x = x_right - text_width - 4;
+    int text_x = x_right - g_text_width - 4;
     int text_y = y + (height - 16) / 2;
 
     // Draw text
-    pax_draw_text(buffer, 0xFF340132, &chakrapetchmedium, 16, text_x, text_y, text);
+    pax_draw_text(buffer, 0xFF340132, &chakrapetchmedium, 16, text_x, text_y, g_text);
 
-    return text_width + 8;  // Width used including margins
+    return g_text_width + 8;  // Width used including margins
 }
 
-int widget_init(void) {
+int widget_init(widget_time_t time) {
+    g_time = (time < WIDGET_TIME_COUNT) ? time : WIDGET_TIME_OFF;
+    g_text_valid = false;
     g_widget_id = asp_plugin_status_widget_register(status_widget_callback, NULL);
     if (g_widget_id < 0) {
         asp_log_warn("musicplayer", "Failed to register status widget");
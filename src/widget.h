@@ -3,9 +3,17 @@
 
 #pragma once
 
+// Play time shown after the song number
+typedef enum {
+    WIDGET_TIME_OFF,
+    WIDGET_TIME_ELAPSED,
+    WIDGET_TIME_REMAINING,
+    WIDGET_TIME_COUNT,
+} widget_time_t;
+
 // Initialize and register status widget
 // Returns 0 on success, -1 on failure
-int widget_init(void);
+int widget_init(widget_time_t time);
 
 // Cleanup and unregister status widget
 void widget_cleanup(void);
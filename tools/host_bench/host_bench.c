@@ -0,0 +1,480 @@
+// SPDX-License-Identifier: MIT
+// Music Player Plugin - Host Benchmark
+// Plays each file through the real decoder pipeline (read-ahead, decoder and
+// output threads) with the I2S write replaced by a checksum, as fast as the
+// host allows. Reports per-stage timings from the stats module, decode speed,
+// stack high-water marks and a PCM checksum per file. A thread that uses more
+// stack than it asked for fails the run.
+//
+// Usage: host_bench [-q] [-o baseline.txt | -c baseline.txt] [-w DIR | -r DIR [-s DB] [-e LSB]] file.mp3...
+//   -o FILE  write the checksums to FILE
+//   -c FILE  compare the checksums with FILE; exit status 1 on any mismatch
+//   -w DIR   write the PCM of each file to DIR/<name>.pcm
+//   -r DIR   compare the PCM with DIR/<name>.pcm and report SNR and peak
+//            error; exit status 1 if a file is below the SNR limit
+//   -s DB    SNR limit for -r, default 60 dB
+//   -e LSB   also fail a file for -r whose peak error is above LSB
+//   -q       hide the pipeline's info log
+//
+// Checksums only hold within one decoder variant. To compare the fixed-point
+// decoder with the float one, write the PCM with a float build (-w) and read
+// it back with a fixed-point build (-r); to compare the vector backend with
+// scalar, add a peak error limit (-e) that float rounding stays within.
+//
+// A useful corpus covers CBR and VBR (Xing and VBRI), mono and stereo,
+// 22.05/44.1/48 kHz, MPEG-2 and free-format streams. Stack sizes are those of
+// the host ABI; use them to compare changes, not as ESP32-P4 figures.
+
+#include "tanmatsu_plugin.h"
+#include "audio.h"
+#include "stats.h"
+#include "../include/music_player.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <limits.h>
+#include <math.h>
+
+// Give up on a file that makes no progress for this long
+#define FILE_TIMEOUT_MS     60000
+
+// Default SNR limit for -r; the Q24 pipeline sits well above it
+#define DEFAULT_MIN_SNR_DB  60.0
+
+static music_player_state_t g_state;
+static bool g_quiet = false;
+
+// Output sink: FNV-1a over the PCM bytes of the current file
+static uint32_t g_checksum = 0;
+static uint64_t g_pcm_bytes = 0;
+static uint32_t g_rate = 0;
+
+// PCM reference of the current file (-w / -r)
+static FILE* g_pcm_out = NULL;
+static FILE* g_pcm_ref = NULL;
+static double g_signal_power = 0.0;
+static double g_error_power = 0.0;
+static int g_max_error = 0;
+static uint64_t g_ref_missing = 0;
+
+music_player_state_t* music_player_get_state(void) {
+    return &g_state;
+}
+
+static void log_line(char level, const char* fmt, va_list args) {
+    if (g_quiet && level == 'I') return;
+    fprintf(stderr, "%c ", level);
+    vfprintf(stderr, fmt, args);
+    fputc('\n', stderr);
+}
+
+void asp_log_info(const char* tag, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    log_line('I', fmt, args);
+    va_end(args);
+}
+
+void asp_log_warn(const char* tag, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    log_line('W', fmt, args);
+    va_end(args);
+}
+
+void asp_log_error(const char* tag, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    log_line('E', fmt, args);
+    va_end(args);
+}
+
+uint32_t asp_plugin_get_tick_ms(void) {
+    return (uint32_t)(stats_now_us() / 1000);
+}
+
+void asp_plugin_delay_ms(uint32_t ms) {
+    usleep(ms * 1000);
+}
+
+int asp_audio_set_rate(uint32_t rate_hz) {
+    g_rate = rate_hz;
+    return 0;
+}
+
+int asp_audio_get_volume(float* out_percentage) {
+    *out_percentage = g_state.volume;
+    return 0;
+}
+
+int asp_audio_set_volume(float percentage) {
+    return 0;
+}
+
+int asp_audio_set_amplifier(bool enabled) {
+    return 0;
+}
+
+int asp_audio_stop(void) {
+    return 0;
+}
+
+int asp_audio_start(void) {
+    return 0;
+}
+
+int asp_audio_write(void* samples, size_t samples_size, int64_t timeout_ms) {
+    const uint8_t* bytes = (const uint8_t*)samples;
+    uint32_t hash = g_checksum;
+    for (size_t i = 0; i < samples_size; i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    g_checksum = hash;
+    g_pcm_bytes += samples_size;
+
+    if (g_pcm_out) fwrite(samples, 1, samples_size, g_pcm_out);
+    if (g_pcm_ref) {
+        const int16_t* pcm = (const int16_t*)samples;
+        size_t count = samples_size / sizeof(int16_t);
+        int16_t ref[512];
+        while (count > 0) {
+            size_t want = count < 512 ? count : 512;
+            size_t got = fread(ref, sizeof(int16_t), want, g_pcm_ref);
+            for (size_t i = 0; i < got; i++) {
+                int error = pcm[i] - ref[i];
+                if (error < 0) error = -error;
+                if (error > g_max_error) g_max_error = error;
+                g_signal_power += (double)ref[i] * ref[i];
+                g_error_power += (double)error * error;
+            }
+            if (got < want) {
+                g_ref_missing += count - got;
+                break;
+            }
+            pcm += got;
+            count -= got;
+        }
+    }
+    return 0;
+}
+
+#ifdef HOST_BENCH_STACK_PAINT
+// Threads get a stack filled with a pattern; after they exit, the deepest
+// overwritten byte below the entry frame gives the peak stack use
+
+#define STACK_PATTERN       0xA5
+#define MAX_THREADS         16
+
+typedef struct {
+    void* (*fn)(void*);
+    void* arg;
+    uint8_t* base;
+    size_t size;
+    size_t requested;
+    uintptr_t entry_sp;
+} painted_thread_t;
+
+static painted_thread_t g_threads[MAX_THREADS];
+static int g_thread_count = 0;
+
+// Stack size last requested for an attribute object; glibc rejects sizes
+// below PTHREAD_STACK_MIN, so the attribute cannot be asked afterwards
+static const pthread_attr_t* g_sized_attr = NULL;
+static size_t g_sized_bytes = 0;
+
+int __real_pthread_create(pthread_t* thread, const pthread_attr_t* attr,
+                          void* (*fn)(void*), void* arg);
+int __real_pthread_attr_setstacksize(pthread_attr_t* attr, size_t size);
+
+int __wrap_pthread_attr_setstacksize(pthread_attr_t* attr, size_t size) {
+    g_sized_attr = attr;
+    g_sized_bytes = size;
+    return __real_pthread_attr_setstacksize(attr, size < PTHREAD_STACK_MIN ? PTHREAD_STACK_MIN : size);
+}
+
+static void* painted_entry(void* arg) {
+    painted_thread_t* t = (painted_thread_t*)arg;
+    volatile uint8_t marker = 0;
+    t->entry_sp = (uintptr_t)&marker;
+    return t->fn(t->arg);
+}
+
+int __wrap_pthread_create(pthread_t* thread, const pthread_attr_t* attr,
+                          void* (*fn)(void*), void* arg) {
+    size_t requested = (attr && attr == g_sized_attr) ? g_sized_bytes : 0;
+    if (g_thread_count == MAX_THREADS) {
+        return __real_pthread_create(thread, attr, fn, arg);
+    }
+
+    // Room for the libc thread descriptor and TLS on top of the requested size
+    size_t size = (requested > PTHREAD_STACK_MIN ? requested : PTHREAD_STACK_MIN) + 64 * 1024;
+    size = (size + 4095) & ~(size_t)4095;
+    uint8_t* base = (uint8_t*)aligned_alloc(4096, size);
+    if (!base) return __real_pthread_create(thread, attr, fn, arg);
+    memset(base, STACK_PATTERN, size);
+
+    painted_thread_t* t = &g_threads[g_thread_count++];
+    t->fn = fn;
+    t->arg = arg;
+    t->base = base;
+    t->size = size;
+    t->requested = requested;
+    t->entry_sp = 0;
+
+    pthread_attr_t painted;
+    pthread_attr_init(&painted);
+    pthread_attr_setstack(&painted, base, size);
+    int err = __real_pthread_create(thread, &painted, painted_entry, t);
+    pthread_attr_destroy(&painted);
+    return err;
+}
+
+// Log the stack peaks of all threads; call once they have been joined
+// Returns the number of threads that used more than they asked for
+static int report_stacks(void) {
+    int over = 0;
+    printf("\nstack high-water marks (host ABI):\n");
+    for (int i = 0; i < g_thread_count; i++) {
+        painted_thread_t* t = &g_threads[i];
+        size_t used = 0;
+        for (size_t off = 0; off < t->size; off++) {
+            if (t->base[off] != STACK_PATTERN) {
+                used = t->entry_sp - (uintptr_t)(t->base + off);
+                break;
+            }
+        }
+        bool is_over = t->requested && used > t->requested;
+        printf("  thread %d: %6zu bytes used of %6zu requested%s\n", i, used, t->requested,
+               is_over ? "  <-- over" : "");
+        if (is_over) over++;
+        free(t->base);
+    }
+    return over;
+}
+#endif // HOST_BENCH_STACK_PAINT
+
+static uint64_t stage_ns(const stats_hist_t* hist) {
+    return hist->count ? hist->total_us * 1000 / hist->count : 0;
+}
+
+// Play path to the end; returns 0 on success, -1 on error or timeout
+static int run_file(const char* path, stats_snapshot_t* snap, uint64_t* wall_us) {
+    g_checksum = 2166136261u;
+    g_pcm_bytes = 0;
+
+    uint64_t start = stats_now_us();
+    audio_play_file(path);
+
+    uint64_t last_progress = start;
+    uint64_t last_bytes = 0;
+    while (true) {
+        uint32_t events = audio_wait_events(10);
+        if (events & AUDIO_EVENT_ERROR) return -1;
+        if ((events & AUDIO_EVENT_FINISHED) && audio_is_finished()) break;
+
+        uint64_t now = stats_now_us();
+        if (g_pcm_bytes != last_bytes) {
+            last_bytes = g_pcm_bytes;
+            last_progress = now;
+        } else if (now - last_progress > (uint64_t)FILE_TIMEOUT_MS * 1000) {
+            audio_stop();
+            return -1;
+        }
+    }
+
+    *wall_us = stats_now_us() - start;
+    stats_snapshot(snap);
+    return 0;
+}
+
+static const char* base_name(const char* path) {
+    const char* slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+// Open DIR/<name>.pcm for the -w or -r mode; NULL on failure
+static FILE* open_pcm(const char* dir, const char* name, const char* mode) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s.pcm", dir, name);
+    FILE* file = fopen(path, mode);
+    if (!file) fprintf(stderr, "cannot open %s\n", path);
+    return file;
+}
+
+// SNR of the current file against its reference in dB, capped for a
+// bit-exact match
+static double pcm_snr_db(void) {
+    if (g_error_power == 0.0) return 200.0;
+    if (g_signal_power == 0.0) return 0.0;
+    return 10.0 * log10(g_signal_power / g_error_power);
+}
+
+// Checksum recorded for name in a baseline file; false if not listed
+static bool baseline_lookup(FILE* file, const char* name, uint32_t* out_checksum, uint64_t* out_bytes) {
+    char line[512];
+    rewind(file);
+    while (fgets(line, sizeof(line), file)) {
+        unsigned checksum;
+        unsigned long long bytes;
+        char listed[400];
+        if (sscanf(line, "%x %llu %399[^\n]", &checksum, &bytes, listed) == 3 &&
+            strcmp(listed, name) == 0) {
+            *out_checksum = checksum;
+            *out_bytes = bytes;
+            return true;
+        }
+    }
+    return false;
+}
+
+static int usage(const char* program) {
+    fprintf(stderr, "usage: %s [-q] [-o baseline | -c baseline] [-w dir | -r dir [-s db] [-e lsb]] file.mp3...\n",
+            program);
+    return 2;
+}
+
+int main(int argc, char** argv) {
+    const char* write_path = NULL;
+    const char* check_path = NULL;
+    const char* pcm_write_dir = NULL;
+    const char* pcm_ref_dir = NULL;
+    double min_snr_db = DEFAULT_MIN_SNR_DB;
+    int max_error = -1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "qo:c:w:r:s:e:")) != -1) {
+        switch (opt) {
+            case 'q': g_quiet = true; break;
+            case 'o': write_path = optarg; break;
+            case 'c': check_path = optarg; break;
+            case 'w': pcm_write_dir = optarg; break;
+            case 'r': pcm_ref_dir = optarg; break;
+            case 's': min_snr_db = atof(optarg); break;
+            case 'e': max_error = atoi(optarg); break;
+            default: return usage(argv[0]);
+        }
+    }
+    if (optind >= argc) return usage(argv[0]);
+
+    FILE* baseline_out = write_path ? fopen(write_path, "w") : NULL;
+    FILE* baseline_in = check_path ? fopen(check_path, "r") : NULL;
+    if ((write_path && !baseline_out) || (check_path && !baseline_in)) {
+        fprintf(stderr, "cannot open baseline file\n");
+        return 2;
+    }
+
+    g_state.volume = 50;
+    if (audio_init() != 0) {
+        fprintf(stderr, "audio_init failed\n");
+        return 2;
+    }
+
+    printf("%-24s %6s %8s %7s %9s %9s %9s %9s %9s  %s\n", "file", "rate", "frames", "x rt",
+           "frames/s", "decode", "max", "sd read", "i2s", "checksum");
+
+    int failures = 0;
+    uint64_t total_frames = 0;
+    uint64_t total_audio_us = 0;
+    uint64_t total_wall_us = 0;
+
+    for (int i = optind; i < argc; i++) {
+        const char* name = base_name(argv[i]);
+        stats_snapshot_t snap;
+        uint64_t wall_us = 0;
+
+        if (pcm_write_dir) g_pcm_out = open_pcm(pcm_write_dir, name, "wb");
+        if (pcm_ref_dir) g_pcm_ref = open_pcm(pcm_ref_dir, name, "rb");
+        g_signal_power = 0.0;
+        g_error_power = 0.0;
+        g_max_error = 0;
+        g_ref_missing = 0;
+
+        int result = run_file(argv[i], &snap, &wall_us);
+        bool has_ref = g_pcm_ref != NULL;
+        bool ref_longer = has_ref && fgetc(g_pcm_ref) != EOF;
+        if (g_pcm_out) fclose(g_pcm_out);
+        if (g_pcm_ref) fclose(g_pcm_ref);
+        g_pcm_out = NULL;
+        g_pcm_ref = NULL;
+
+        if (result != 0) {
+            printf("%-24.24s  FAILED\n", name);
+            failures++;
+            continue;
+        }
+
+        const stats_hist_t* decode = &snap.timers[STATS_DECODE];
+        uint64_t audio_us = (uint64_t)audio_get_position_ms() * 1000;
+        double realtime = wall_us ? (double)audio_us / (double)wall_us : 0.0;
+        double frames_per_s = wall_us ? decode->count * 1e6 / (double)wall_us : 0.0;
+
+        printf("%-24.24s %6u %8u %7.1f %9.0f %6lu ns %6u us %6lu ns %6lu ns  %08x",
+               name, (unsigned)g_rate, (unsigned)decode->count, realtime, frames_per_s,
+               (unsigned long)stage_ns(decode), (unsigned)decode->max_us,
+               (unsigned long)stage_ns(&snap.timers[STATS_READ]),
+               (unsigned long)stage_ns(&snap.timers[STATS_WRITE]), (unsigned)g_checksum);
+
+        if (baseline_out) {
+            fprintf(baseline_out, "%08x %llu %s\n", (unsigned)g_checksum,
+                    (unsigned long long)g_pcm_bytes, name);
+        }
+        if (baseline_in) {
+            uint32_t expected;
+            uint64_t expected_bytes;
+            if (!baseline_lookup(baseline_in, name, &expected, &expected_bytes)) {
+                printf("  (not in baseline)");
+            } else if (expected != g_checksum || expected_bytes != g_pcm_bytes) {
+                printf("  MISMATCH (expected %08x, %llu bytes)", (unsigned)expected,
+                       (unsigned long long)expected_bytes);
+                failures++;
+            }
+        }
+        if (pcm_ref_dir) {
+            double snr = pcm_snr_db();
+            printf("  snr %5.1f dB, max error %d", snr, g_max_error);
+            if (!has_ref || ref_longer || g_ref_missing > 0) {
+                printf("  LENGTH MISMATCH");
+                failures++;
+            } else if (snr < min_snr_db) {
+                printf("  BELOW %.0f dB", min_snr_db);
+                failures++;
+            } else if (max_error >= 0 && g_max_error > max_error) {
+                printf("  ABOVE %d LSB", max_error);
+                failures++;
+            }
+        }
+        printf("\n");
+
+        total_frames += decode->count;
+        total_audio_us += audio_us;
+        total_wall_us += wall_us;
+    }
+
+    audio_cleanup();
+
+    if (total_wall_us > 0) {
+        printf("\ntotal: %llu frames, %.1f x realtime, %.0f frames/s\n",
+               (unsigned long long)total_frames, (double)total_audio_us / (double)total_wall_us,
+               total_frames * 1e6 / (double)total_wall_us);
+    }
+#ifdef HOST_BENCH_STACK_PAINT
+    int stacks_over = report_stacks();
+    if (stacks_over > 0) {
+        printf("\n%d thread(s) over their stack size\n", stacks_over);
+        failures += stacks_over;
+    }
+#endif
+
+    if (baseline_out) fclose(baseline_out);
+    if (baseline_in) fclose(baseline_in);
+
+    if (failures > 0) {
+        printf("\n%d file(s) failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
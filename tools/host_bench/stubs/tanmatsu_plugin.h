@@ -0,0 +1,17 @@
+// SPDX-License-Identifier: MIT
+// Music Player Plugin - Host Benchmark
+// The subset of the plugin API used by the decoder pipeline, implemented by
+// host_bench.c so the pipeline builds without ESP-IDF.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+void asp_log_info(const char* tag, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+void asp_log_warn(const char* tag, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+void asp_log_error(const char* tag, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+uint32_t asp_plugin_get_tick_ms(void);
+void asp_plugin_delay_ms(uint32_t ms);